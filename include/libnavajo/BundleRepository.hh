@@ -0,0 +1,78 @@
+//********************************************************
+/**
+ * @file  BundleRepository.hh
+ *
+ * @brief Serves a memory-mapped bundle of web files
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef BUNDLEREPOSITORY_HH_
+#define BUNDLEREPOSITORY_HH_
+
+#include "libnavajo/GrDebug.hpp"
+
+#include "WebRepository.hh"
+
+#include "libnavajo/nvjBundle.h"
+#include "libnavajo/nvjRcu.h"
+#include <atomic>
+#include <memory>
+#include <string>
+
+/**
+ * BundleRepository - serves the files of a bundle generated by
+ * "navajoPrecompiler htmlRepository --bundle file.nvjb".
+ *
+ * The bundle is mapped in memory and the responses are sent from the
+ * mapping. Replacing the file (rename) publishes a new version: it is
+ * mapped by the next request, the responses in progress keep the
+ * previous mapping alive until they are sent.
+ */
+class BundleRepository : public WebRepository {
+  typedef std::shared_ptr<const NvjBundle> BundlePtr;
+
+  NvjRcuPtr<BundlePtr> bundle; // current mapping, nullptr if none
+  std::string          aliasName;
+  std::string          bundlePath;
+  unsigned             checkInterval;
+  std::atomic<time_t>  lastCheck;
+
+  void checkUpdate();
+
+public:
+  /**
+   * @param alias: the url prefix of the files
+   * @param path: the bundle file
+   * @param interval: the file is checked for replacement at most every
+   *   interval seconds, 0 to never reload it automatically
+   */
+  BundleRepository(const std::string &alias, const std::string &path, const unsigned interval = 1);
+  virtual ~BundleRepository() {};
+
+  /**
+   * Try to resolve an http request by requesting the BundleRepository.
+   * Inherited from class WebRepository
+   * called from WebServer::accept_request() method
+   * @param request: a pointer to the current request
+   * @param response: a pointer to the new generated response
+   * \return true if the repository contains the requested resource
+   */
+  bool getFile(HttpRequest *request, HttpResponse *response) override;
+
+  /**
+   * Free resources after use. Inherited from class WebRepository
+   * The content belongs to the mapping, released with the response.
+   */
+  inline void freeFile([[maybe_unused]] unsigned char *webpage) override {};
+
+  /**
+   * Map the bundle file again
+   * @return false if the file is invalid, the previous mapping is then kept
+   */
+  bool reload();
+};
+
+#endif
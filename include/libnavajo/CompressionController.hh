@@ -0,0 +1,156 @@
+//********************************************************
+/**
+ * @file  CompressionController.hh
+ *
+ * @brief Chooses the compression level of each response
+ *        from the server load, the payload size and
+ *        the mime type
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef COMPRESSIONCONTROLLER_HH_
+#define COMPRESSIONCONTROLLER_HH_
+
+#include <atomic>
+#include <string>
+
+/**
+ * CompressionController - process-wide compression policy.
+ *
+ * The load is the highest of the http workers utilization (busy/total)
+ * and the 1 minute load average divided by the number of cpus.
+ * Below the low watermark the maximal level is used, above the high
+ * watermark the payloads are sent uncompressed, in between the level
+ * decreases linearly from the maximal to the minimal level.
+ *
+ * The decisions are counted and can be exported in the Prometheus text
+ * format with getMetrics(), e.g. from a DynamicPage.
+ */
+class CompressionController {
+public:
+  enum SkipReason { SKIP_MIME = 0, SKIP_SIZE, SKIP_LOAD, SKIP_DISABLED, SKIP_REASON_COUNT };
+
+  static const int NO_COMPRESSION = -1;
+
+  /**
+   * getInstance - return the process-wide controller
+   */
+  static CompressionController *getInstance();
+
+  /**
+   * Choose the compression level for a payload
+   * @param size: the payload length
+   * @param mimetype: the payload mime type, nullptr if unknown (considered as compressible)
+   * @param minSize: payloads up to this length are sent as is
+   * @return the zlib level, or NO_COMPRESSION
+   */
+  int chooseLevel(const size_t size, const char *mimetype, const size_t minSize);
+
+  /**
+   * Choose the compression level of an http response
+   */
+  inline int chooseLevel(const size_t size, const char *mimetype) { return chooseLevel(size, mimetype, minSize); };
+
+  /**
+   * Choose the compression level of a websocket message
+   */
+  inline int chooseMessageLevel(const size_t size) { return chooseLevel(size, nullptr, minMessageSize); };
+
+  /**
+   * Account the result of a compression
+   * @param sizeIn: the payload length
+   * @param sizeOut: the compressed length
+   */
+  inline void recordCompressed(const size_t sizeIn, const size_t sizeOut) {
+    bytesIn.fetch_add(sizeIn, std::memory_order_relaxed);
+    bytesOut.fetch_add(sizeOut, std::memory_order_relaxed);
+  };
+
+  /**
+   * @return true if a payload of this mime type is worth compressing
+   */
+  static bool isCompressibleMimeType(const char *mimetype);
+
+  /**
+   * Workers accounting, used by the WebServer threads pool: a worker is busy
+   * from a request line to its response, not while waiting on a keep-alive
+   */
+  inline void addWorkers(const size_t nb) { workers.fetch_add(nb, std::memory_order_relaxed); };
+  inline void removeWorkers(const size_t nb) { workers.fetch_sub(nb, std::memory_order_relaxed); };
+  inline void workerBusy() { busyWorkers.fetch_add(1, std::memory_order_relaxed); };
+  inline void workerIdle() { busyWorkers.fetch_sub(1, std::memory_order_relaxed); };
+
+  /**
+   * @return the current load, between 0 and 1
+   */
+  double getLoad();
+
+  /**
+   * Enable or disable the load adaptation. When disabled, the maximal
+   * level is always used (default: enabled)
+   */
+  inline void setAdaptive(const bool a) { adaptive = a; };
+
+  /**
+   * Enable or disable the compression (default: enabled)
+   */
+  inline void setEnabled(const bool e) { enabled = e; };
+
+  /**
+   * Set the range of levels to use (default: 1 to 6)
+   */
+  void setLevels(const int minLevel, const int maxLevel);
+
+  /**
+   * Set the load watermarks (default: 0.5 and 0.9)
+   */
+  void setLoadWatermarks(const double low, const double high);
+
+  /**
+   * Set the length up to which a response is sent uncompressed (default: 2048)
+   */
+  inline void setMinSize(const size_t s) { minSize = s; };
+
+  /**
+   * Set the length up to which a websocket message is sent uncompressed (default: 64)
+   */
+  inline void setMinMessageSize(const size_t s) { minMessageSize = s; };
+
+  /**
+   * Set the length from which a payload is compressed with at most maxL
+   * (default: 1MB, level 3)
+   */
+  inline void setLargePayload(const size_t s, const int maxL) {
+    largeSize     = s;
+    largeMaxLevel = maxL;
+  };
+
+  /**
+   * @return the decisions counters, in the Prometheus text format
+   */
+  std::string getMetrics();
+
+private:
+  CompressionController();
+  CompressionController(const CompressionController &)            = delete;
+  CompressionController &operator=(const CompressionController &) = delete;
+
+  std::atomic<bool>   enabled, adaptive;
+  std::atomic<int>    minLevel, maxLevel, largeMaxLevel;
+  std::atomic<double> lowWatermark, highWatermark;
+  std::atomic<size_t> minSize, minMessageSize, largeSize;
+
+  std::atomic<long>      workers, busyWorkers;
+  std::atomic<double>    cpuLoad;
+  std::atomic<long long> cpuLoadDate_ms;
+  long                   nbCpus;
+
+  std::atomic<unsigned long long> levelCount[10];
+  std::atomic<unsigned long long> skipCount[SKIP_REASON_COUNT];
+  std::atomic<unsigned long long> bytesIn, bytesOut;
+};
+
+#endif
@@ -33,15 +33,8 @@ public:
   /**********************************************************************/
 
   template <class T> static inline T getValue(const std::string &s) {
-    if (!s.length()) {
-      throw std::bad_cast();
-    }
-
-    std::istringstream iss(s);
-    T                  tmp;
-    iss >> tmp;
-
-    if (iss.fail()) {
+    T tmp{};
+    if (!HttpRequest::parseValue(s, tmp)) {
       throw std::bad_cast();
     }
 
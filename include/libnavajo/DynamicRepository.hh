@@ -16,27 +16,31 @@
 
 #include "libnavajo/GrDebug.hpp"
 
-#include <map>
+#include <algorithm>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "libnavajo/HttpRouter.hh"
 #include "libnavajo/WebRepository.hh"
+#include "libnavajo/nvjRcu.h"
 
 class DynamicRepository : public WebRepository {
 
-  pthread_mutex_t                              _mutex;
-  typedef std::map<std::string, DynamicPage *> IndexMap;
-  IndexMap                                     indexMap;
+  typedef HttpRouter<DynamicPage *> IndexMap;
+  NvjRcuPtr<IndexMap>               indexMap; // immutable snapshots, lock-free lookups
 
-public:
-  DynamicRepository() {
-    GR_JUMP_TRACE;
-    pthread_mutex_init(&_mutex, nullptr);
-  }
-  virtual ~DynamicRepository() {
-    GR_JUMP_TRACE;
-    indexMap.clear();
+  static inline std::string_view stripSlashes(std::string_view url) {
+    while (url.size() && url[0] == '/') {
+      url.remove_prefix(1);
+    }
+    return url;
   }
 
+public:
+  DynamicRepository() { GR_JUMP_TRACE; }
+  virtual ~DynamicRepository() { GR_JUMP_TRACE; }
+
   /**
    * Free resources after use. Inherited from class WebRepository
    * called from WebServer::accept_request() method
@@ -49,53 +53,36 @@ public:
 
   /**
    * Add new page to the repository
-   * @param name: the url (from the document root)
+   * @param url: the url pattern (from the document root). Named segments
+   *   "{name}" and a final wildcard "*name" are available to the page
+   *   through HttpRequest::getPathParameter()
    * @param page: the DynamicPage instance responsible for content generation
+   * @param method: the request method served, UNKNOWN_METHOD for all
+   * @return false if the pattern is invalid or already registered
    */
-  // GLSR FIXME
-  inline void add(const std::string url, DynamicPage *page) {
+  inline bool add(const std::string &url, DynamicPage *page, HttpRequestMethod method = UNKNOWN_METHOD) {
     GR_JUMP_TRACE;
-    size_t i = 0;
-    while (url.size() && url[i] == '/') {
-      GR_JUMP_TRACE;
-      i++;
-    }
-    pthread_mutex_lock(&_mutex);
-    indexMap.insert(std::pair<std::string, DynamicPage *>(url.substr(i, url.size() - i), page));
-    pthread_mutex_unlock(&_mutex);
+    return indexMap.update([&](IndexMap &m) { return m.add(stripSlashes(url), page, method); });
   }
 
   /**
    * Remove page from the repository
-   * @param urlToRemove: the url (from the document root)
+   * @param urlToRemove: the url pattern (from the document root)
    * @param deleteDynamicPage: true if the related DynamicPage must be deleted
    */
-  // GLSR FIXME
-  inline void remove(const std::string urlToRemove, bool deleteDynamicPage = false) {
+  inline void remove(const std::string &urlToRemove, bool deleteDynamicPage = false) {
     GR_JUMP_TRACE;
-    std::string url(urlToRemove);
-    while (url.size() && url[0] == '/') {
-      GR_JUMP_TRACE;
-      url.erase(0, 1);
-    }
-    pthread_mutex_lock(&_mutex);
-    IndexMap::iterator i = indexMap.find(url);
-    if (i == indexMap.end()) {
-      GR_JUMP_TRACE;
-      pthread_mutex_unlock(&_mutex);
-      return;
-    } else {
+    std::vector<DynamicPage *> removed;
+    indexMap.update([&](IndexMap &m) { m.remove(stripSlashes(urlToRemove), &removed); });
+
+    if (deleteDynamicPage) {
       GR_JUMP_TRACE;
-      pthread_mutex_unlock(&_mutex);
-      if (deleteDynamicPage) {
-        GR_JUMP_TRACE;
-        delete i->second;
+      std::sort(removed.begin(), removed.end());
+      removed.erase(std::unique(removed.begin(), removed.end()), removed.end());
+      for (auto page : removed) {
+        delete page;
       }
-      indexMap.erase(i);
-      return;
     }
-
-    pthread_mutex_lock(&_mutex);
   }
 
   /**
@@ -108,25 +95,29 @@ public:
    */
   inline bool getFile(HttpRequest *request, HttpResponse *response) override {
     GR_JUMP_TRACE;
-    std::string url = request->getUrl();
-    while (url.size() && url[0] == '/') {
-      url.erase(0, 1);
+    HttpPathParameters params;
+    DynamicPage       *found = nullptr;
+    {
+      auto                snapshot = indexMap.read();
+      DynamicPage *const *page = snapshot->find(stripSlashes(request->getUrl()), request->getRequestType(), params);
+      if (page != nullptr) {
+        found = *page;
+      }
     }
-    pthread_mutex_lock(&_mutex);
-    IndexMap::const_iterator i = indexMap.find(url);
-    if (i == indexMap.end()) {
+
+    if (found == nullptr) {
       GR_JUMP_TRACE;
-      pthread_mutex_unlock(&_mutex);
       return false;
-    } else {
-      GR_JUMP_TRACE;
-      pthread_mutex_unlock(&_mutex);
-      bool res = i->second->getPage(request, response);
-      if (request->getSessionId().size()) {
-        response->addSessionCookie(request->getSessionId());
-      }
-      return res;
     }
+
+    GR_JUMP_TRACE;
+    request->setPathParameters(std::move(params));
+    bool res = found->getPage(request, response);
+    // the session is only looked up if the page asked for it
+    if (request->isSessionResolved() && request->getSessionId().size()) {
+      response->addSessionCookie(request->getSessionId());
+    }
+    return res;
   }
 };
 #endif
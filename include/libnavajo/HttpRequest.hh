@@ -14,18 +14,26 @@
 #ifndef HTTPREQUEST_HH_
 #define HTTPREQUEST_HH_
 
+#include <charconv>
 #include <iostream>
 
 #include <map>
+#include <memory>
 #include <openssl/ssl.h>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <strings.h>
+#include <type_traits>
 #include <vector>
 
 #include "libnavajo/GrDebug.hpp"
 
 #include "HttpSession.hh"
+#include "libnavajo/HttpRequestHeaders.hh"
+#include "libnavajo/HttpRouter.hh"
 #include "libnavajo/IpAddress.hh"
+#include "libnavajo/nvjUrlDecode.h"
 
 #include "MPFDParser/Parser.h"
 
@@ -53,8 +61,6 @@ typedef struct {
   //  pthread_mutex_t client_mutex;
 } ClientSockData;
 
-typedef std::map<std::string, std::string> HttpRequestHeadersMap;
-
 class HttpRequest {
   typedef std::map<std::string, std::string> HttpRequestParametersMap;
   typedef std::map<std::string, std::string> HttpRequestCookiesMap;
@@ -64,93 +70,55 @@ class HttpRequest {
   ClientSockData          *mClientSockData;
   std::string              mHttpAuthUsername;
   HttpRequestMethod        mHttpMethod;
-  HttpRequestCookiesMap    mCookies;
-  HttpRequestParametersMap mParameters;
-  HttpRequestHeadersMap    mExtraHeaders;
-  std::string              mSessionId;
+  HttpRequestHeaders       mExtraHeaders;
   MPFD::Parser            *mMultipartContentParser;
   const char              *mMimeType;
   std::vector<uint8_t>    *mPayload;
 
+  // parameters, cookies and session are decoded on first access
+  std::string                      mRawParams, mRawCookies;
+  mutable bool                     mParamsDecoded, mCookiesDecoded, mSessionResolved;
+  mutable HttpRequestParametersMap mParameters;
+  mutable HttpRequestCookiesMap    mCookies;
+  mutable std::string              mSessionId;
+  HttpPathParameters               mPathParameters;
+
   /**********************************************************************/
   /**
    * decode all http parameters and fill the parameters Map
    * @param p: raw string containing all the http parameters
    */
-  inline void decodParams(const std::string &p) {
+  inline void decodParams(const std::string &p) const {
     GR_JUMP_TRACE;
-    size_t      start = 0, end = 0;
-    std::string paramstr = p;
-
-    while ((end = paramstr.find_first_of("%+", start)) != std::string::npos) {
-      GR_JUMP_TRACE;
-      size_t len = paramstr.length() - end - 1;
-      switch (paramstr[end]) {
-      case '%':
-        if (paramstr[end + 1] == '%' && len) {
-          paramstr = paramstr.erase(end + 1, 1);
-        } else {
-          if (len < 2) {
-            break;
-          }
-
-          unsigned int      specar;
-          std::string       hexChar = paramstr.substr(end + 1, 2);
-          std::stringstream ss;
-          ss << std::hex << hexChar.c_str();
-          ss >> specar;
-          paramstr[end] = (char)specar;
-          paramstr      = paramstr.erase(end + 1, 2);
-        }
-        break;
-
-      case '+':
-        paramstr[end] = ' ';
-        break;
-      }
-
-      start = end + 1;
-    }
-
-    start            = 0;
-    end              = 0;
-    bool islastParam = false;
-    while (!islastParam) {
+    nvj_split_query(p, [this](std::string_view rawKey, std::string_view rawValue, bool hasValue) {
       GR_JUMP_TRACE;
-      islastParam = (end = paramstr.find('&', start)) == std::string::npos;
-      if (islastParam) {
-        end = paramstr.size();
+      std::string key = nvj_url_decode(rawKey);
+      if (!hasValue) {
+        GR_JUMP_TRACE;
+        mParameters[key] = "";
+        return;
       }
 
-      std::string theParam = paramstr.substr(start, end - start);
-
-      size_t posEq = 0;
-      if ((posEq = theParam.find('=')) == std::string::npos) {
+      std::string value = nvj_url_decode(rawValue);
+      auto        it    = mParameters.find(key);
+      if (it == mParameters.end()) {
         GR_JUMP_TRACE;
-        mParameters[theParam] = "";
+        mParameters.emplace(std::move(key), std::move(value));
       } else {
         GR_JUMP_TRACE;
-        std::string key   = theParam.substr(0, posEq);
-        std::string value = theParam.substr(posEq + 1);
-        if (mParameters.count(key) == 0) {
+        std::string arrayKey = key + "[]";
+        auto        itArray  = mParameters.find(arrayKey);
+        if (itArray != mParameters.end()) {
           GR_JUMP_TRACE;
-          mParameters[key] = value;
+          itArray->second += '|';
+          itArray->second += value;
         } else {
           GR_JUMP_TRACE;
-          std::string arrayKey = key + "[]";
-          if (mParameters.count(arrayKey) == 1) {
-            GR_JUMP_TRACE;
-            mParameters[arrayKey] += "|" + value;
-          } else {
-            GR_JUMP_TRACE;
-            mParameters[arrayKey] = mParameters[key] + "|" + value;
-          }
-          mParameters[key] = value;
+          mParameters[arrayKey] = it->second + "|" + value;
         }
+        it->second = std::move(value);
       }
-
-      start = end + 1;
-    }
+    });
   };
 
   /**********************************************************************/
@@ -158,14 +126,15 @@ class HttpRequest {
    * decode all http cookies and fill the cookies Map
    * @param c: raw string containing all the cockies definitions
    */
-  inline void decodCookies(const std::string &c) {
+  inline void decodCookies(std::string_view c) const {
     GR_JUMP_TRACE;
-    std::stringstream ss(c);
-    std::string       theCookie;
-    while (std::getline(ss, theCookie, ';')) {
+    size_t start = 0;
+    while (start < c.size()) {
       GR_JUMP_TRACE;
-      size_t posEq = 0;
-      if ((posEq = theCookie.find('=')) != std::string::npos) {
+      size_t           end       = c.find(';', start);
+      std::string_view theCookie = c.substr(start, end == std::string_view::npos ? end : end - start);
+      size_t           posEq     = 0;
+      if ((posEq = theCookie.find('=')) != std::string_view::npos) {
         GR_JUMP_TRACE;
         size_t firstC = 0;
         while (!iswgraph(theCookie[firstC]) && firstC < posEq) {
@@ -173,28 +142,62 @@ class HttpRequest {
           firstC++;
         }
 
-        if (posEq - firstC > 0 && theCookie.length() - posEq > 0) {
+        if (posEq - firstC > 0) {
           GR_JUMP_TRACE;
-          mCookies[theCookie.substr(firstC, posEq - firstC)] = theCookie.substr(posEq + 1, theCookie.length() - posEq);
+          mCookies[std::string(theCookie.substr(firstC, posEq - firstC))] = std::string(theCookie.substr(posEq + 1));
         }
       }
+      if (end == std::string_view::npos) {
+        break;
+      }
+      start = end + 1;
     }
   }
 
+  /**********************************************************************/
+  /**
+   * the parameters and cookies maps, decoded on first access
+   */
+  inline const HttpRequestParametersMap &parameters() const {
+    if (!mParamsDecoded) {
+      GR_JUMP_TRACE;
+      mParamsDecoded = true;
+      if (!mRawParams.empty()) {
+        decodParams(mRawParams);
+      }
+    }
+    return mParameters;
+  }
+
+  inline const HttpRequestCookiesMap &cookies() const {
+    if (!mCookiesDecoded) {
+      GR_JUMP_TRACE;
+      mCookiesDecoded = true;
+      if (!mRawCookies.empty()) {
+        decodCookies(mRawCookies);
+      }
+    }
+    return mCookies;
+  }
+
   /**********************************************************************/
   /**
    * check the SID cookie and set the sessionID attribute if the session is valid
-   * (called by constructor)
+   * (called once, by the first session accessor)
    */
-  inline void getSession() {
+  inline void getSession() const {
     GR_JUMP_TRACE;
-    mSessionId = getCookie("SID");
+    if (mSessionResolved) {
+      return;
+    }
+    mSessionResolved = true;
+    mSessionId       = getCookie("SID");
 
     if (mSessionId.length() && HttpSession::updateExpirationIfExists(mSessionId)) {
       return;
     }
 
-    initSessionId();
+    mSessionId = "";
   }
 
 public:
@@ -219,7 +222,7 @@ public:
    */
   inline bool getCookie(const std::string &name, std::string &value) const {
     GR_JUMP_TRACE;
-    if (!mCookies.empty()) {
+    if (!cookies().empty()) {
       HttpRequestCookiesMap::const_iterator it;
       if ((it = mCookies.find(name)) != mCookies.end()) {
         value = it->second;
@@ -237,7 +240,7 @@ public:
   inline std::vector<std::string> getCookiesNames() const {
     GR_JUMP_TRACE;
     std::vector<std::string> res;
-    for (const auto &cookie : mCookies) {
+    for (const auto &cookie : cookies()) {
       res.push_back(cookie.first);
     }
     return res;
@@ -246,21 +249,45 @@ public:
   /**********************************************************************/
   /**
    * get header value
-   * @param name: the header name
+   * @param name: the header name (case-insensitive)
    * @param value: the header value
    * @return true is the header exists
    */
   inline bool getExtraHeader(const std::string &name, std::string &value) const {
-    if (!mExtraHeaders.empty()) {
-      HttpRequestHeadersMap::const_iterator it;
-      if ((it = mExtraHeaders.find(name)) != mExtraHeaders.end()) {
-        value = it->second;
-        return true;
-      }
+    std::string_view v;
+    if (mExtraHeaders.find(name, v)) {
+      value.assign(v);
+      return true;
     }
     return false;
   }
 
+  /**********************************************************************/
+  /**
+   * get header value without copy
+   * @param name: the header name (case-insensitive)
+   * @param value: a view on the header value, valid during the request
+   * @return true is the header exists
+   */
+  inline bool getExtraHeader(std::string_view name, std::string_view &value) const {
+    return mExtraHeaders.find(name, value);
+  }
+
+  /**********************************************************************/
+  /**
+   * get a common header value without copy
+   * @param id: the header id (HTTP_HEADER_HOST, ...)
+   * @param value: a view on the header value, valid during the request
+   * @return true is the header exists
+   */
+  inline bool getExtraHeader(HttpHeaderId id, std::string_view &value) const { return mExtraHeaders.find(id, value); }
+
+  /**********************************************************************/
+  /**
+   * get all the request headers
+   */
+  inline const HttpRequestHeaders &getExtraHeaders() const { return mExtraHeaders; }
+
   /**********************************************************************/
   /**
    * get parameter value
@@ -270,7 +297,7 @@ public:
    */
   inline bool getParameter(const std::string &name, std::string &value) const {
     GR_JUMP_TRACE;
-    if (!mParameters.empty()) {
+    if (!parameters().empty()) {
       HttpRequestParametersMap::const_iterator it;
       if ((it = mParameters.find(name)) != mParameters.end()) {
         value = it->second;
@@ -301,8 +328,91 @@ public:
    */
   inline bool hasParameter(const std::string &name) const {
     GR_JUMP_TRACE;
-    std::string tmp;
-    return getParameter(name, tmp);
+    return parameters().count(name) != 0;
+  }
+
+  /**********************************************************************/
+  /**
+   * convert a string to a value. Arithmetic types are parsed with
+   * std::from_chars and must span the whole string (surrounding spaces
+   * apart), bool accepts 0/1/true/false, other types use operator>>.
+   * @param s: the string
+   * @param value: the converted value, unchanged on failure
+   * @return true if the conversion succeeded
+   */
+  template <class T> static inline bool parseValue(std::string_view s, T &value) {
+    while (!s.empty() && isspace((unsigned char)s.front())) {
+      s.remove_prefix(1);
+    }
+    while (!s.empty() && isspace((unsigned char)s.back())) {
+      s.remove_suffix(1);
+    }
+    if (s.empty()) {
+      return false;
+    }
+
+    if constexpr (std::is_same_v<T, bool>) {
+      if (s == "1" || s == "true") {
+        value = true;
+      } else if (s == "0" || s == "false") {
+        value = false;
+      } else {
+        return false;
+      }
+      return true;
+    } else if constexpr (std::is_floating_point_v<T> ||
+                         (std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, signed char> &&
+                          !std::is_same_v<T, unsigned char>)) {
+      if (s.front() == '+') {
+        s.remove_prefix(1);
+        if (s.empty() || s.front() == '-') {
+          return false;
+        }
+      }
+      T    tmp;
+      auto res = std::from_chars(s.data(), s.data() + s.size(), tmp);
+      if (res.ec != std::errc() || res.ptr != s.data() + s.size()) {
+        return false;
+      }
+      value = tmp;
+      return true;
+    } else {
+      std::istringstream iss{std::string(s)};
+      T                  tmp;
+      iss >> tmp;
+      if (iss.fail()) {
+        return false;
+      }
+      value = std::move(tmp);
+      return true;
+    }
+  }
+
+  /**********************************************************************/
+  /**
+   * get a typed parameter value
+   * @param name: the parameter name
+   * @param value: the parameter value, unchanged if missing or invalid
+   * @return true is the parameter exists and is valid
+   */
+  template <class T> inline bool getParameterAs(const std::string &name, T &value) const {
+    GR_JUMP_TRACE;
+    HttpRequestParametersMap::const_iterator it = parameters().find(name);
+    return it != mParameters.end() && parseValue(it->second, value);
+  }
+
+  /**********************************************************************/
+  /**
+   * get a typed parameter value
+   * @param name: the parameter name
+   * @param defaultValue: returned if the parameter is missing or invalid
+   * @return the parameter value
+   */
+  template <class T> inline T getParameterAs(const std::string &name, const T &defaultValue) const {
+    GR_JUMP_TRACE;
+    T value = defaultValue;
+    getParameterAs(name, value);
+    return value;
   }
 
   /**********************************************************************/
@@ -313,19 +423,76 @@ public:
   inline std::vector<std::string> getParameterNames() const {
     GR_JUMP_TRACE;
     std::vector<std::string> res;
-    for (const auto &parameter : mParameters) {
+    for (const auto &parameter : parameters()) {
       GR_JUMP_TRACE;
       res.push_back(parameter.first);
     }
     return res;
   }
 
+  /**********************************************************************/
+  /**
+   * set the values of the named segments of the matched url pattern
+   * (called by DynamicRepository)
+   */
+  inline void setPathParameters(HttpPathParameters &&params) { mPathParameters = std::move(params); }
+
+  /**********************************************************************/
+  /**
+   * get the value of a named segment ("{name}" or "*name") of the
+   * url pattern the request matched
+   * @param name: the segment name
+   * @param value: the segment value
+   * @return true is the segment exists
+   */
+  inline bool getPathParameter(const std::string &name, std::string &value) const {
+    GR_JUMP_TRACE;
+    for (const auto &param : mPathParameters) {
+      if (param.first == name) {
+        value = param.second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline std::string getPathParameter(const std::string &name) const {
+    GR_JUMP_TRACE;
+    std::string res = "";
+    getPathParameter(name, res);
+    return res;
+  }
+
+  /**********************************************************************/
+  /**
+   * get a typed path parameter value
+   * @param name: the segment name
+   * @param value: the segment value, unchanged if missing or invalid
+   * @return true is the segment exists and is valid
+   */
+  template <class T> inline bool getPathParameterAs(const std::string &name, T &value) const {
+    GR_JUMP_TRACE;
+    for (const auto &param : mPathParameters) {
+      if (param.first == name) {
+        return parseValue(param.second, value);
+      }
+    }
+    return false;
+  }
+
+  /**********************************************************************/
+  /**
+   * get all the named segments values
+   */
+  inline const HttpPathParameters &getPathParameters() const { return mPathParameters; }
+
   /**********************************************************************/
   /**
    * is there a valid session cookie
    */
   inline bool isSessionValid() {
     GR_JUMP_TRACE;
+    getSession();
     return !mSessionId.empty();
   }
 
@@ -335,6 +502,7 @@ public:
    */
   inline void createSession() {
     GR_JUMP_TRACE;
+    mSessionResolved = true;
     HttpSession::create(mSessionId);
   }
 
@@ -343,6 +511,7 @@ public:
    */
   inline void removeSession() {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       GR_JUMP_TRACE;
       return;
@@ -357,6 +526,7 @@ public:
    */
   void setSessionAttribute(const std::string &name, void *value) {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       GR_JUMP_TRACE;
       createSession();
@@ -371,6 +541,7 @@ public:
    */
   void setSessionObjectAttribute(const std::string &name, SessionAttributeObject *value) {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       GR_JUMP_TRACE;
       createSession();
@@ -385,6 +556,7 @@ public:
    */
   void *getSessionAttribute(const std::string &name) {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       GR_JUMP_TRACE;
       return nullptr;
@@ -399,6 +571,7 @@ public:
    */
   SessionAttributeObject *getSessionObjectAttribute(const std::string &name) {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       GR_JUMP_TRACE;
       return nullptr;
@@ -406,12 +579,32 @@ public:
     return HttpSession::getObjectAttribute(mSessionId, name);
   }
 
+  /**
+   * get a handle on the server session, to share typed values safely:
+   *   request->getSessionHandle(true).set("cart", std::move(cart));
+   *   std::shared_ptr<Cart> cart = request->getSessionHandle().get<Cart>("cart");
+   * @param create: create the session if there is none
+   * @return the handle, false if there is no session
+   */
+  HttpSession::Handle getSessionHandle(bool create = false) {
+    GR_JUMP_TRACE;
+    getSession();
+    if (mSessionId.empty()) {
+      if (!create) {
+        return HttpSession::Handle();
+      }
+      createSession();
+    }
+    return HttpSession::find(mSessionId);
+  }
+
   /**
    * get the list of the attribute's Names of the server session
    * @return a vector containing all attribute's names
    */
   inline std::vector<std::string> getSessionAttributeNames() {
     GR_JUMP_TRACE;
+    getSession();
     if (mSessionId.empty()) {
       return std::vector<std::string>();
     }
@@ -424,6 +617,7 @@ public:
    */
   inline void getSessionRemoveAttribute(const std::string &name) {
     GR_JUMP_TRACE;
+    getSession();
     if (!mSessionId.empty()) {
       GR_JUMP_TRACE;
       HttpSession::removeAttribute(mSessionId, name);
@@ -435,7 +629,8 @@ public:
    */
   inline void initSessionId() {
     GR_JUMP_TRACE;
-    mSessionId = "";
+    mSessionResolved = true;
+    mSessionId       = "";
   }
 
   /**
@@ -444,9 +639,16 @@ public:
    */
   std::string getSessionId() const {
     GR_JUMP_TRACE;
+    getSession();
     return mSessionId;
   }
 
+  /**
+   * has the session been looked up during this request ?
+   * (by one of the session accessors)
+   */
+  inline bool isSessionResolved() const { return mSessionResolved; }
+
   /**********************************************************************/
   /**
    * HttpRequest constructor
@@ -456,26 +658,18 @@ public:
    * @cookies params: raw http cookies string
    */
   HttpRequest(const HttpRequestMethod type, const char *url, const char *params, const char *cookies,
-              HttpRequestHeadersMap &hMap, const char *origin, const std::string &username, ClientSockData *client, const char *mimeType,
-std::vector<uint8_t> *payload = nullptr, MPFD::Parser *parser = nullptr) {
-    GR_JUMP_TRACE;
-    mHttpMethod             = type;
-    mUrl                    = url;
-    mOrigin                 = origin;
-    mHttpAuthUsername       = username;
-    mClientSockData         = client;
-    mMimeType               = mimeType;
-    mPayload                = payload;
-    mMultipartContentParser = parser;
-    mExtraHeaders           = hMap;
-
+              HttpRequestHeaders hMap, const char *origin, const std::string &username, ClientSockData *client,
+              const char *mimeType, std::vector<uint8_t> *payload = nullptr, MPFD::Parser *parser = nullptr)
+      : mUrl(url), mOrigin(origin), mClientSockData(client), mHttpAuthUsername(username), mHttpMethod(type),
+        mExtraHeaders(std::move(hMap)), mMultipartContentParser(parser), mMimeType(mimeType), mPayload(payload),
+        mParamsDecoded(false), mCookiesDecoded(false), mSessionResolved(false) {
+    GR_JUMP_TRACE;
     setParams(params);
 
-    if (cookies != nullptr && strlen(cookies)) {
+    if (cookies != nullptr) {
       GR_JUMP_TRACE;
-      decodCookies(cookies);
+      mRawCookies = cookies;
     }
-    getSession();
   }
 
   /**********************************************************************/
@@ -549,7 +743,14 @@ std::vector<uint8_t> *payload = nullptr, MPFD::Parser *parser = nullptr) {
     }
     if (params != nullptr && strlen(params)) {
       GR_JUMP_TRACE;
-      decodParams(params);
+      if (mParamsDecoded) {
+        decodParams(params);
+      } else {
+        if (!mRawParams.empty()) {
+          mRawParams += '&';
+        }
+        mRawParams += params;
+      }
     }
   }
 
@@ -623,6 +824,95 @@ std::vector<uint8_t> *payload = nullptr, MPFD::Parser *parser = nullptr) {
     return mClientSockData->peerDN != nullptr;
   }
 
+  /**********************************************************************/
+  /**
+   * does the client accept a content-coding ?
+   * @param coding: "gzip", "br"...
+   * @return true if the coding, or "*", is listed in Accept-Encoding
+   *   without a null quality
+   */
+  inline bool acceptsEncoding(std::string_view coding) const {
+    std::string_view accept;
+    bool             wildcard = false;
+
+    if (!mExtraHeaders.find(HTTP_HEADER_ACCEPT_ENCODING, accept)) {
+      return false;
+    }
+
+    while (!accept.empty()) {
+      size_t           comma = accept.find(',');
+      std::string_view item  = accept.substr(0, comma);
+      accept                 = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+      size_t           semi = item.find(';');
+      std::string_view name = item.substr(0, semi);
+      while (!name.empty() && (name.front() == ' ' || name.front() == '\t')) {
+        name.remove_prefix(1);
+      }
+      while (!name.empty() && (name.back() == ' ' || name.back() == '\t')) {
+        name.remove_suffix(1);
+      }
+
+      bool accepted = true;
+      if (semi != std::string_view::npos) {
+        std::string_view params = item.substr(semi + 1);
+        size_t           q      = params.find("q=");
+        if (q != std::string_view::npos) {
+          params = params.substr(q + 2, params.find_first_of(" \t;", q + 2) - q - 2);
+          accepted = params.find_first_not_of("0.") != std::string_view::npos;
+        }
+      }
+
+      if (name.size() == coding.size() && !strncasecmp(name.data(), coding.data(), name.size())) {
+        return accepted;
+      }
+      if (name == "*") {
+        wildcard = accepted;
+      }
+    }
+
+    return wildcard;
+  }
+
+  /**********************************************************************/
+  /**
+   * does the If-None-Match header match an etag, or the etag of one of
+   * its encodings ("<etag>-gz", "<etag>-br") ?
+   * @param etag: the quoted strong validator of the resource
+   */
+  inline bool isNotModified(std::string_view etag) const {
+    std::string_view ifNoneMatch;
+    if (etag.size() < 2 || !mExtraHeaders.find(HTTP_HEADER_IF_NONE_MATCH, ifNoneMatch)) {
+      return false;
+    }
+
+    while (!ifNoneMatch.empty()) {
+      size_t           comma = ifNoneMatch.find(',');
+      std::string_view tag   = ifNoneMatch.substr(0, comma);
+      while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) {
+        tag.remove_prefix(1);
+      }
+      while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) {
+        tag.remove_suffix(1);
+      }
+      if (tag.substr(0, 2) == "W/") {
+        tag.remove_prefix(2);
+      }
+      if (tag == "*" || tag == etag) {
+        return true;
+      }
+      if (tag.size() == etag.size() + 3 && tag.compare(0, etag.size() - 1, etag, 0, etag.size() - 1) == 0 &&
+          (tag.substr(etag.size() - 1) == "-gz\"" || tag.substr(etag.size() - 1) == "-br\"")) {
+        return true;
+      }
+      if (comma == std::string_view::npos) {
+        break;
+      }
+      ifNoneMatch.remove_prefix(comma + 1);
+    }
+    return false;
+  }
+
   /**********************************************************************/
   /**
    * get compression mode
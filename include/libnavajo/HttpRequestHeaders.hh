@@ -0,0 +1,293 @@
+//****************************************************************************
+/**
+ * @file  HttpRequestHeaders.hh
+ *
+ * @brief Flat, case-insensitive storage of the http request headers
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//****************************************************************************
+
+#ifndef HTTPREQUESTHEADERS_HH_
+#define HTTPREQUESTHEADERS_HH_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//****************************************************************************
+
+/**
+ * Common header names, interned when the headers are parsed
+ */
+typedef enum : uint8_t {
+  HTTP_HEADER_OTHER = 0,
+  HTTP_HEADER_ACCEPT,
+  HTTP_HEADER_ACCEPT_ENCODING,
+  HTTP_HEADER_ACCEPT_LANGUAGE,
+  HTTP_HEADER_AUTHORIZATION,
+  HTTP_HEADER_CACHE_CONTROL,
+  HTTP_HEADER_CONNECTION,
+  HTTP_HEADER_CONTENT_LENGTH,
+  HTTP_HEADER_CONTENT_TYPE,
+  HTTP_HEADER_COOKIE,
+  HTTP_HEADER_HOST,
+  HTTP_HEADER_IF_MATCH,
+  HTTP_HEADER_IF_MODIFIED_SINCE,
+  HTTP_HEADER_IF_NONE_MATCH,
+  HTTP_HEADER_IF_RANGE,
+  HTTP_HEADER_ORIGIN,
+  HTTP_HEADER_RANGE,
+  HTTP_HEADER_REFERER,
+  HTTP_HEADER_UPGRADE,
+  HTTP_HEADER_USER_AGENT,
+  HTTP_HEADER_X_FORWARDED_FOR,
+  HTTP_HEADER_X_FORWARDED_PROTO,
+  HTTP_HEADER_X_REAL_IP,
+  HTTP_HEADER_X_REQUESTED_WITH,
+  HTTP_HEADER_COUNT
+} HttpHeaderId;
+
+//****************************************************************************
+
+/**
+ * HttpRequestHeaders - the header lines are copied once into a single
+ * buffer, names and values are accessed as views into it. The first
+ * entries are stored inline, lookups compare a case-insensitive hash
+ * first. When a header is repeated, the last value is returned.
+ */
+class HttpRequestHeaders {
+  static const size_t INLINE_ENTRIES = 16;
+
+  typedef struct {
+    uint32_t     hash;
+    uint32_t     nameOffset;
+    uint32_t     valueOffset;
+    uint32_t     valueLength;
+    uint16_t     nameLength;
+    HttpHeaderId id;
+  } Entry;
+
+  std::string        mBuffer;
+  Entry              mInline[INLINE_ENTRIES];
+  std::vector<Entry> mOverflow;
+  size_t             mSize;
+
+  inline const Entry &entry(size_t i) const { return i < INLINE_ENTRIES ? mInline[i] : mOverflow[i - INLINE_ENTRIES]; }
+
+  static inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
+  static inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+      if (lower(a[i]) != lower(b[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static inline bool isTokenChar(unsigned char c) {
+    return c > 0x20 && c < 0x7f && c != ':' && c != '(' && c != ')' && c != ',' && c != ';' && c != '<' &&
+           c != '>' && c != '@' && c != '[' && c != ']' && c != '\\' && c != '"' && c != '/' && c != '?' &&
+           c != '=' && c != '{' && c != '}';
+  }
+
+  static inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+      s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r' || s.back() == '\n')) {
+      s.remove_suffix(1);
+    }
+    return s;
+  }
+
+  /**********************************************************************/
+
+  static inline const char *const *headerNames() {
+    static const char *const names[HTTP_HEADER_COUNT] = {"",
+                                                         "accept",
+                                                         "accept-encoding",
+                                                         "accept-language",
+                                                         "authorization",
+                                                         "cache-control",
+                                                         "connection",
+                                                         "content-length",
+                                                         "content-type",
+                                                         "cookie",
+                                                         "host",
+                                                         "if-match",
+                                                         "if-modified-since",
+                                                         "if-none-match",
+                                                         "if-range",
+                                                         "origin",
+                                                         "range",
+                                                         "referer",
+                                                         "upgrade",
+                                                         "user-agent",
+                                                         "x-forwarded-for",
+                                                         "x-forwarded-proto",
+                                                         "x-real-ip",
+                                                         "x-requested-with"};
+    return names;
+  }
+
+  static inline const uint32_t *headerHashes() {
+    static const struct Hashes {
+      uint32_t h[HTTP_HEADER_COUNT];
+      Hashes() {
+        for (int i = 0; i < HTTP_HEADER_COUNT; i++) {
+          h[i] = hashName(headerNames()[i]);
+        }
+      }
+    } hashes;
+    return hashes.h;
+  }
+
+public:
+  /**
+   * case-insensitive FNV-1a hash of a header name
+   */
+  static inline uint32_t hashName(std::string_view name) {
+    uint32_t h = 2166136261u;
+    for (char c : name) {
+      h = (h ^ (unsigned char)lower(c)) * 16777619u;
+    }
+    return h;
+  }
+
+  /**
+   * @return the id of a common header name, HTTP_HEADER_OTHER otherwise
+   */
+  static inline HttpHeaderId getHeaderId(std::string_view name, uint32_t hash) {
+    const uint32_t *hashes = headerHashes();
+    for (int i = 1; i < HTTP_HEADER_COUNT; i++) {
+      if (hashes[i] == hash && equalsIgnoreCase(name, headerNames()[i])) {
+        return (HttpHeaderId)i;
+      }
+    }
+    return HTTP_HEADER_OTHER;
+  }
+
+  static inline HttpHeaderId getHeaderId(std::string_view name) { return getHeaderId(name, hashName(name)); }
+
+  /**
+   * @return the lowercase name of a common header
+   */
+  static inline const char *getHeaderName(HttpHeaderId id) {
+    return id < HTTP_HEADER_COUNT ? headerNames()[id] : "";
+  }
+
+  /**********************************************************************/
+
+  HttpRequestHeaders() : mSize(0) {}
+
+  inline size_t size() const { return mSize; }
+  inline bool   empty() const { return mSize == 0; }
+
+  /**
+   * remove all the headers, keeping the allocated memory
+   */
+  inline void clear() {
+    mBuffer.clear();
+    mOverflow.clear();
+    mSize = 0;
+  }
+
+  /**
+   * add a header
+   * @return false if the name is not a valid header name
+   */
+  inline bool add(std::string_view name, std::string_view value) {
+    if (name.empty() || name.size() > 0xffff) {
+      return false;
+    }
+    for (char c : name) {
+      if (!isTokenChar((unsigned char)c)) {
+        return false;
+      }
+    }
+
+    Entry e;
+    e.hash        = hashName(name);
+    e.id          = getHeaderId(name, e.hash);
+    e.nameOffset  = mBuffer.size();
+    e.nameLength  = name.size();
+    e.valueOffset = e.nameOffset + e.nameLength;
+    e.valueLength = value.size();
+    mBuffer.append(name);
+    mBuffer.append(value);
+
+    if (mSize < INLINE_ENTRIES) {
+      mInline[mSize] = e;
+    } else {
+      mOverflow.push_back(e);
+    }
+    mSize++;
+    return true;
+  }
+
+  /**
+   * add a raw header line "Name: value"
+   * @return false if the line is not a header (the request line for instance)
+   */
+  inline bool addLine(std::string_view line) {
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      return false;
+    }
+    return add(line.substr(0, colon), trim(line.substr(colon + 1)));
+  }
+
+  /**********************************************************************/
+
+  inline std::string_view getName(size_t i) const {
+    const Entry &e = entry(i);
+    return std::string_view(mBuffer.data() + e.nameOffset, e.nameLength);
+  }
+
+  inline std::string_view getValue(size_t i) const {
+    const Entry &e = entry(i);
+    return std::string_view(mBuffer.data() + e.valueOffset, e.valueLength);
+  }
+
+  inline HttpHeaderId getId(size_t i) const { return entry(i).id; }
+
+  /**
+   * get a header value
+   * @param name: the header name (case-insensitive)
+   * @param value: a view on the value, valid until the headers are modified
+   * @return true is the header exists
+   */
+  inline bool find(std::string_view name, std::string_view &value) const {
+    uint32_t hash = hashName(name);
+    for (size_t i = mSize; i-- > 0;) {
+      const Entry &e = entry(i);
+      if (e.hash == hash && equalsIgnoreCase(getName(i), name)) {
+        value = getValue(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  inline bool find(HttpHeaderId id, std::string_view &value) const {
+    if (id == HTTP_HEADER_OTHER) {
+      return false;
+    }
+    for (size_t i = mSize; i-- > 0;) {
+      if (entry(i).id == id) {
+        value = getValue(i);
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+#endif
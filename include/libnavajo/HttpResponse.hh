@@ -26,6 +26,9 @@ class HttpResponse {
   unsigned                                mHttpReturnCode;
   std::string                             mHttpReturnCodeMessage;
   std::string                             mHttpSpecificHeaders;
+  const char                             *mPrerenderedHeaders;
+  std::shared_ptr<const void>             mContentOwner;
+  int                                     mContentFd;
   static const unsigned                   mUnsetHttpReturnCodeMessage = 0;
   static std::map<unsigned, const char *> mHttpReturnCodes;
 
@@ -33,7 +36,7 @@ public:
   HttpResponse(const std::string mime = "")
       : mResponseContent(NULL), mResponseContentLength(0), mZippedFile(false), mMimeType(mime), mForwardToUrl(""),
         mCors(false), mCorsCred(false), mCorsDomain(""), mHttpReturnCode(mUnsetHttpReturnCodeMessage),
-        mHttpReturnCodeMessage("Unspecified"), mHttpSpecificHeaders("") {
+        mHttpReturnCodeMessage("Unspecified"), mHttpSpecificHeaders(""), mPrerenderedHeaders(nullptr), mContentFd(-1) {
     initializeHttpReturnCode();
   }
 
@@ -56,6 +59,26 @@ public:
     }
   }
 
+  /************************************************************************/
+  /**
+   * set a response body read from an opened file, sent without copy
+   * (sendfile) when the connection is not encrypted. The file is sent
+   * as is, without compression, and closed with the response.
+   * @param fd: The file descriptor, the content is sent from its beginning
+   * @param length: The content's length
+   */
+  inline void setContentFile(const int fd, const size_t length) {
+    setContent(nullptr, length);
+    mContentFd    = fd;
+    mContentOwner = std::shared_ptr<const void>(nullptr, [fd](const void *) { close(fd); });
+  }
+
+  /************************************************************************/
+  /**
+   * @return the file descriptor of the response body, -1 if it's in memory
+   */
+  inline int getContentFd() const { return mContentFd; }
+
   /************************************************************************/
   /**
    * Returns the response body of the HTTP method
@@ -333,6 +356,28 @@ public:
   }
 
   std::string getSpecificHeaders() const { return mHttpSpecificHeaders; }
+
+  /************************************************************************/
+  /**
+   * Set the headers describing the content, rendered in advance
+   * (Content-Type, Content-Length, Content-Encoding...). The content is
+   * then sent as is, without any compression.
+   * @param headers: the header lines, each one ended by "\r\n"
+   */
+  inline void setPrerenderedHeaders(const char *headers) { mPrerenderedHeaders = headers; }
+
+  /************************************************************************/
+  /**
+   * @return the headers rendered in advance, nullptr if none
+   */
+  inline const char *getPrerenderedHeaders() const { return mPrerenderedHeaders; }
+
+  /************************************************************************/
+  /**
+   * Keep the owner of the content alive until the response is sent
+   * (a mapped file for instance)
+   */
+  inline void setContentOwner(std::shared_ptr<const void> owner) { mContentOwner = std::move(owner); }
 };
 
 //****************************************************************************
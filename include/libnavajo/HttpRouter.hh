@@ -0,0 +1,330 @@
+//****************************************************************************
+/**
+ * @file  HttpRouter.hh
+ *
+ * @brief Compressed radix tree mapping url patterns to handlers
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//****************************************************************************
+
+#ifndef HTTPROUTER_HH_
+#define HTTPROUTER_HH_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//****************************************************************************
+
+typedef std::vector<std::pair<std::string, std::string>> HttpPathParameters;
+
+/**
+ * HttpRouter - url patterns are made of static parts, of named segments
+ * "{name}" matching up to the next '/', and of a final wildcard "*name"
+ * matching the rest of the url. Static parts are preferred to segments,
+ * segments to wildcards.
+ *
+ *   "items/{id}/details", "static/" "*path"
+ *
+ * Each pattern holds one handler per request method (the slots are
+ * indexed by HttpRequestMethod), slot 0 matching any method.
+ * Resolution is linear in the url length.
+ */
+template <class T, size_t NB_METHODS = 8> class HttpRouter {
+  struct Node {
+    std::string           prefix;
+    std::vector<Node>     children; // static children, distinct first chars
+    std::unique_ptr<Node> param, wildcard;
+    std::string           paramName, wildcardName;
+    T                     handlers[NB_METHODS];
+    bool                  hasHandler[NB_METHODS] = {};
+
+    Node() : handlers() {}
+    explicit Node(std::string_view p) : prefix(p), handlers() {}
+
+    Node(const Node &o)
+        : prefix(o.prefix), children(o.children), param(o.param ? std::make_unique<Node>(*o.param) : nullptr),
+          wildcard(o.wildcard ? std::make_unique<Node>(*o.wildcard) : nullptr), paramName(o.paramName),
+          wildcardName(o.wildcardName) {
+      std::copy(o.handlers, o.handlers + NB_METHODS, handlers);
+      std::copy(o.hasHandler, o.hasHandler + NB_METHODS, hasHandler);
+    }
+    Node(Node &&)            = default;
+    Node &operator=(Node &&) = default;
+    Node &operator=(const Node &o) {
+      Node tmp(o);
+      return *this = std::move(tmp);
+    }
+
+    inline bool hasAnyHandler() const {
+      for (bool h : hasHandler) {
+        if (h) {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+  Node   mRoot;
+  size_t mSize;
+
+  /**********************************************************************/
+
+  static Node *insertStatic(Node *node, std::string_view s) {
+    while (!s.empty()) {
+      Node *child = nullptr;
+      for (auto &c : node->children) {
+        if (c.prefix[0] == s[0]) {
+          child = &c;
+          break;
+        }
+      }
+
+      if (child == nullptr) {
+        node->children.emplace_back(s);
+        return &node->children.back();
+      }
+
+      size_t l = 0;
+      while (l < s.size() && l < child->prefix.size() && s[l] == child->prefix[l]) {
+        l++;
+      }
+
+      if (l < child->prefix.size()) {
+        // split the child at the end of the common prefix
+        Node split(std::string_view(child->prefix).substr(0, l));
+        child->prefix.erase(0, l);
+        split.children.push_back(std::move(*child));
+        *child = std::move(split);
+      }
+
+      node = child;
+      s.remove_prefix(l);
+    }
+    return node;
+  }
+
+  /**
+   * walk (and create if needed) the nodes of a pattern
+   * @return the final node, nullptr if the pattern is invalid or conflicts
+   */
+  Node *walk(std::string_view pattern, bool create) {
+    Node *node = &mRoot;
+
+    while (!pattern.empty()) {
+      if (pattern[0] == '{') {
+        size_t end = pattern.find('}');
+        if (end == std::string_view::npos || end == 1 || (end + 1 < pattern.size() && pattern[end + 1] != '/')) {
+          return nullptr;
+        }
+        std::string_view name = pattern.substr(1, end - 1);
+        if (node->param == nullptr) {
+          if (!create) {
+            return nullptr;
+          }
+          node->param     = std::make_unique<Node>();
+          node->paramName = name;
+        } else if (node->paramName != name) {
+          return nullptr;
+        }
+        node = node->param.get();
+        pattern.remove_prefix(end + 1);
+      } else if (pattern[0] == '*') {
+        std::string_view name = pattern.substr(1);
+        if (name.find_first_of("/{*") != std::string_view::npos) {
+          return nullptr;
+        }
+        if (node->wildcard == nullptr) {
+          if (!create) {
+            return nullptr;
+          }
+          node->wildcard     = std::make_unique<Node>();
+          node->wildcardName = name;
+        } else if (node->wildcardName != name) {
+          return nullptr;
+        }
+        return node->wildcard.get();
+      } else {
+        size_t           end = pattern.find_first_of("{*");
+        std::string_view s   = pattern.substr(0, end);
+        if (end != std::string_view::npos && end && pattern[end - 1] != '/') {
+          return nullptr; // segments and wildcards start after a '/'
+        }
+        if (create) {
+          node = insertStatic(node, s);
+        } else {
+          node = findStatic(node, s);
+          if (node == nullptr) {
+            return nullptr;
+          }
+        }
+        pattern.remove_prefix(s.size());
+      }
+    }
+    return node;
+  }
+
+  static Node *findStatic(Node *node, std::string_view s) {
+    while (!s.empty()) {
+      Node *child = nullptr;
+      for (auto &c : node->children) {
+        if (c.prefix[0] == s[0]) {
+          child = &c;
+          break;
+        }
+      }
+      if (child == nullptr || s.substr(0, child->prefix.size()) != child->prefix) {
+        return nullptr;
+      }
+      s.remove_prefix(child->prefix.size());
+      node = child;
+    }
+    return node;
+  }
+
+  /**********************************************************************/
+
+  static const T *handlerOf(const Node &node, size_t method) {
+    if (method < NB_METHODS && node.hasHandler[method]) {
+      return &node.handlers[method];
+    }
+    if (node.hasHandler[0]) {
+      return &node.handlers[0];
+    }
+    return nullptr;
+  }
+
+  static const T *match(const Node &node, std::string_view path, size_t method, HttpPathParameters &params) {
+    if (path.empty()) {
+      const T *h = handlerOf(node, method);
+      if (h != nullptr) {
+        return h;
+      }
+    } else {
+      for (const auto &c : node.children) {
+        if (c.prefix[0] == path[0]) {
+          if (path.substr(0, c.prefix.size()) == c.prefix) {
+            const T *h = match(c, path.substr(c.prefix.size()), method, params);
+            if (h != nullptr) {
+              return h;
+            }
+          }
+          break;
+        }
+      }
+
+      if (node.param != nullptr) {
+        size_t seg = path.find('/');
+        if (seg == std::string_view::npos) {
+          seg = path.size();
+        }
+        if (seg) {
+          params.emplace_back(node.paramName, path.substr(0, seg));
+          const T *h = match(*node.param, path.substr(seg), method, params);
+          if (h != nullptr) {
+            return h;
+          }
+          params.pop_back();
+        }
+      }
+    }
+
+    if (node.wildcard != nullptr) {
+      const T *h = handlerOf(*node.wildcard, method);
+      if (h != nullptr) {
+        params.emplace_back(node.wildcardName, path);
+        return h;
+      }
+    }
+
+    return nullptr;
+  }
+
+public:
+  HttpRouter() : mSize(0) {}
+
+  /**
+   * Add a route
+   * @param pattern: the url pattern
+   * @param value: the handler
+   * @param method: the request method, 0 for any
+   * @return false if the pattern is invalid or already registered for this method
+   */
+  bool add(std::string_view pattern, const T &value, size_t method = 0) {
+    Node *node = walk(pattern, true);
+    if (node == nullptr || method >= NB_METHODS || node->hasHandler[method]) {
+      return false;
+    }
+    node->handlers[method]   = value;
+    node->hasHandler[method] = true;
+    mSize++;
+    return true;
+  }
+
+  /**
+   * Remove a route
+   * @param pattern: the url pattern, as registered
+   * @param removed: filled with the removed handlers
+   * @param method: the request method, NB_METHODS for all
+   * @return the number of handlers removed
+   */
+  size_t remove(std::string_view pattern, std::vector<T> *removed = nullptr, size_t method = NB_METHODS) {
+    Node  *node = walk(pattern, false);
+    size_t nb   = 0;
+    if (node == nullptr) {
+      return 0;
+    }
+    for (size_t m = 0; m < NB_METHODS; m++) {
+      if ((method == NB_METHODS || method == m) && node->hasHandler[m]) {
+        if (removed != nullptr) {
+          removed->push_back(node->handlers[m]);
+        }
+        node->handlers[m]   = T();
+        node->hasHandler[m] = false;
+        nb++;
+      }
+    }
+    mSize -= nb;
+    return nb;
+  }
+
+  /**
+   * Resolve an url
+   * @param path: the url
+   * @param method: the request method
+   * @param params: filled with the named segments and wildcard values
+   * @return the handler, nullptr if not found
+   */
+  inline const T *find(std::string_view path, size_t method, HttpPathParameters &params) const {
+    params.clear();
+    const T *h = match(mRoot, path, method, params);
+    if (h == nullptr) {
+      params.clear();
+    }
+    return h;
+  }
+
+  /**
+   * does the route exist for at least one method ?
+   */
+  inline bool contains(std::string_view pattern) const {
+    const Node *node = const_cast<HttpRouter *>(this)->walk(pattern, false);
+    return node != nullptr && node->hasAnyHandler();
+  }
+
+  inline size_t size() const { return mSize; }
+  inline bool   empty() const { return mSize == 0; }
+
+  inline void clear() {
+    mRoot = Node();
+    mSize = 0;
+  }
+};
+
+#endif
@@ -14,16 +14,28 @@
 #ifndef HTTPSESSION_HH_
 #define HTTPSESSION_HH_
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
-#include <map>
-#include <sstream>
+#include <iterator>
+#include <memory>
+#include <pthread.h>
+#include <random>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 #include "spdlog/spdlog.h"
 
 #include "libnavajo/GrDebug.hpp"
+#include "libnavajo/nvjThread.h"
+
+#define HTTP_SESSION_SHARDS      64
+#define HTTP_SESSION_WHEEL_SLOTS 4096 // one per second
 
 class SessionAttributeObject {
 public:
@@ -35,24 +47,201 @@ class HttpSession {
 
   typedef struct {
     enum {
-      BASIC, /**< objetos fundamentais criados com malloc */
-      OBJECT /**< objetos C++ criados com new */
+      BASIC,  /**< objetos fundamentais criados com malloc */
+      OBJECT, /**< objetos C++ criados com new */
+      TYPED   /**< valores de tipo T, movidos para a sessão */
     } type;
-    union {
-      void *ptr;                   // usado pelo BASIC
-      SessionAttributeObject *obj; // usado pelo OBJECT
-    };
+    std::shared_ptr<void> value; // released with the last reader
+    const std::type_info *typeInfo; // TYPED
   } SessionAttribute;
 
-  typedef std::map<std::string, std::map<std::string, SessionAttribute> *>
-      HttpSessionsContainerMap;
+  // a session, locked on its own: the requests of other sessions don't wait
+  struct Session {
+    pthread_mutex_t mutex;
+    std::unordered_map<std::string, SessionAttribute> attributes;
+    std::vector<std::shared_ptr<void>> replaced; // raw pointer values replaced, kept for their readers
+    std::atomic<time_t> expiration; // 0: never
+
+    Session() : expiration(0) { pthread_mutex_init(&mutex, nullptr); }
+    ~Session() { pthread_mutex_destroy(&mutex); }
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+  };
+
+  // the sessions, spread by id over independent maps
+  struct Shard {
+    pthread_rwlock_t lock;
+    std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
 
-  static HttpSessionsContainerMap sessions;
-  static pthread_mutex_t sessions_mutex;
-  static time_t lastExpirationSearchTime;
+    Shard() { pthread_rwlock_init(&lock, nullptr); }
+    ~Shard() { pthread_rwlock_destroy(&lock); }
+  };
+
+  static Shard shards[HTTP_SESSION_SHARDS];
+  static std::atomic<time_t> lastExpirationSearchTime;
   static time_t sessionLifeTime;
 
+  // expiration timing wheel: a session is checked in the slot of the second
+  // it was due to expire, and rescheduled there if it was used meanwhile.
+  // The requests only update Session::expiration.
+  struct Timer {
+    std::string id;
+    std::weak_ptr<Session> session; // removed sessions are just dropped
+  };
+  static std::vector<Timer> wheel[HTTP_SESSION_WHEEL_SLOTS];
+  static pthread_mutex_t wheelMutex;
+  static time_t wheelTime; // the last second reaped
+
+  // background reaper, shared by the web servers
+  static pthread_t reaperThread;
+  static std::atomic<unsigned> reaperUsers; // written under reaperMutex, read by create()
+  static bool reaperExiting;
+  static pthread_mutex_t reaperMutex;
+  static pthread_cond_t reaperCond;
+
+  inline static Shard &shardOf(const std::string &id) {
+    return shards[std::hash<std::string>()(id) % HTTP_SESSION_SHARDS];
+  }
+
+  inline static std::shared_ptr<Session> findSession(const std::string &id) {
+    Shard &shard = shardOf(id);
+    std::shared_ptr<Session> session;
+    pthread_rwlock_rdlock(&shard.lock);
+    auto it = shard.sessions.find(id);
+    if (it != shard.sessions.end()) {
+      session = it->second;
+    }
+    pthread_rwlock_unlock(&shard.lock);
+    return session;
+  }
+
+  // set an attribute; the previous value is released after the unlock, or
+  // with the session if it could have been read as a raw pointer
+  static void setSessionAttribute(Session &session, const std::string &name, SessionAttribute attribute) {
+    pthread_mutex_lock(&session.mutex);
+    SessionAttribute &slot = session.attributes[name];
+    std::swap(slot, attribute);
+    if (attribute.value != nullptr && attribute.type != SessionAttribute::TYPED) {
+      session.replaced.push_back(std::move(attribute.value));
+    }
+    pthread_mutex_unlock(&session.mutex);
+  }
+
+  static std::shared_ptr<void> getSessionAttribute(Session &session, const std::string &name, int type,
+                                                   const std::type_info *typeInfo = nullptr) {
+    std::shared_ptr<void> value;
+    pthread_mutex_lock(&session.mutex);
+    auto it = session.attributes.find(name);
+    if (it != session.attributes.end() && it->second.type == type &&
+        (typeInfo == nullptr || *it->second.typeInfo == *typeInfo)) {
+      value = it->second.value;
+    }
+    pthread_mutex_unlock(&session.mutex);
+    return value;
+  }
+
+  static void removeSessionAttribute(Session &session, const std::string &name) {
+    SessionAttribute removed;
+    pthread_mutex_lock(&session.mutex);
+    auto it = session.attributes.find(name);
+    if (it != session.attributes.end()) {
+      removed = std::move(it->second);
+      session.attributes.erase(it);
+    }
+    pthread_mutex_unlock(&session.mutex);
+  }
+
+  static void schedule(std::vector<Timer> &timers, std::vector<time_t> &expirations) {
+    pthread_mutex_lock(&wheelMutex);
+    for (size_t i = 0; i < timers.size(); i++) {
+      // a later second than the current revolution comes back here first
+      time_t at = expirations[i] > wheelTime ? expirations[i] : wheelTime + 1;
+      wheel[at % HTTP_SESSION_WHEEL_SLOTS].push_back(std::move(timers[i]));
+    }
+    pthread_mutex_unlock(&wheelMutex);
+  }
+
+  static void *reaperRoutine(void *) {
+    pthread_mutex_lock(&reaperMutex);
+    while (!reaperExiting) {
+      struct timespec next;
+      clock_gettime(CLOCK_REALTIME, &next);
+      next.tv_sec++;
+      pthread_cond_timedwait(&reaperCond, &reaperMutex, &next);
+      pthread_mutex_unlock(&reaperMutex);
+      removeExpiredSession();
+      pthread_mutex_lock(&reaperMutex);
+    }
+    pthread_mutex_unlock(&reaperMutex);
+    return nullptr;
+  }
+
+  static std::vector<std::string> getSessionAttributeNames(Session &session) {
+    std::vector<std::string> res;
+    pthread_mutex_lock(&session.mutex);
+    res.reserve(session.attributes.size());
+    for (auto &attribute : session.attributes) {
+      res.push_back(attribute.first);
+    }
+    pthread_mutex_unlock(&session.mutex);
+    return res;
+  }
+
 public:
+  /**
+   * A reference to a session, which stays valid even if the session is
+   * removed or expires meanwhile. Its values are shared pointers: they
+   * stay valid while they are used, even if the attribute is replaced.
+   */
+  class Handle {
+    std::shared_ptr<Session> mSession;
+
+  public:
+    Handle() = default;
+    explicit Handle(std::shared_ptr<Session> session) : mSession(std::move(session)) {}
+
+    explicit operator bool() const { return mSession != nullptr; }
+
+    /**
+     * set a typed attribute
+     * @param name: the attribute name
+     * @param value: the value, moved into the session
+     */
+    template <class T> void set(const std::string &name, T &&value) {
+      if (mSession == nullptr) {
+        return;
+      }
+      typedef typename std::decay<T>::type V;
+      SessionAttribute attribute;
+      attribute.type     = SessionAttribute::TYPED;
+      attribute.value    = std::make_shared<V>(std::forward<T>(value));
+      attribute.typeInfo = &typeid(V);
+      setSessionAttribute(*mSession, name, std::move(attribute));
+    }
+
+    /**
+     * get a typed attribute
+     * @param name: the attribute name
+     * @return the value, or nullptr if not found or of another type
+     */
+    template <class T> std::shared_ptr<T> get(const std::string &name) const {
+      if (mSession == nullptr) {
+        return nullptr;
+      }
+      return std::static_pointer_cast<T>(getSessionAttribute(*mSession, name, SessionAttribute::TYPED, &typeid(T)));
+    }
+
+    void remove(const std::string &name) {
+      if (mSession != nullptr) {
+        removeSessionAttribute(*mSession, name);
+      }
+    }
+
+    std::vector<std::string> getNames() const {
+      return mSession == nullptr ? std::vector<std::string>() : getSessionAttributeNames(*mSession);
+    }
+  };
+
   inline static void setSessionLifeTime(const time_t sec) {
     sessionLifeTime = sec;
   };
@@ -67,39 +256,78 @@ public:
     const char elements[] =
         "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
     const size_t nbElements = sizeof(elements) / sizeof(char);
-    srand(time(nullptr));
+    static thread_local std::mt19937_64 random(std::random_device{}());
 
+    // not make_shared: the timer's weak_ptr would keep the memory
+    std::shared_ptr<Session> session(new Session());
+    session->expiration = time(nullptr) + sessionLifeTime;
     id.reserve(idLength);
 
-    do {
+    bool inserted = false;
+    while (!inserted) {
       id.clear();
       for (size_t i = 0; i < idLength; ++i) {
-        id += elements[rand() % (nbElements - 1)];
+        id += elements[random() % (nbElements - 1)];
       }
-    } while (
-        exists(id)); // GLSR aqui usava updateExpirationIfExists, antiga find
-
-    pthread_mutex_lock(&sessions_mutex);
-    sessions[id] = new std::map<std::string, SessionAttribute>();
-    pthread_mutex_unlock(&sessions_mutex);
-    time_t *expiration = (time_t *)malloc(sizeof(time_t));
-    *expiration = time(nullptr) + sessionLifeTime;
-    setAttribute(id, "session_expiration", expiration);
-
-    // look for expired session (max every minute)
-    if (time(nullptr) > lastExpirationSearchTime + 60) {
+      Shard &shard = shardOf(id);
+      pthread_rwlock_wrlock(&shard.lock);
+      inserted = shard.sessions.emplace(id, session).second;
+      pthread_rwlock_unlock(&shard.lock);
+    }
+    std::vector<Timer>  timer{Timer{id, session}};
+    std::vector<time_t> expiration{session->expiration};
+    schedule(timer, expiration);
+
+    // without a reaper, the requests creating sessions expire the others
+    // (at most every second, by a single thread)
+    time_t now = time(nullptr), last = lastExpirationSearchTime;
+    if (!reaperUsers && now > last && lastExpirationSearchTime.compare_exchange_strong(last, now)) {
       removeExpiredSession();
-      lastExpirationSearchTime = time(nullptr);
     }
   };
 
+  /**
+   * Start the thread expiring the sessions in the background, or count
+   * one more user of it. Called by the web servers as they start.
+   */
+  static void startReaper() {
+    pthread_mutex_lock(&reaperMutex);
+    if (!reaperUsers++) {
+      reaperExiting = false;
+      create_thread(&reaperThread, reaperRoutine, nullptr);
+    }
+    pthread_mutex_unlock(&reaperMutex);
+  }
+
+  /**
+   * Stop the thread expiring the sessions, when its last user stops
+   */
+  static void stopReaper() {
+    pthread_mutex_lock(&reaperMutex);
+    if (!reaperUsers || --reaperUsers) {
+      pthread_mutex_unlock(&reaperMutex);
+      return;
+    }
+    reaperExiting = true;
+    pthread_cond_signal(&reaperCond);
+    pthread_mutex_unlock(&reaperMutex);
+    wait_for_thread(reaperThread);
+  }
+
+  /**
+   * get a handle on a session
+   * @param id: the session id
+   * @return the handle, false if the session doesn't exist
+   */
+  static Handle find(const std::string &id) { return Handle(findSession(id)); }
+
   /**********************************************************************/
 
   static void updateExpiration(const std::string &id) {
     GR_JUMP_TRACE;
-    time_t *expiration = (time_t *)getAttribute(id, "session_expiration");
-    if (expiration) {
-      *expiration = time(nullptr) + sessionLifeTime;
+    std::shared_ptr<Session> session = findSession(id);
+    if (session != nullptr) {
+      session->expiration = time(nullptr) + sessionLifeTime;
     }
   };
 
@@ -107,98 +335,110 @@ public:
 
   static void noExpiration(const std::string &id) {
     GR_JUMP_TRACE;
-    time_t *expiration = (time_t *)getAttribute(id, "session_expiration");
-    if (expiration) {
-      *expiration = 0;
+    std::shared_ptr<Session> session = findSession(id);
+    if (session != nullptr) {
+      session->expiration = 0;
     }
   };
 
   /**********************************************************************/
 
+  // expire the sessions due since the last call: O(due) under the locks,
+  // the sessions used meanwhile go back to the wheel
   static void removeExpiredSession() {
     GR_JUMP_TRACE;
-
-    pthread_mutex_lock(&sessions_mutex);
-    auto it = sessions.cbegin();
-    while (it != sessions.cend()) {
-      spdlog::debug("Removendo sessão expirada: {}", it->first);
-      std::map<std::string, SessionAttribute> *attributesMap = it->second;
-      std::map<std::string, SessionAttribute>::iterator it2 =
-          attributesMap->find("session_expiration");
-      time_t *expiration = nullptr;
-      if (it2 != attributesMap->end()) {
-        expiration = (time_t *)it2->second.ptr;
+    time_t             now = time(nullptr);
+    std::vector<Timer> due;
+
+    pthread_mutex_lock(&wheelMutex);
+    time_t from = now - wheelTime > HTTP_SESSION_WHEEL_SLOTS ? now - HTTP_SESSION_WHEEL_SLOTS + 1 : wheelTime + 1;
+    for (time_t t = from; t <= now; t++) {
+      std::vector<Timer> &slot = wheel[t % HTTP_SESSION_WHEEL_SLOTS];
+      if (due.empty()) {
+        due.swap(slot);
+      } else {
+        std::move(slot.begin(), slot.end(), std::back_inserter(due));
+        slot.clear();
       }
-
-      if (expiration != nullptr && *expiration && *expiration > time(nullptr)) {
-        ++it;
+    }
+    if (now > wheelTime) {
+      wheelTime = now;
+    }
+    pthread_mutex_unlock(&wheelMutex);
+
+    std::vector<Timer>                    later;
+    std::vector<time_t>                   laterExpirations;
+    std::vector<std::shared_ptr<Session>> expired; // released after the unlocks
+    for (Timer &timer : due) {
+      std::shared_ptr<Session> session = timer.session.lock();
+      if (session == nullptr) {
         continue;
       }
-
-      removeAllAttribute(attributesMap);
-      delete attributesMap;
-      sessions.erase(it++);
+      time_t expiration = session->expiration;
+      if (expiration && expiration <= now) {
+        Shard &shard = shardOf(timer.id);
+        pthread_rwlock_wrlock(&shard.lock);
+        auto it      = shard.sessions.find(timer.id);
+        bool current = it != shard.sessions.end() && it->second == session;
+        expiration   = session->expiration; // may have been used meanwhile
+        if (current && expiration && expiration <= now) {
+          spdlog::debug("Removendo sessão expirada: {}", timer.id);
+          shard.sessions.erase(it);
+          expired.push_back(std::move(session));
+          current = false;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+        if (!current) {
+          continue;
+        }
+      }
+      // used meanwhile, or without expiration (checked again a lifetime later)
+      laterExpirations.push_back(expiration ? expiration : now + sessionLifeTime);
+      later.push_back(std::move(timer));
     }
-    pthread_mutex_unlock(&sessions_mutex);
+    schedule(later, laterExpirations);
   }
 
   /**********************************************************************/
 
-  // GLSR Parece que não está sendo usada
   static void removeAllSession() {
     GR_JUMP_TRACE;
-    // pthread_mutex_lock( &sessions_mutex ); // GLSR: Não tem unlock
-    // HttpSessionsContainerMap::iterator it = sessions.begin();
-    // for( ; it != sessions.end(); ) {
-    //   std::map<std::string, SessionAttribute> *attributesMap = it->second;
-    //   removeAllAttribute( attributesMap );
-    //   delete attributesMap;
-    //   sessions.erase( ++it );
-    // }
-    pthread_mutex_lock(&sessions_mutex);
-    for (auto &session : sessions) {
-      std::cerr << "Removendo session " << session.first << std::endl;
-      removeAllAttribute(session.second);
-    }
-    sessions.clear();
-    pthread_mutex_unlock(&sessions_mutex);
+    for (Shard &shard : shards) {
+      std::unordered_map<std::string, std::shared_ptr<Session>> removed;
+      pthread_rwlock_wrlock(&shard.lock);
+      removed.swap(shard.sessions);
+      pthread_rwlock_unlock(&shard.lock);
+      for (auto &session : removed) {
+        std::cerr << "Removendo session " << session.first << std::endl;
+      }
+    }
   }
 
-  static bool exists(const std::string &id) {
-    pthread_mutex_lock(&sessions_mutex);
-    bool ret = sessions.size() && sessions.find(id) != sessions.end();
-    pthread_mutex_unlock(&sessions_mutex);
-    return ret;
-  }
+  static bool exists(const std::string &id) { return findSession(id) != nullptr; }
 
   static bool updateExpirationIfExists(const std::string &id) {
     GR_JUMP_TRACE;
-
-    bool res;
-    pthread_mutex_lock(&sessions_mutex);
-    res = sessions.size() && sessions.find(id) != sessions.end();
-    pthread_mutex_unlock(&sessions_mutex);
-    if (res) {
-      updateExpiration(id);
+    std::shared_ptr<Session> session = findSession(id);
+    if (session == nullptr) {
+      return false;
     }
-
-    return res;
+    session->expiration = time(nullptr) + sessionLifeTime;
+    return true;
   }
 
   /**********************************************************************/
 
   static void remove(const std::string &sid) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::iterator it = sessions.find(sid);
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
-      return;
-    };
-    removeAllAttribute(it->second);
-    delete it->second;
-    sessions.erase(it);
-    pthread_mutex_unlock(&sessions_mutex);
+    std::shared_ptr<Session> removed;
+    Shard &shard = shardOf(sid);
+    pthread_rwlock_wrlock(&shard.lock);
+    auto it = shard.sessions.find(sid);
+    if (it != shard.sessions.end()) {
+      removed = std::move(it->second);
+      shard.sessions.erase(it);
+    }
+    pthread_rwlock_unlock(&shard.lock);
   }
 
   /**********************************************************************/
@@ -207,20 +447,18 @@ public:
   setObjectAttribute(const std::string &sid, const std::string &name,
                      SessionAttributeObject *sessionAttributeObject) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::const_iterator it = sessions.find(sid);
-
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session == nullptr) {
       return;
-    };
-
+    }
+    if (getSessionAttribute(*session, name, SessionAttribute::OBJECT).get() == sessionAttributeObject) {
+      return; // already set: not released twice
+    }
     SessionAttribute attribute;
-    attribute.type = SessionAttribute::OBJECT;
-    attribute.obj = sessionAttributeObject;
-    it->second->insert(
-        std::pair<std::string, SessionAttribute>(name, attribute));
-    pthread_mutex_unlock(&sessions_mutex);
+    attribute.type     = SessionAttribute::OBJECT;
+    attribute.value    = std::shared_ptr<SessionAttributeObject>(sessionAttributeObject);
+    attribute.typeInfo = nullptr;
+    setSessionAttribute(*session, name, std::move(attribute));
   }
 
   /**********************************************************************/
@@ -228,155 +466,83 @@ public:
   static void setAttribute(const std::string &sid, const std::string &name,
                            void *value) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::const_iterator it = sessions.find(sid);
-
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session == nullptr) {
       return;
-    };
-
+    }
+    if (getSessionAttribute(*session, name, SessionAttribute::BASIC).get() == value) {
+      return; // already set: not released twice
+    }
     SessionAttribute attribute;
-    attribute.type = SessionAttribute::BASIC;
-    attribute.ptr = value;
-    it->second->insert(
-        std::pair<std::string, SessionAttribute>(name, attribute));
-    pthread_mutex_unlock(&sessions_mutex);
+    attribute.type     = SessionAttribute::BASIC;
+    attribute.value    = std::shared_ptr<void>(value, ::free);
+    attribute.typeInfo = nullptr;
+    setSessionAttribute(*session, name, std::move(attribute));
   }
 
   /**********************************************************************/
 
+  // the object belongs to the session: valid until the attribute is
+  // removed or the session ends, a replaced object is kept until then
   static SessionAttributeObject *getObjectAttribute(const std::string &sid,
                                                     const std::string &name) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::iterator it = sessions.find(sid);
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session == nullptr) {
       return nullptr;
     }
-
-    std::map<std::string, SessionAttribute> *sessionMap = it->second;
-    std::map<std::string, SessionAttribute>::iterator it2 =
-        sessionMap->find(name);
-    pthread_mutex_unlock(&sessions_mutex);
-
-    if (it2 != sessionMap->end() &&
-        (it2->second.type == SessionAttribute::OBJECT)) {
-      return it2->second.obj;
-    }
-    return nullptr;
+    return static_cast<SessionAttributeObject *>(
+        getSessionAttribute(*session, name, SessionAttribute::OBJECT).get());
   }
 
   /**********************************************************************/
 
+  // the value belongs to the session: valid until the attribute is
+  // removed or the session ends, a replaced value is kept until then
   static void *getAttribute(const std::string &sid, const std::string &name) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::iterator it = sessions.find(sid);
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session == nullptr) {
       return nullptr;
     }
-
-    std::map<std::string, SessionAttribute> *sessionMap = it->second;
-    std::map<std::string, SessionAttribute>::iterator it2 =
-        sessionMap->find(name);
-    pthread_mutex_unlock(&sessions_mutex);
-
-    if (it2 != sessionMap->end() &&
-        (it2->second.type == SessionAttribute::BASIC)) {
-      return it2->second.ptr;
-    }
-    return nullptr;
-  }
-
-  /**********************************************************************/
-
-  static void
-  removeAllAttribute(std::map<std::string, SessionAttribute> *attributesMap) {
-    GR_JUMP_TRACE;
-    for (auto &iter : *attributesMap) {
-      spdlog::debug("Removendo atributo: {}", iter.first);
-      if (iter.second.type == SessionAttribute::OBJECT) {
-        if (iter.second.obj) {
-          delete iter.second.obj;
-          iter.second.obj = nullptr;
-        }
-      } else if (iter.second.type == SessionAttribute::BASIC) {
-        if (iter.second.ptr) {
-          free(iter.second.ptr);
-          iter.second.ptr = nullptr;
-        }
-      }
-    }
+    return getSessionAttribute(*session, name, SessionAttribute::BASIC).get();
   }
 
   /**********************************************************************/
 
   static void removeAttribute(const std::string &sid, const std::string &name) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::iterator it = sessions.find(sid);
-    if (it == sessions.end()) {
-      pthread_mutex_unlock(&sessions_mutex);
-      return;
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session != nullptr) {
+      removeSessionAttribute(*session, name);
     }
-    std::map<std::string, SessionAttribute> *attributesMap = it->second;
-    std::map<std::string, SessionAttribute>::iterator it2 =
-        attributesMap->find(name);
-    if (it2 != attributesMap->end()) {
-      if (it2->second.type == SessionAttribute::OBJECT) {
-        if (it2->second.obj != nullptr) {
-          delete it2->second.obj;
-        }
-      } else if (it2->second.type == SessionAttribute::BASIC) {
-        if (it2->second.ptr != nullptr) {
-          free(it2->second.ptr);
-        }
-      }
-      attributesMap->erase(it2);
-    }
-    pthread_mutex_unlock(&sessions_mutex);
   }
 
   /**********************************************************************/
 
   static std::vector<std::string> getAttributeNames(const std::string &sid) {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    std::vector<std::string> res;
-    HttpSessionsContainerMap::iterator it = sessions.find(sid);
-    if (it != sessions.end()) {
-      std::map<std::string, SessionAttribute> *attributesMap = it->second;
-      std::map<std::string, SessionAttribute>::iterator iter =
-          attributesMap->begin();
-      for (; iter != attributesMap->end(); ++iter) {
-        res.push_back(iter->first);
-      }
+    std::shared_ptr<Session> session = findSession(sid);
+    if (session == nullptr) {
+      return std::vector<std::string>();
     }
-    pthread_mutex_unlock(&sessions_mutex);
-    return res;
+    return getSessionAttributeNames(*session);
   }
 
   /**********************************************************************/
 
   static void printAll() {
     GR_JUMP_TRACE;
-    pthread_mutex_lock(&sessions_mutex);
-    HttpSessionsContainerMap::iterator it = sessions.begin();
-    for (; it != sessions.end(); ++it) {
-      std::map<std::string, SessionAttribute> *attributesMap = it->second;
-      printf("Session SID : '%s' \n", it->first.c_str());
-      std::map<std::string, SessionAttribute>::iterator iter =
-          attributesMap->begin();
-      for (; iter != attributesMap->end(); ++iter) {
-        if (iter->second.ptr != nullptr) {
-          printf("\t'%s'\n", iter->first.c_str());
+    for (Shard &shard : shards) {
+      pthread_rwlock_rdlock(&shard.lock);
+      for (auto &it : shard.sessions) {
+        printf("Session SID : '%s' \n", it.first.c_str());
+        for (const std::string &name : getSessionAttributeNames(*it.second)) {
+          printf("\t'%s'\n", name.c_str());
         }
       }
+      pthread_rwlock_unlock(&shard.lock);
     }
-    pthread_mutex_unlock(&sessions_mutex);
   }
 
   /**********************************************************************/
@@ -18,26 +18,134 @@
 
 #include "WebRepository.hh"
 
+#include "libnavajo/nvjContentCache.h"
+#include "libnavajo/nvjRcu.h"
 #include "libnavajo/nvjThread.h"
+#include "libnavajo/nvjThreadPool.h"
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <sys/stat.h>
+#include <vector>
 
 class LocalRepository : public WebRepository {
-  pthread_mutex_t _mutex;
+public:
+  typedef enum {
+    FULL_SCAN,      // the directory is scanned by the constructor and reload()
+    LAZY,           // the files are resolved on demand, nothing is scanned
+    LAZY_BACKGROUND // resolved on demand until scanned in the background
+  } IndexingMode;
 
-  std::set<std::string> filenamesSet; // list of available files
+private:
+  typedef std::set<std::string>                     FilenamesSet;
+  typedef std::vector<std::pair<std::string, bool>> FilenamesChanges; // url, exists
+  NvjRcuPtr<FilenamesSet>                           filenamesSet;     // list of available files, lock-free lookups
   // pair<std::string,std::string> aliasesSet; // alias name | Path to local
   // directory
   std::string aliasName;
   std::string fullPathToLocalDir;
 
-  bool loadFilename_dir(const std::string &alias, const std::string &path,
-                        const std::string &subpath = "");
+  // indexing
+  IndexingMode                             indexingMode;
+  std::atomic<bool>                        indexed;        // filenamesSet lists all the files
+  bool                                     indexing;       // a scan is in progress, protected by updateMutex
+  FilenamesChanges                         pendingChanges; // changes seen meanwhile, applied to its result
+  int                                      rootFd;         // for the lazy resolution
+  std::unique_ptr<NvjContentCache<time_t>> missingFiles;   // negative cache: expiration times
+  pthread_t                                indexerThread;
+  bool                                     indexerStarted;
+  std::atomic<bool>                        indexerRunning, indexerRescan, indexerStopping;
+  pthread_mutex_t                          indexMutex; // serializes the scans
+
+  // content of a file, shared by the cache and the responses being sent
+  struct FileContent {
+    std::vector<unsigned char> data;
+    struct stat                st;
+  };
+  std::unique_ptr<NvjContentCache<FileContent>> cache; // nullptr if disabled
+  size_t                                        maxCachedFileSize;
+  size_t                                        sendFileThreshold;
+
+  // inotify invalidation of the cache
+  std::atomic<int>           inotifyFd; // read without lock by getFile()
+  int                        stopFd;
+  pthread_t                  watcherThread;
+  std::map<int, std::string> watchedDirs;  // watch descriptor -> subpath
+  std::set<int>              addedWatches; // since the start of the last scan
+  pthread_mutex_t            watchMutex;
+  pthread_mutex_t            updateMutex; // serializes the updates of the list of files
+
+  // concurrent scan of the subdirectories, by the shared pool
+  struct ParallelScan {
+    NvjThreadPool  &pool;
+    NvjWaitGroup    pending;
+    pthread_mutex_t mutex;
+
+    ParallelScan() : pool(NvjThreadPool::shared()) { pthread_mutex_init(&mutex, nullptr); }
+    ~ParallelScan() { pthread_mutex_destroy(&mutex); }
+  };
+
+  bool loadFilename_dir(FilenamesSet &filenames, const std::string &alias, const std::string &path,
+                        const std::string &subpath = "", ParallelScan *parallel = nullptr);
+  void index(bool parallel);
+  void startIndexing();
+  void indexInBackground();
+  void updateFilenames(const FilenamesChanges &changes);
   bool fileExist(const std::string &url);
+  int  openBeneath(const std::string &relativePath);
+  void watchDirectory(const std::string &subpath);
+  void watchEvents();
+  void stopWatching();
+
+  inline static void *startWatcher(void *t) {
+    static_cast<LocalRepository *>(t)->watchEvents();
+    pthread_exit(nullptr);
+    return nullptr;
+  };
+
+  inline static void *startIndexer(void *t) {
+    static_cast<LocalRepository *>(t)->indexInBackground();
+    pthread_exit(nullptr);
+    return nullptr;
+  };
 
 public:
-  LocalRepository(const std::string &alias, const std::string &dirPath);
-  virtual ~LocalRepository() {};
+  /**
+   * @param alias: the url prefix of the files
+   * @param dirPath: the directory
+   * @param mode: FULL_SCAN lists the files at startup and on reload().
+   *   LAZY opens the requested files on demand (component by component,
+   *   "." and ".." are refused) and remembers the missing ones for a few
+   *   seconds, for an immediate startup and a memory proportional to the
+   *   requested files. LAZY_BACKGROUND also scans the directory with
+   *   parallel threads, and uses the list of files once complete.
+   */
+  LocalRepository(const std::string &alias, const std::string &dirPath, IndexingMode mode = FULL_SCAN);
+  virtual ~LocalRepository();
+
+  /**
+   * Keep the content of the files in memory, up to maxSize bytes.
+   * The cache is invalidated by inotify: the modified files are reread
+   * within milliseconds, and the created or deleted files are seen without
+   * calling reload(). Where inotify is not available, each hit checks the
+   * file with stat().
+   * Should be called before the server starts.
+   * @param maxSize: the size of the cache in bytes, 0 to disable it
+   * @param maxFileSize: larger files are not cached (default: maxSize/8)
+   */
+  void setCacheSize(size_t maxSize, size_t maxFileSize = 0);
+
+  /**
+   * Send the files from this size directly from their descriptor, without
+   * reading them: sendfile(), or io_uring (WebServer::setIoUring()). The
+   * cached files, and the compressible files requested by a client
+   * accepting gzip, are still read.
+   * @param bytes: the threshold, 0 to always read the files (default: 64KB)
+   */
+  inline void setSendFileThreshold(size_t bytes) { sendFileThreshold = bytes; }
 
   /**
    * Try to resolve an http request by requesting the LocalRepository. Inherited
@@ -54,25 +162,32 @@ public:
    * called from WebServer::accept_request() method
    * @param webpage: a pointer to the generated page
    */
-  // GLSR FIXME override
-  void freeFile(unsigned char *webpage) override {
-    GR_JUMP_TRACE;
-    ::free(webpage);
-  };
+  // The content belongs to the response (setContentOwner)
+  inline void freeFile([[maybe_unused]] unsigned char *webpage) override {};
 
   /**
    * Reload the content of the directory
-   * SHOULD BE CALLED EACH TIME A FILE IS CREATED, MODIFIED, OR DELETED
+   * SHOULD BE CALLED EACH TIME A FILE IS CREATED, MODIFIED, OR DELETED,
+   * unless the cache is enabled and inotify is available
+   * In LAZY_BACKGROUND mode, the new scan is done in the background.
    */
   void reload();
 
   /**
    * Return the list of available resources (list of url)
+   * In the lazy modes, it is empty or incomplete until indexed.
+   * The list stays valid while the returned snapshot is alive, reload()
+   * must not be called meanwhile by the same thread.
    */
-  inline std::set<std::string> *getFilenames() {
+  inline NvjRcuPtr<FilenamesSet>::ReadGuard getFilenames() {
     GR_JUMP_TRACE;
-    return &filenamesSet;
+    return filenamesSet.read();
   }
+
+  /**
+   * @return true once the list of files is complete
+   */
+  inline bool isIndexed() const { return indexed.load(std::memory_order_acquire); }
 };
 
 #endif
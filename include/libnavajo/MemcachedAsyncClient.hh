@@ -0,0 +1,111 @@
+//********************************************************
+/**
+ * @file  MemcachedAsyncClient.hh
+ *
+ * @brief Pipelined non-blocking memcached gets
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef MEMCACHEDASYNCCLIENT_HH_
+#define MEMCACHEDASYNCCLIENT_HH_
+
+#include <atomic>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+typedef enum { MEMCACHED_ASYNC_FOUND, MEMCACHED_ASYNC_NOTFOUND, MEMCACHED_ASYNC_ERROR } MemcachedAsyncStatus;
+
+// ----------------------------------------------------------------------
+// memcached client multiplexing the gets of all the threads on one
+// persistent non-blocking connection per server: the requests are
+// pipelined (text protocol, answered in order) by a single I/O thread,
+// which calls their completion when the response arrives
+// ----------------------------------------------------------------------
+class MemcachedAsyncClient {
+public:
+  // called by the I/O thread: should be short, and not call the client
+  typedef std::function<void(MemcachedAsyncStatus status, std::shared_ptr<char> data, size_t length, uint32_t flags)>
+      Completion;
+
+private:
+  struct Request {
+    std::string host;
+    int port;
+    std::string key;
+    Completion done;
+    int64_t deadline; // ms, monotonic clock
+  };
+
+  // a connection, owned by the I/O thread
+  struct Server {
+    std::string host;
+    int port;
+    int fd;
+    bool connecting;
+    int64_t retryAt; // after a failure, the requests fail at once until then
+    std::string out, in;
+    size_t outPos;
+    std::deque<Request> pending; // sent, in order
+
+    // the response being read
+    bool valueSeen;
+    std::shared_ptr<char> data;
+    size_t length;
+    uint32_t flags;
+  };
+
+  unsigned mIoTimeout;    // ms
+  unsigned mRetryTimeout; // s
+  pthread_t mThread;
+  int mWakeup[2]; // pipe waking the I/O thread up
+  std::atomic<bool> mExiting;
+
+  std::vector<Request> mQueue; // submitted by the threads
+  pthread_mutex_t mQueueMutex;
+
+  std::map<std::string, std::unique_ptr<Server>> mServers; // by host:port
+
+  static void *startRoutine(void *p);
+  void run();
+  Server *server(const std::string &host, int port);
+  void submit(Request &request, int64_t now);
+  bool connect(Server *srv);
+  void fail(Server *srv, int64_t now);
+  bool writeSome(Server *srv);
+  bool readSome(Server *srv);
+  bool parse(Server *srv);
+
+public:
+  /**
+   * Start the I/O thread
+   * @param ioTimeout: the time given to a server to answer, in ms
+   * @param retryTimeout: the time a server is not asked again after a failure, in s
+   * @throw std::runtime_error if the thread can't be started
+   */
+  MemcachedAsyncClient(unsigned ioTimeout, unsigned retryTimeout);
+
+  // the requests in progress complete with MEMCACHED_ASYNC_ERROR
+  ~MemcachedAsyncClient();
+  MemcachedAsyncClient(const MemcachedAsyncClient &) = delete;
+  MemcachedAsyncClient &operator=(const MemcachedAsyncClient &) = delete;
+
+  /**
+   * Get a value, without waiting for the server
+   * @param host, port: the server of the key
+   * @param key: the key, without spaces nor control characters
+   * @param done: called once with the result
+   * @return false if the key can't be sent in the text protocol (done isn't called)
+   */
+  bool get(const std::string &host, int port, const std::string &key, Completion done);
+};
+
+#endif
@@ -2,40 +2,283 @@
 #define __MEMCACHED_REPOSITORY_HH__
 
 #include <cinttypes>
+#include <map>
 #include <memory>
+#include <pthread.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 
-#include <libmemcached/memcached.hpp>
+#include <libmemcached/util.h>
 
 #include "WebRepository.hh"
 #include "libnavajo/GrDebug.hpp"
+#include "libnavajo/MemcachedAsyncClient.hh"
+#include "libnavajo/nvjContentCache.h"
+
+#define MEMCACHED_DEFAULT_POOL_SIZE        64
+#define MEMCACHED_DEFAULT_CONNECT_TIMEOUT  1000 // ms
+#define MEMCACHED_DEFAULT_IO_TIMEOUT       500  // ms
+#define MEMCACHED_DEFAULT_CHECKOUT_TIMEOUT 1000 // ms
+#define MEMCACHED_DEFAULT_RETRY_TIMEOUT    2    // s
+#define MEMCACHED_DEFAULT_FAILURE_LIMIT    2
+#define MEMCACHED_DEFAULT_L1_TTL           5    // s
+#define MEMCACHED_DEFAULT_L1_NEGATIVE_TTL  1    // s
+#define MEMCACHED_DEFAULT_L1_SHARDS        16
+#define MEMCACHED_DEFAULT_EARLY_REFRESH    1.0
+#define MEMCACHED_DEFAULT_ASYNC_WAIT       50   // ms
+#define MEMCACHED_DEFAULT_COMPRESSION_MIN  1024 // bytes
+#define MEMCACHED_DEFAULT_COMPRESSION_LEVEL 9
+
+// flag of the values stored gzipped (the other bits are left to the application)
+#define MEMCACHED_FLAG_GZIP 0x80000000u
+
+// ----------------------------------------------------------------------
+// a memcached server, and its share of the keys
+// ----------------------------------------------------------------------
+struct MemcachedServer {
+  std::string host;
+  int port;
+  uint32_t weight;
+
+  MemcachedServer(const std::string &h = "127.0.0.1", const int p = 11211, const uint32_t w = 1)
+      : host(h), port(p), weight(w) {}
+};
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
 class MemcachedRepository : public WebRepository {
 private:
-  std::shared_ptr<memcache::Memcache> mMemCacheClient;
+  memcached_st *mMemc; // configuration of the connections, cloned by the pool
+  memcached_pool_st *mPool;
   std::string mPrefix;
-  std::string mServer;
-  int mPort;
+  std::vector<MemcachedServer> mServers;
+  unsigned mCheckoutTimeout, mIoTimeout, mRetryTimeout;
+
+  // a connection checked out of the pool for the duration of an operation
+  class Connection {
+    memcached_pool_st *mPool;
+    memcached_st *mMemc;
+
+  public:
+    explicit Connection(const MemcachedRepository &repo);
+    ~Connection();
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+    inline memcached_st *get() const { return mMemc; }
+  };
+
+  // a value read from memcached, shared by the local cache and the responses
+  struct Value {
+    std::shared_ptr<char> data; // allocated by libmemcached
+    size_t length;
+    uint32_t flags;
+    bool found;         // false: the key is missing
+    int64_t expiration; // in the local cache (ms, monotonic clock)
+    int64_t delta;      // duration of the fetch (ms)
+  };
+  typedef NvjContentCache<Value> LocalCache;
+
+  // local cache, sharded by key (empty if disabled)
+  std::vector<std::unique_ptr<LocalCache>> mLocalCache;
+  unsigned mLocalTtl, mLocalNegativeTtl;
+  double mEarlyRefresh;
+
+  // a lookup in progress, waited for by the concurrent lookups of the same key
+  struct Flight {
+    bool done;
+    bool regenerating;        // missing key: set() is awaited until the deadline
+    struct timespec deadline; // monotonic clock
+    std::shared_ptr<const Value> value;
+    pthread_cond_t cond;
+
+    Flight();
+    ~Flight() { pthread_cond_destroy(&cond); }
+    inline bool isExpired(int64_t now) const {
+      return regenerating && (int64_t)deadline.tv_sec * 1000 + deadline.tv_nsec / 1000000 <= now;
+    }
+  };
+  std::unordered_map<std::string, std::shared_ptr<Flight>> mFlights;
+  pthread_mutex_t mFlightsMutex;
+  unsigned mRegenerationLease;
+  int64_t mFlightsSweep; // next removal of the expired leases (ms, monotonic clock)
+
+  size_t mCompressionMin; // 0: values stored as is
+  int mCompressionLevel;
+
+  // a get sent by the asynchronous client, waited for at most mAsyncWait
+  struct AsyncFetch {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool done;
+    bool abandoned; // the request went on without it
+    MemcachedAsyncStatus status;
+    Value value;
+
+    AsyncFetch();
+    ~AsyncFetch();
+  };
+  std::unique_ptr<MemcachedAsyncClient> mAsync;
+  unsigned mAsyncWait;
+
+  static int64_t nowMs();
+  void land(const std::string &url, const std::shared_ptr<Flight> &flight, std::shared_ptr<const Value> value);
+  void sweepFlights(int64_t now);
+
+  inline LocalCache *localCacheShard(const std::string &url) const {
+    return mLocalCache.empty() ? nullptr
+                               : mLocalCache[std::hash<std::string>()(url) % mLocalCache.size()].get();
+  }
+  void invalidate(const std::string &url);
+
   time_t expiryTime(const time_t t);
-  bool get(const std::string &url, std::vector<char> &vec);
-  bool get(const std::string &url, std::string &value);
+  bool store(const std::string &url, const char *data, size_t length, time_t expiry, uint32_t flags);
+  bool fetch(const std::string &url, Value &value);
+  bool fetchAsync(const std::string &url, Value &value, uint64_t generation);
+  std::shared_ptr<const Value> lookup(const std::string &url);
+  static bool decode(const char *data, size_t length, uint32_t flags, std::string &value);
 
 public:
+  /**
+   * @param prefix: the prefix of the keys
+   * @param server, port: the memcached server
+   * @param poolSize: the maximum number of connections, shared by the
+   *   worker threads (a thread waits for a connection when they are all in use)
+   * @throw std::runtime_error if the client can't be created
+   */
   MemcachedRepository(const std::string &prefix, const std::string &server = "127.0.0.1",
-                      const int port = 11211);
-  virtual ~MemcachedRepository() {};
+                      const int port = 11211, const size_t poolSize = MEMCACHED_DEFAULT_POOL_SIZE);
+
+  /**
+   * @param prefix: the prefix of the keys
+   * @param servers: the memcached servers. The keys are distributed by
+   *   consistent hashing (ketama) according to their weights: adding or
+   *   removing a server only moves its share of the keys. A server failing
+   *   repeatedly is ejected, its keys going to the others, until the retry
+   *   timeout.
+   * @param poolSize: the maximum number of connections (to all the servers)
+   * @throw std::runtime_error if the client can't be created
+   */
+  MemcachedRepository(const std::string &prefix, const std::vector<MemcachedServer> &servers,
+                      const size_t poolSize = MEMCACHED_DEFAULT_POOL_SIZE);
+  virtual ~MemcachedRepository();
+  MemcachedRepository(const MemcachedRepository &) = delete;
+  MemcachedRepository &operator=(const MemcachedRepository &) = delete;
+
+  /**
+   * Set the timeouts, in milliseconds
+   * @param connectTimeout: to connect to the server (default: 1000)
+   * @param ioTimeout: to wait for the server on an established connection (default: 500)
+   * @param checkoutTimeout: to wait for a free connection of the pool (default: 1000)
+   */
+  void setTimeouts(unsigned connectTimeout, unsigned ioTimeout, unsigned checkoutTimeout);
+
+  /**
+   * Set the delay before reconnecting to a server after a failure
+   * @param seconds: the delay (default: 2)
+   */
+  void setRetryTimeout(unsigned seconds);
+
+  /**
+   * Set the number of consecutive failures after which a server is ejected
+   * @param failures: the limit (default: 2)
+   */
+  void setServerFailureLimit(unsigned failures);
+
+  /**
+   * Talk to the servers with the binary protocol instead of the text one.
+   * Should be called before the server starts.
+   */
+  void setBinaryProtocol(bool binary);
+
+  /**
+   * Read the values through a single pipelined connection per server,
+   * driven by an I/O thread, instead of a connection of the pool held by
+   * the worker thread for the whole round trip. A request waits for its
+   * value at most maxWait milliseconds, then goes on to the next
+   * repositories: a slow server only delays the requests by maxWait
+   * instead of holding the worker threads of the whole server until the
+   * I/O timeout. A value arriving too late still fills the local cache
+   * for the next requests. A get failing on its server is retried through
+   * the pool, which ejects the failing servers.
+   * set(), remove() and getMulti() still use the pool.
+   * Should be called before the server starts.
+   * @param maxWait: the time a request waits for memcached, in ms, 0 to
+   *   disable (default)
+   * @throw std::runtime_error if the I/O thread can't be started
+   */
+  void setAsync(unsigned maxWait = MEMCACHED_DEFAULT_ASYNC_WAIT);
+
+  /**
+   * Keep the values read from memcached in memory, and the missing keys
+   * for a shorter time, so that the hot keys and the urls served by the
+   * next repositories don't make a round trip. set() and remove()
+   * invalidate the local copy, the changes made by other processes are
+   * seen after the ttl.
+   * Should be called before the server starts.
+   * @param maxSize: the size of the cache in bytes, 0 to disable it
+   * @param ttl: the lifetime of the values, in seconds (default: 5)
+   * @param negativeTtl: the lifetime of the missing keys, in seconds, 0 to
+   *   not remember them (default: 1)
+   * @param shards: the number of independent parts, to spread the locks (default: 16)
+   */
+  void setLocalCache(size_t maxSize, unsigned ttl = MEMCACHED_DEFAULT_L1_TTL,
+                     unsigned negativeTtl = MEMCACHED_DEFAULT_L1_NEGATIVE_TTL,
+                     unsigned shards = MEMCACHED_DEFAULT_L1_SHARDS);
+
+  /**
+   * Refresh the values of the local cache before their expiration, by a
+   * single request while the others are still served the cached value.
+   * A request refreshes early with a probability growing as the
+   * expiration approaches, and with the duration of the previous fetch.
+   * @param beta: 0 to disable, > 1 to favour earlier refreshes (default: 1)
+   */
+  inline void setEarlyRefresh(double beta) { mEarlyRefresh = beta; }
+
+  /**
+   * When a key is missing, let a single request regenerate it: this one
+   * goes on to the next repositories (a DynamicPage calling set()), while
+   * the concurrent requests for the same key wait for set() to give them
+   * the new value, at most leaseTime milliseconds.
+   * The missing keys are then not kept in the local cache: use this for a
+   * prefix whose keys are all regenerated.
+   * @param leaseTime: the time given to regenerate the value, 0 to disable
+   *   (default), the waiting requests go on to the next repositories after it
+   */
+  inline void setRegenerationLease(unsigned leaseTime) { mRegenerationLease = leaseTime; }
+
+  /**
+   * Store the values gzipped, flagged with MEMCACHED_FLAG_GZIP: memcached
+   * holds and sends fewer bytes, and getFile() serves them as is to the
+   * clients accepting gzip (uncompressed by the server for the others).
+   * Only the values whose url doesn't name an already compressed type
+   * (images, archives...) are compressed, and kept so if they shrink.
+   * A value set with the MEMCACHED_FLAG_GZIP flag is taken as already gzipped.
+   * @param minSize: the smallest value compressed, 0 to disable (default)
+   * @param level: the zlib compression level, paid once by set() (default: 9)
+   */
+  void setCompression(size_t minSize = MEMCACHED_DEFAULT_COMPRESSION_MIN,
+                      int level = MEMCACHED_DEFAULT_COMPRESSION_LEVEL);
+
   bool set(const std::string &url, const std::vector<char> &vec, time_t expiry = 0,
            uint32_t flags = 0);
   bool set(const std::string &url, const std::string &value, time_t expiry = 0,
            uint32_t flags = 0);
   bool remove(const std::string &url);
+
+  /**
+   * Get several values at once: the keys are requested from all their
+   * servers in parallel, in one round trip (and from the local cache)
+   * @param urls: the urls to look up
+   * @param values: receives the values found, by url (uncompressed)
+   * @return the number of values found
+   */
+  size_t getMulti(const std::vector<std::string> &urls, std::map<std::string, std::string> &values);
   bool getFile(HttpRequest *request, HttpResponse *response) override;
-  void freeFile(unsigned char *webpage) override;
+  // The value belongs to the response (setContentOwner)
+  inline void freeFile([[maybe_unused]] unsigned char *webpage) override {};
 };
 
 #endif
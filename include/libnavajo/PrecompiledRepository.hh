@@ -14,24 +14,77 @@
 #ifndef PRECOMPILEDREPOSITORY_HH_
 #define PRECOMPILEDREPOSITORY_HH_
 
-#include "nvjThread.h"
-#include <map>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 #include "libnavajo/WebRepository.hh"
+#include "libnavajo/nvjPerfectHash.h"
 
+/**
+ * PrecompiledRepository - serves the files embedded by navajoPrecompiler.
+ *
+ * The generated code defines a constexpr minimal perfect hash table of
+ * the files: lookups are O(1), without any initialization nor locking.
+ */
 class PrecompiledRepository : public WebRepository {
-  pthread_mutex_t _mutex;
-
-  struct WebStaticPage {
-    const unsigned char *data;
+public:
+  /**
+   * An encoding of an embedded file
+   */
+  struct Variant {
+    const unsigned char *data; // nullptr if not embedded
     size_t               length;
-    WebStaticPage(const unsigned char *d, size_t l) : data(d), length(l) {};
+    const char          *headers; // Content-Type, Content-Length, Content-Encoding, ETag, Vary
+  };
+
+  /**
+   * An embedded file, with its gzip and brotli versions
+   */
+  struct Asset {
+    std::string_view name;
+    Variant          identity, gzip, brotli;
+    const char      *mimeType; // nullptr if unknown
+    const char      *etag;     // quoted strong validator of the identity
+  };
+
+  /**
+   * The perfect hash table of the embedded files
+   */
+  struct Index {
+    const Asset    *assets;
+    size_t          nbAssets;
+    const uint32_t *seeds;
+    size_t          nbBuckets;
   };
 
-  typedef std::map<std::string, const WebStaticPage> IndexMap;
-  static IndexMap                                    indexMap;
-  static std::string                                 location;
+  /**
+   * Find an embedded file
+   * @return the file, nullptr if not found
+   */
+  static constexpr const Asset *find(const Index &idx, std::string_view name) {
+    if (!idx.nbAssets) {
+      return nullptr;
+    }
+    const Asset *asset = &idx.assets[nvj_phash_slot(name, idx.seeds, idx.nbBuckets, idx.nbAssets)];
+    return asset->name == name ? asset : nullptr;
+  }
+
+  /**
+   * Check, at compile time, that each file is found at its slot
+   */
+  static constexpr bool checkIndex(const Index &idx) {
+    for (size_t i = 0; i < idx.nbAssets; i++) {
+      if (find(idx, idx.assets[i].name) != &idx.assets[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  static const Index index; // defined by the generated code
+  static std::string location;
 
 public:
   PrecompiledRepository(const std::string &l = "") {
@@ -42,14 +95,8 @@ public:
     while (location.size() && location[location.size() - 1] == '/') {
       location.erase(location.size() - 1);
     }
-    pthread_mutex_init(&_mutex, nullptr);
-    if (!indexMap.size()) {
-      initIndexMap();
-    }
   };
-  virtual ~PrecompiledRepository() { indexMap.clear(); };
-
-  static void initIndexMap();
+  virtual ~PrecompiledRepository() {};
 
   /**
    * Free resources after use. Inherited from class WebRepository
@@ -67,37 +114,59 @@ public:
    * \return true if the repository contains the requested resource
    */
   inline bool getFile(HttpRequest *request, HttpResponse *response) override {
-    std::string url = request->getUrl();
+    std::string_view url = request->getUrl();
     if (url.compare(0, location.length(), location) != 0) {
       return false;
     }
 
-    url.erase(0, location.length());
+    url.remove_prefix(location.length());
     while (url.size() && url[0] == '/') {
-      url.erase(0, 1);
+      url.remove_prefix(1);
     }
     if (!url.size()) {
       url = "index.html";
     }
 
-    size_t         webpageLen;
-    unsigned char *webpage;
-    pthread_mutex_lock(&_mutex);
-    IndexMap::const_iterator i = indexMap.find(url);
-    if (i == indexMap.end()) {
-      i = indexMap.find(url + ".gz");
-      if (i == indexMap.end()) {
-        pthread_mutex_unlock(&_mutex);
-        return false;
-      } else {
-        response->setIsZipped(true);
-      }
+    const Asset *asset = find(index, url);
+    if (asset == nullptr) {
+      return false;
+    }
+
+    if (asset->mimeType != nullptr) {
+      response->setMimeType(asset->mimeType);
+    }
+
+    if (request->isNotModified(asset->etag)) {
+      response->addSpecificHeader(std::string("ETag: ") + asset->etag);
+      response->setHttpReturnCode(304);
+      response->setContent(nullptr, 0);
+      return true;
     }
 
-    webpage    = (unsigned char *)((i->second).data);
-    webpageLen = (i->second).length;
-    pthread_mutex_unlock(&_mutex);
-    response->setContent(webpage, webpageLen);
+    // the embedded versions are sent as is, with their prerendered headers
+    const Variant *variant = nullptr;
+    if (asset->brotli.data != nullptr && request->acceptsEncoding("br")) {
+      variant = &asset->brotli;
+    } else if (asset->gzip.data != nullptr && request->acceptsEncoding("gzip")) {
+      variant = &asset->gzip;
+    } else if (asset->identity.data != nullptr) {
+      variant = &asset->identity;
+    }
+
+    if (variant != nullptr) {
+      response->setContent(const_cast<unsigned char *>(variant->data), variant->length);
+      response->setPrerenderedHeaders(variant->headers);
+      return true;
+    }
+
+    // empty file, or gzip version only: uncompressed by the server if needed
+    response->addSpecificHeader(std::string("ETag: ") + asset->etag);
+    if (asset->gzip.data != nullptr) {
+      response->setContent(const_cast<unsigned char *>(asset->gzip.data), asset->gzip.length);
+      response->setIsZipped(true);
+    } else {
+      response->setContent(nullptr, 0);
+    }
     return true;
   };
 };
@@ -110,6 +110,8 @@ class WebServer {
   ushort             socketTimeoutInSecond;
   ushort             tcpPort;
   size_t             threadsPoolSize;
+  size_t             parallelGzipThreshold;
+  bool               ioUring;
   std::string        device;
 
   std::string multipartTempDirForFileUpload;
@@ -149,6 +151,22 @@ public:
    */
   inline void setThreadsPoolSize(const size_t nbThread) { threadsPoolSize = nbThread; };
 
+  /**
+   * Set the response size from which gzip compression is split across
+   * the shared worker pool.
+   * @param bytes: the threshold, 0 to always compress on the request thread
+   * (Default value: 1MB)
+   */
+  inline void setParallelGzipThreshold(const size_t bytes) { parallelGzipThreshold = bytes; };
+
+  /**
+   * Splice the files sent from their descriptor through io_uring instead
+   * of sendfile(). The kernel support is probed at runtime, sendfile() is
+   * kept if io_uring is unavailable.
+   * @param b: true to use io_uring (Default value: false)
+   */
+  inline void setIoUring(const bool b = true) { ioUring = b; };
+
   /**
    * Set the tcp port to listen.
    * @param p: the port number, from 1 to 65535 (Default value: 8080)
@@ -348,6 +366,7 @@ public:
   bool isRunning() { return threadWebServer != 0; }
 
   static bool httpSend(ClientSockData *client, const void *buf, size_t len);
+  static bool httpSendFile(ClientSockData *client, int fd, size_t len, bool useIoUring = false);
 
   inline static void freeClientSockData(ClientSockData *clientSockData) {
     closeSocket(clientSockData);
@@ -34,6 +34,7 @@ class WebSocketClient {
     unsigned char z_dictionary_inflate[32768];
     unsigned int  dictInfLength;
     z_stream      strm_deflate;
+    int           level;
   } GzipContext;
 
   GzipContext                  gzipcontext;
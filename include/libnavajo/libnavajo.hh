@@ -1,3 +1,5 @@
+#include "libnavajo/BundleRepository.hh"
+#include "libnavajo/CompressionController.hh"
 #include "libnavajo/DynamicPage.hh"
 #include "libnavajo/DynamicRepository.hh"
 #include "libnavajo/LocalRepository.hh"
@@ -0,0 +1,230 @@
+//********************************************************
+/**
+ * @file  nvjBundle.h
+ *
+ * @brief memory-mappable bundle of web files, written by
+ *        navajoPrecompiler --bundle and served by
+ *        BundleRepository
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJBUNDLE_H_
+#define NVJBUNDLE_H_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libnavajo/nvjPerfectHash.h"
+
+/*
+ * Layout (host byte order, checked with byteOrder):
+ *
+ *   NvjBundleHeader
+ *   uint32_t        seeds[nbBuckets]     perfect hash seeds
+ *   NvjBundleEntry  entries[nbEntries]   ordered by perfect hash slot
+ *   char            strings[]            names, mime types, etags, headers,
+ *                                        each one followed by a '\0'
+ *   blobs                                starting on a page boundary,
+ *                                        blobs of a page or more are page-aligned
+ */
+
+#define NVJ_BUNDLE_MAGIC "NVJBNDL"
+#define NVJ_BUNDLE_VERSION 1
+#define NVJ_BUNDLE_BYTE_ORDER 0x01020304
+#define NVJ_BUNDLE_PAGE_SIZE 4096
+
+typedef enum { NVJ_BUNDLE_IDENTITY = 0, NVJ_BUNDLE_GZIP, NVJ_BUNDLE_BROTLI, NVJ_BUNDLE_NB_VARIANTS } NvjBundleVariantId;
+
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t nbEntries;
+  uint32_t nbBuckets;
+  uint64_t seedsOffset;
+  uint64_t entriesOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsLength;
+  uint64_t fileLength;
+} NvjBundleHeader;
+
+typedef struct {
+  uint64_t offset; // in the file, 0 if the variant doesn't exist
+  uint64_t length;
+  uint32_t headersOffset; // in the strings, prerendered headers (nul-terminated)
+  uint32_t headersLength;
+} NvjBundleVariant;
+
+typedef struct {
+  uint32_t         nameOffset, nameLength; // in the strings
+  uint32_t         mimeOffset, mimeLength; // mimeLength is 0 if unknown
+  uint32_t         etagOffset, etagLength;
+  NvjBundleVariant variants[NVJ_BUNDLE_NB_VARIANTS];
+} NvjBundleEntry;
+
+//********************************************************
+
+/**
+ * NvjBundle - a read-only mapping of a bundle file.
+ * The whole file is validated when it is opened, the pages are then
+ * loaded on demand by the kernel.
+ */
+class NvjBundle {
+  const unsigned char   *mMap;
+  size_t                 mLength;
+  const NvjBundleHeader *mHeader;
+  const uint32_t        *mSeeds;
+  const NvjBundleEntry  *mEntries;
+  const char            *mStrings;
+  dev_t                  mDevice;
+  ino_t                  mInode;
+  time_t                 mModified;
+
+  // offset + length <= size, written so that it can't wrap
+  static inline bool inRange(uint64_t offset, uint64_t length, uint64_t size) {
+    return length <= size && offset <= size - length;
+  }
+
+  inline bool inStrings(uint32_t offset, uint32_t length) const {
+    return inRange(offset, length, mHeader->stringsLength);
+  }
+
+  // the prerendered headers and their terminating '\0'
+  inline bool headersInStrings(uint32_t offset, uint32_t length) const {
+    return offset < mHeader->stringsLength && length < mHeader->stringsLength - offset &&
+           mStrings[(uint64_t)offset + length] == '\0';
+  }
+
+  void validate() {
+    if (mLength < sizeof(NvjBundleHeader))
+      throw std::runtime_error("bundle : truncated header");
+
+    mHeader = reinterpret_cast<const NvjBundleHeader *>(mMap);
+    if (memcmp(mHeader->magic, NVJ_BUNDLE_MAGIC, sizeof NVJ_BUNDLE_MAGIC) != 0)
+      throw std::runtime_error("bundle : bad magic number");
+    if (mHeader->version != NVJ_BUNDLE_VERSION || mHeader->byteOrder != NVJ_BUNDLE_BYTE_ORDER)
+      throw std::runtime_error("bundle : unsupported version or byte order");
+    if (mHeader->fileLength != mLength)
+      throw std::runtime_error("bundle : truncated file");
+
+    // nbEntries and nbBuckets are 32 bits: their sizes can't wrap
+    if ((mHeader->nbEntries && !mHeader->nbBuckets) || mHeader->seedsOffset % alignof(uint32_t) ||
+        mHeader->entriesOffset % alignof(NvjBundleEntry) ||
+        !inRange(mHeader->seedsOffset, (uint64_t)mHeader->nbBuckets * sizeof(uint32_t), mLength) ||
+        !inRange(mHeader->entriesOffset, (uint64_t)mHeader->nbEntries * sizeof(NvjBundleEntry), mLength) ||
+        !inRange(mHeader->stringsOffset, mHeader->stringsLength, mLength))
+      throw std::runtime_error("bundle : corrupted index");
+
+    mSeeds   = reinterpret_cast<const uint32_t *>(mMap + mHeader->seedsOffset);
+    mEntries = reinterpret_cast<const NvjBundleEntry *>(mMap + mHeader->entriesOffset);
+    mStrings = reinterpret_cast<const char *>(mMap + mHeader->stringsOffset);
+
+    // all the entries are checked before find() reads any of them
+    for (uint32_t i = 0; i < mHeader->nbEntries; i++) {
+      const NvjBundleEntry &e = mEntries[i];
+      if (!inStrings(e.nameOffset, e.nameLength) || !inStrings(e.mimeOffset, e.mimeLength) ||
+          !inStrings(e.etagOffset, e.etagLength))
+        throw std::runtime_error("bundle : corrupted entry");
+      for (const auto &v : e.variants) {
+        if ((v.offset && !inRange(v.offset, v.length, mLength)) ||
+            !headersInStrings(v.headersOffset, v.headersLength))
+          throw std::runtime_error("bundle : corrupted entry");
+      }
+    }
+
+    for (uint32_t i = 0; i < mHeader->nbEntries; i++) {
+      if (find(getName(mEntries[i])) != &mEntries[i])
+        throw std::runtime_error("bundle : corrupted hash table");
+    }
+  }
+
+public:
+  /**
+   * map a bundle file
+   * @throw std::runtime_error if the file can't be read or is invalid
+   */
+  explicit NvjBundle(const std::string &path) : mMap(nullptr), mLength(0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("bundle : can't open " + path + ": " + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !st.st_size) {
+      close(fd);
+      throw std::runtime_error("bundle : can't read " + path);
+    }
+    mLength   = st.st_size;
+    mDevice   = st.st_dev;
+    mInode    = st.st_ino;
+    mModified = st.st_mtime;
+
+    void *map = mmap(nullptr, mLength, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive, even once replaced
+    if (map == MAP_FAILED)
+      throw std::runtime_error("bundle : can't map " + path + ": " + strerror(errno));
+    mMap = static_cast<const unsigned char *>(map);
+
+    try {
+      validate();
+    } catch (...) {
+      munmap(const_cast<unsigned char *>(mMap), mLength);
+      throw;
+    }
+  }
+
+  ~NvjBundle() { munmap(const_cast<unsigned char *>(mMap), mLength); }
+
+  NvjBundle(const NvjBundle &)            = delete;
+  NvjBundle &operator=(const NvjBundle &) = delete;
+
+  /**
+   * @return the entry of a file, nullptr if not found
+   */
+  inline const NvjBundleEntry *find(std::string_view name) const {
+    if (!mHeader->nbEntries)
+      return nullptr;
+    const NvjBundleEntry *e = &mEntries[nvj_phash_slot(name, mSeeds, mHeader->nbBuckets, mHeader->nbEntries)];
+    return getName(*e) == name ? e : nullptr;
+  }
+
+  inline std::string_view getString(uint32_t offset, uint32_t length) const {
+    return std::string_view(mStrings + offset, length);
+  }
+  inline std::string_view getName(const NvjBundleEntry &e) const { return getString(e.nameOffset, e.nameLength); }
+  inline std::string_view getMimeType(const NvjBundleEntry &e) const {
+    return getString(e.mimeOffset, e.mimeLength);
+  }
+  inline std::string_view getEtag(const NvjBundleEntry &e) const { return getString(e.etagOffset, e.etagLength); }
+
+  /**
+   * @return the content of a variant, nullptr if it doesn't exist
+   */
+  inline const unsigned char *getData(const NvjBundleVariant &v) const {
+    return v.offset ? mMap + v.offset : nullptr;
+  }
+  inline std::string_view getHeaders(const NvjBundleVariant &v) const {
+    return getString(v.headersOffset, v.headersLength);
+  }
+
+  inline size_t size() const { return mHeader->nbEntries; }
+
+  /**
+   * has the file been replaced since it was mapped ?
+   */
+  inline bool isOutdated(const struct stat &st) const {
+    return st.st_dev != mDevice || st.st_ino != mInode || st.st_mtime != mModified;
+  }
+};
+
+#endif
@@ -0,0 +1,271 @@
+//********************************************************
+/**
+ * @file  nvjContentCache.h
+ *
+ * @brief bounded cache of immutable refcounted values,
+ *        with S3-FIFO eviction
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJCONTENTCACHE_H_
+#define NVJCONTENTCACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+#include "pthread.h"
+}
+
+/**
+ * NvjContentCache - a cache of values (shared_ptr<const V>) indexed by
+ * string, bounded by the sum of their costs (their sizes in bytes).
+ *
+ * The eviction is S3-FIFO: new entries go through a small FIFO (10% of the
+ * capacity) and are only promoted to the main FIFO if they are accessed
+ * again meanwhile, so that one-hit wonders don't evict the hot entries.
+ * The main FIFO gives a second chance to the entries accessed since their
+ * last pass. The keys evicted from the small FIFO are remembered (ghost
+ * FIFO) and go directly to the main FIFO if they come back.
+ *
+ * A hit only takes the lock in shared mode and bumps an atomic counter:
+ * the entries are never moved on access.
+ */
+template <class V> class NvjContentCache {
+public:
+  typedef std::shared_ptr<const V> ValuePtr;
+
+private:
+  struct Node {
+    std::string          key;
+    ValuePtr             value;
+    size_t               cost;
+    std::atomic<uint8_t> freq;
+    bool                 inMain;
+
+    Node(const std::string &k, ValuePtr v, size_t c, bool m)
+        : key(k), value(std::move(v)), cost(c), freq(0), inMain(m) {}
+  };
+  typedef std::list<Node>                                              NodeList;
+  typedef std::unordered_map<std::string, typename NodeList::iterator> NodeMap;
+
+  static const uint8_t MAX_FREQ = 3;
+
+  NodeList                        small, main; // FIFO: inserted at front, evicted from back
+  NodeMap                         nodes;
+  std::list<size_t>               ghost; // hashes of the keys evicted from small
+  std::unordered_map<size_t, int> ghostCount;
+  size_t                          capacity, smallCost, mainCost;
+  std::atomic<uint64_t>           generation;
+  mutable std::atomic<uint64_t>   hits, misses;
+  mutable pthread_rwlock_t        lock;
+
+  inline size_t hash(const std::string &key) const { return std::hash<std::string>()(key); }
+
+  void addGhost(const std::string &key) {
+    size_t h = hash(key);
+    ghost.push_front(h);
+    ghostCount[h]++;
+    while (ghost.size() > nodes.size() + 1) {
+      auto it = ghostCount.find(ghost.back());
+      if (it != ghostCount.end() && --it->second == 0) {
+        ghostCount.erase(it);
+      }
+      ghost.pop_back();
+    }
+  }
+
+  bool takeGhost(const std::string &key) {
+    auto it = ghostCount.find(hash(key));
+    if (it == ghostCount.end()) {
+      return false;
+    }
+    // the hash stays in the FIFO, it will just be ignored when it expires
+    if (--it->second == 0) {
+      ghostCount.erase(it);
+    }
+    return true;
+  }
+
+  void remove(typename NodeList::iterator it) {
+    (it->inMain ? mainCost : smallCost) -= it->cost;
+    nodes.erase(it->key);
+    (it->inMain ? main : small).erase(it);
+  }
+
+  void evictSmall() {
+    while (!small.empty()) {
+      auto it = std::prev(small.end());
+      if (it->freq.load(std::memory_order_relaxed) > 0) {
+        // accessed again: promoted
+        it->freq.store(0, std::memory_order_relaxed);
+        it->inMain  = true;
+        smallCost  -= it->cost;
+        mainCost   += it->cost;
+        main.splice(main.begin(), small, it);
+      } else {
+        addGhost(it->key);
+        remove(it);
+        return;
+      }
+    }
+  }
+
+  void evictMain() {
+    while (!main.empty()) {
+      auto    it   = std::prev(main.end());
+      uint8_t freq = it->freq.load(std::memory_order_relaxed);
+      if (freq > 0) {
+        // second chance
+        it->freq.store(freq - 1, std::memory_order_relaxed);
+        main.splice(main.begin(), main, it);
+      } else {
+        remove(it);
+        return;
+      }
+    }
+  }
+
+  void evict() {
+    while (smallCost + mainCost > capacity) {
+      if (smallCost > capacity / 10 || main.empty()) {
+        evictSmall();
+      } else {
+        evictMain();
+      }
+    }
+  }
+
+public:
+  /**
+   * @param maxCost: the capacity of the cache (sum of the costs of the entries)
+   */
+  explicit NvjContentCache(size_t maxCost)
+      : capacity(maxCost), smallCost(0), mainCost(0), generation(0), hits(0), misses(0) {
+    pthread_rwlock_init(&lock, nullptr);
+  }
+
+  ~NvjContentCache() { pthread_rwlock_destroy(&lock); }
+
+  NvjContentCache(const NvjContentCache &)            = delete;
+  NvjContentCache &operator=(const NvjContentCache &) = delete;
+
+  /**
+   * @return the value of a key, nullptr if not cached
+   */
+  ValuePtr get(const std::string &key) const {
+    pthread_rwlock_rdlock(&lock);
+    ValuePtr res;
+    auto     it = nodes.find(key);
+    if (it != nodes.end()) {
+      Node   &node = *it->second;
+      uint8_t freq = node.freq.load(std::memory_order_relaxed);
+      if (freq < MAX_FREQ) {
+        node.freq.store(freq + 1, std::memory_order_relaxed); // approximate under contention
+      }
+      res = node.value;
+    }
+    pthread_rwlock_unlock(&lock);
+    (res != nullptr ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+    return res;
+  }
+
+  /**
+   * Current generation, to be read before loading a value:
+   * put() ignores the values loaded before an invalidation
+   */
+  inline uint64_t getGeneration() const { return generation.load(std::memory_order_acquire); }
+
+  /**
+   * Insert or replace a value
+   * @param cost: its cost, the value is not cached if it exceeds the capacity
+   * @param loadGeneration: the generation read before loading the value
+   * @return true if the value has been cached
+   */
+  bool put(const std::string &key, ValuePtr value, size_t cost, uint64_t loadGeneration) {
+    pthread_rwlock_wrlock(&lock);
+    bool res = cost <= capacity && loadGeneration == generation.load(std::memory_order_relaxed);
+    if (res) {
+      auto it = nodes.find(key);
+      if (it != nodes.end()) {
+        remove(it->second);
+      }
+      bool      inMain = takeGhost(key);
+      NodeList &queue  = inMain ? main : small;
+      queue.emplace_front(key, std::move(value), cost, inMain);
+      nodes[key]                        = queue.begin();
+      (inMain ? mainCost : smallCost)  += cost;
+      evict();
+    }
+    pthread_rwlock_unlock(&lock);
+    return res;
+  }
+
+  /**
+   * Invalidate a key
+   */
+  void erase(const std::string &key) {
+    pthread_rwlock_wrlock(&lock);
+    generation.fetch_add(1, std::memory_order_release);
+    auto it = nodes.find(key);
+    if (it != nodes.end()) {
+      remove(it->second);
+    }
+    pthread_rwlock_unlock(&lock);
+  }
+
+  /**
+   * Invalidate all the keys
+   */
+  void clear() {
+    pthread_rwlock_wrlock(&lock);
+    generation.fetch_add(1, std::memory_order_release);
+    nodes.clear();
+    small.clear();
+    main.clear();
+    ghost.clear();
+    ghostCount.clear();
+    smallCost = mainCost = 0;
+    pthread_rwlock_unlock(&lock);
+  }
+
+  /**
+   * Change the capacity, evicting entries if needed
+   */
+  void setCapacity(size_t maxCost) {
+    pthread_rwlock_wrlock(&lock);
+    capacity = maxCost;
+    evict();
+    pthread_rwlock_unlock(&lock);
+  }
+
+  inline size_t getCapacity() const { return capacity; }
+
+  inline size_t size() const {
+    pthread_rwlock_rdlock(&lock);
+    size_t res = nodes.size();
+    pthread_rwlock_unlock(&lock);
+    return res;
+  }
+
+  inline size_t getCost() const {
+    pthread_rwlock_rdlock(&lock);
+    size_t res = smallCost + mainCost;
+    pthread_rwlock_unlock(&lock);
+    return res;
+  }
+
+  inline uint64_t getHits() const { return hits.load(std::memory_order_relaxed); }
+  inline uint64_t getMisses() const { return misses.load(std::memory_order_relaxed); }
+};
+
+#endif
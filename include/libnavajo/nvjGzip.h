@@ -14,137 +14,409 @@
 #ifndef NVJGZIP_H_
 #define NVJGZIP_H_
 
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "zlib.h"
 #if (ZLIB_VERNUM < 0x1271)
 #include "zlibPatchOldVersion.h"
 #endif
 
+#include "libnavajo/nvjThreadPool.h"
+
 #define CHUNK 16384
 
+#define NVJ_GZIP_PARALLEL_BLOCK_SIZE (128 * 1024)
+#define NVJ_GZIP_WINDOW_SIZE         32768
+
 //********************************************************
+/**
+ * Per-thread cache of zlib streams.
+ * deflateInit2/inflateInit2 allocate ~256KB of state: the streams are
+ * created once per thread (gzip and raw deflate flavours) and recycled
+ * with deflateReset/inflateReset for every buffer.
+ */
+class NvjZStreamCache {
+  z_stream mDeflate[2];
+  bool     mDeflateReady[2];
+  int      mDeflateLevel[2];
+  z_stream mInflate[2];
+  bool     mInflateReady[2];
+
+  NvjZStreamCache() {
+    for (int i = 0; i < 2; i++) {
+      mDeflateReady[i] = false;
+      mDeflateLevel[i] = Z_DEFAULT_COMPRESSION;
+      mInflateReady[i] = false;
+    }
+  }
 
-inline size_t nvj_gzip(unsigned char **dst, const unsigned char *src, const size_t sizeSrc,
-                       bool rawDeflateData = false) {
-  z_stream strm;
-  size_t   sizeDst = CHUNK;
+public:
+  NvjZStreamCache(const NvjZStreamCache &)            = delete;
+  NvjZStreamCache &operator=(const NvjZStreamCache &) = delete;
 
-  /* allocate deflate state */
-  strm.zalloc = Z_NULL;
-  strm.zfree  = Z_NULL;
-  strm.opaque = Z_NULL;
+  ~NvjZStreamCache() {
+    for (int i = 0; i < 2; i++) {
+      if (mDeflateReady[i])
+        (void)deflateEnd(&mDeflate[i]);
+      if (mInflateReady[i])
+        (void)inflateEnd(&mInflate[i]);
+    }
+  }
 
-  if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, rawDeflateData ? -15 : 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) !=
-      Z_OK)
-    throw std::runtime_error(std::string("gzip : inflateInit2 error"));
+  /**
+   * @return the cache of the calling thread
+   */
+  inline static NvjZStreamCache &local() {
+    static thread_local NvjZStreamCache cache;
+    return cache;
+  }
 
-  if ((*dst = (unsigned char *)malloc(CHUNK * sizeof(unsigned char))) == NULL)
-    throw std::runtime_error(std::string("gzip : malloc error (1)"));
+  /**
+   * get a reset deflate stream
+   * @param rawDeflateData: raw deflate stream instead of gzip
+   * @param level: the compression level
+   */
+  z_stream *getDeflate(bool rawDeflateData, int level) {
+    const int i    = rawDeflateData ? 1 : 0;
+    z_stream *strm = &mDeflate[i];
+
+    if (!mDeflateReady[i]) {
+      strm->zalloc = Z_NULL;
+      strm->zfree  = Z_NULL;
+      strm->opaque = Z_NULL;
+      if (deflateInit2(strm, level, Z_DEFLATED, rawDeflateData ? -15 : 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error(std::string("gzip : deflateInit2 error"));
+      mDeflateReady[i] = true;
+      mDeflateLevel[i] = level;
+      return strm;
+    }
 
-  strm.avail_in = sizeSrc;
-  strm.next_in  = (Bytef *)src;
+    if (deflateReset(strm) != Z_OK)
+      throw std::runtime_error(std::string("gzip : deflateReset error"));
 
-  int i = 0;
+    if (mDeflateLevel[i] != level) {
+      if (deflateParams(strm, level, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error(std::string("gzip : deflateParams error"));
+      mDeflateLevel[i] = level;
+    }
+    return strm;
+  }
 
-  do {
-    strm.avail_out = CHUNK;
-    strm.next_out  = (Bytef *)*dst + i * CHUNK;
-    sizeDst        = CHUNK * (i + 1);
+  /**
+   * get a reset inflate stream
+   * @param rawDeflateData: raw deflate stream instead of gzip
+   */
+  z_stream *getInflate(bool rawDeflateData) {
+    const int i    = rawDeflateData ? 1 : 0;
+    z_stream *strm = &mInflate[i];
+
+    if (!mInflateReady[i]) {
+      strm->zalloc   = Z_NULL;
+      strm->zfree    = Z_NULL;
+      strm->opaque   = Z_NULL;
+      strm->avail_in = 0;
+      strm->next_in  = Z_NULL;
+      if (inflateInit2(strm, rawDeflateData ? -15 : 16 + MAX_WBITS) != Z_OK)
+        throw std::runtime_error(std::string("gunzip : inflateInit2 error"));
+      mInflateReady[i] = true;
+      return strm;
+    }
 
-    if (deflate(&strm, Z_FINISH) == Z_STREAM_ERROR) /* state not clobbered */
-    {
-      free(*dst);
+    if (inflateReset(strm) != Z_OK)
+      throw std::runtime_error(std::string("gunzip : inflateReset error"));
+    return strm;
+  }
+};
+
+//********************************************************
+
+/**
+ * run deflate on a whole buffer
+ * @param strm: an initialized deflate stream
+ * @param dst: the output buffer
+ * @param dstCapacity: the output buffer size
+ * @param flush: Z_FINISH to close the stream, Z_SYNC_FLUSH to stop on a byte boundary
+ * @return the number of bytes written, 0 if dst is too small
+ */
+inline size_t nvj_deflate_buffer(z_stream *strm, unsigned char *dst, const size_t dstCapacity,
+                                 const unsigned char *src, const size_t sizeSrc, const int flush = Z_FINISH) {
+  const size_t maxAvail = (uInt)-1;
+  size_t       leftIn = sizeSrc, leftOut = dstCapacity;
+
+  strm->next_in  = (Bytef *)src;
+  strm->next_out = (Bytef *)dst;
+
+  for (;;) {
+    strm->avail_in  = leftIn > maxAvail ? maxAvail : leftIn;
+    strm->avail_out = leftOut > maxAvail ? maxAvail : leftOut;
+    leftIn -= strm->avail_in;
+    leftOut -= strm->avail_out;
+
+    int ret = deflate(strm, leftIn ? Z_NO_FLUSH : flush);
+    if (ret == Z_STREAM_ERROR)
       throw std::runtime_error(std::string("gzip : deflate error"));
-    }
 
-    i++;
+    leftIn += strm->avail_in;
+    leftOut += strm->avail_out;
 
-    if (strm.avail_out == 0) {
-      unsigned char *reallocDst = (unsigned char *)realloc(*dst, CHUNK * (i + 1) * sizeof(unsigned char));
+    if (ret == Z_STREAM_END || (flush != Z_FINISH && !leftIn && strm->avail_out))
+      return dstCapacity - leftOut;
 
-      if (reallocDst != nullptr) {
-        *dst = reallocDst;
-      } else {
-        free(reallocDst);
-        free(*dst);
-        throw std::runtime_error(std::string("gzip : (re)allocating memory"));
-      }
-    }
-  } while (strm.avail_out == 0);
+    if (!leftOut)
+      return 0;
+  }
+}
 
-  /* clean up and return */
-  (void)deflateEnd(&strm);
-  return sizeDst - strm.avail_out;
+//********************************************************
+
+/**
+ * upper bound of the compressed size
+ * @return the size of a buffer large enough for nvj_gzip_into
+ */
+inline size_t nvj_gzip_bound(const size_t sizeSrc, bool rawDeflateData = false, int level = Z_BEST_SPEED) {
+  return deflateBound(NvjZStreamCache::local().getDeflate(rawDeflateData, level), sizeSrc);
+}
+
+//********************************************************
+
+/**
+ * compress into a caller-provided buffer
+ * @param dst: the output buffer (see nvj_gzip_bound)
+ * @param dstCapacity: the output buffer size
+ * @return the compressed size, 0 if dst is too small
+ */
+inline size_t nvj_gzip_into(unsigned char *dst, const size_t dstCapacity, const unsigned char *src,
+                            const size_t sizeSrc, bool rawDeflateData = false, int level = Z_BEST_SPEED) {
+  z_stream *strm = NvjZStreamCache::local().getDeflate(rawDeflateData, level);
+  return nvj_deflate_buffer(strm, dst, dstCapacity, src, sizeSrc);
+}
+
+//********************************************************
+
+inline size_t nvj_gzip(unsigned char **dst, const unsigned char *src, const size_t sizeSrc,
+                       bool rawDeflateData = false, int level = Z_BEST_SPEED) {
+  z_stream *strm    = NvjZStreamCache::local().getDeflate(rawDeflateData, level);
+  size_t    sizeDst = deflateBound(strm, sizeSrc);
+
+  if ((*dst = (unsigned char *)malloc(sizeDst * sizeof(unsigned char))) == NULL)
+    throw std::runtime_error(std::string("gzip : malloc error (1)"));
+
+  try {
+    sizeDst = nvj_deflate_buffer(strm, *dst, sizeDst, src, sizeSrc);
+  } catch (...) {
+    free(*dst);
+    throw;
+  }
+
+  if (!sizeDst) {
+    free(*dst);
+    throw std::runtime_error(std::string("gzip : deflateBound exceeded"));
+  }
+
+  return sizeDst;
 }
 
 //********************************************************
 
 inline size_t nvj_gunzip(unsigned char **dst, const unsigned char *src, const size_t sizeSrc,
                          bool rawDeflateData = false) {
-  z_stream strm;
-  size_t   sizeDst = CHUNK;
-  int      ret;
+  size_t sizeDst = 0, capacity;
+  int    ret;
 
   if (src == NULL)
     throw std::runtime_error(std::string("gunzip : src == NULL !"));
 
-  /* allocate inflate state */
-  strm.zalloc   = Z_NULL;
-  strm.zfree    = Z_NULL;
-  strm.opaque   = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in  = Z_NULL;
+  z_stream *strm = NvjZStreamCache::local().getInflate(rawDeflateData);
 
-  if (inflateInit2(&strm, rawDeflateData ? -15 : 16 + MAX_WBITS) != Z_OK)
-    throw std::runtime_error(std::string("gunzip : inflateInit2 error"));
+  // the gzip trailer holds the uncompressed size (mod 2^32): only a hint,
+  // bounded by the maximum expansion of deflate, the buffer grows if needed
+  if (!rawDeflateData && sizeSrc >= 18) {
+    const unsigned char *isize = src + sizeSrc - 4;
+    capacity = (size_t)isize[0] | (size_t)isize[1] << 8 | (size_t)isize[2] << 16 | (size_t)isize[3] << 24;
+    if (capacity > sizeSrc * 1032)
+      capacity = sizeSrc * 1032;
+  } else {
+    capacity = sizeSrc * 4;
+  }
+  if (capacity < CHUNK)
+    capacity = CHUNK;
 
-  if ((*dst = (unsigned char *)malloc(CHUNK * sizeof(unsigned char))) == NULL)
+  if ((*dst = (unsigned char *)malloc(capacity * sizeof(unsigned char))) == NULL)
     throw std::runtime_error(std::string("gunzip : malloc error (2)"));
 
-  strm.avail_in = sizeSrc;
-  strm.next_in  = (Bytef *)src;
-
-  int i = 0;
+  const size_t maxAvail = (uInt)-1;
+  size_t       leftIn   = sizeSrc;
+  strm->next_in         = (Bytef *)src;
 
   do {
-    strm.avail_out = CHUNK;
-    strm.next_out  = (Bytef *)*dst + i * CHUNK;
-    sizeDst        = CHUNK * (i + 1);
+    if (sizeDst == capacity) {
+      unsigned char *reallocDst = (unsigned char *)realloc(*dst, capacity * 2 * sizeof(unsigned char));
+      if (reallocDst == nullptr) {
+        free(*dst);
+        throw std::runtime_error(std::string("gunzip : (re)allocating memory"));
+      }
+      *dst = reallocDst;
+      capacity *= 2;
+    }
 
-    ret = inflate(&strm, Z_NO_FLUSH);
+    strm->avail_in  = leftIn > maxAvail ? maxAvail : leftIn;
+    strm->avail_out = capacity - sizeDst > maxAvail ? maxAvail : capacity - sizeDst;
+    strm->next_out  = (Bytef *)*dst + sizeDst;
+    leftIn -= strm->avail_in;
+    const uInt availOut = strm->avail_out;
+
+    ret = inflate(strm, Z_NO_FLUSH);
 
     switch (ret) {
     case Z_STREAM_ERROR:
-      free(*dst);
-      throw std::runtime_error(std::string("gunzip : inflate Z_STREAM_ERROR"));
     case Z_NEED_DICT:
     case Z_DATA_ERROR:
     case Z_MEM_ERROR:
-      (void)inflateEnd(&strm);
       free(*dst);
       throw std::runtime_error(std::string("gunzip : inflate error"));
     }
 
-    i++;
-    if (strm.avail_out == 0) {
-      unsigned char *reallocDst = (unsigned char *)realloc(*dst, CHUNK * (i + 1) * sizeof(unsigned char));
+    leftIn += strm->avail_in;
+    sizeDst += availOut - strm->avail_out;
+  } while (ret != Z_STREAM_END && (strm->avail_out == 0 || leftIn));
 
-      if (reallocDst != nullptr) {
-        *dst = reallocDst;
-      } else {
-        free(reallocDst);
-        free(*dst);
-        throw std::runtime_error(std::string("gunzip : (re)allocating memory"));
+  if (ret != Z_STREAM_END) {
+    free(*dst);
+    throw std::runtime_error(std::string("gunzip : truncated stream"));
+  }
+
+  return sizeDst;
+}
+
+//********************************************************
+
+/**
+ * compress a large buffer on several threads (pigz-like)
+ * The input is split in blocks compressed as raw deflate streams, each one
+ * primed with the 32KB preceding it, then concatenated in one gzip member.
+ * The calling thread takes part in the work.
+ * @param blockSize: the size of the input blocks
+ * @param pool: the executor running the helper tasks
+ * @return the compressed size (*dst must be freed)
+ */
+inline size_t nvj_gzip_parallel(unsigned char **dst, const unsigned char *src, const size_t sizeSrc,
+                                int level = Z_BEST_SPEED, size_t blockSize = NVJ_GZIP_PARALLEL_BLOCK_SIZE,
+                                NvjThreadPool &pool = NvjThreadPool::shared()) {
+  if (blockSize < NVJ_GZIP_WINDOW_SIZE)
+    blockSize = NVJ_GZIP_WINDOW_SIZE;
+
+  const size_t nbBlocks = (sizeSrc + blockSize - 1) / blockSize;
+  if (nbBlocks <= 1 || pool.size() < 2)
+    return nvj_gzip(dst, src, sizeSrc, false, level);
+
+  struct Block {
+    unsigned char *data   = nullptr;
+    size_t         length = 0;
+    uLong          crc    = 0;
+  };
+
+  struct Job {
+    const unsigned char *src;
+    size_t               sizeSrc, blockSize, nbBlocks;
+    int                  level;
+    std::vector<Block>   blocks;
+    std::atomic<size_t>  next{0};
+    std::atomic<bool>    failed{false};
+    NvjWaitGroup         completed;
+
+    Job(const unsigned char *s, size_t ss, size_t bs, size_t nb, int l)
+        : src(s), sizeSrc(ss), blockSize(bs), nbBlocks(nb), level(l), blocks(nb), completed(nb) {}
+
+    ~Job() {
+      for (auto &block : blocks)
+        free(block.data);
+    }
+
+    void compressBlock(size_t i) {
+      const size_t start = i * blockSize;
+      const size_t len   = (i == nbBlocks - 1) ? sizeSrc - start : blockSize;
+      Block       &block = blocks[i];
+
+      block.crc = crc32(0L, src + start, len);
+
+      z_stream *strm = NvjZStreamCache::local().getDeflate(true, level);
+      if (start) {
+        const size_t dictLen = start < NVJ_GZIP_WINDOW_SIZE ? start : NVJ_GZIP_WINDOW_SIZE;
+        if (deflateSetDictionary(strm, src + start - dictLen, dictLen) != Z_OK)
+          throw std::runtime_error(std::string("gzip : deflateSetDictionary error"));
+      }
+
+      // the sync flush marker is not part of deflateBound
+      size_t capacity = deflateBound(strm, len) + 16;
+      if ((block.data = (unsigned char *)malloc(capacity)) == nullptr)
+        throw std::runtime_error(std::string("gzip : malloc error (3)"));
+
+      block.length = nvj_deflate_buffer(strm, block.data, capacity, src + start, len,
+                                        (i == nbBlocks - 1) ? Z_FINISH : Z_SYNC_FLUSH);
+      if (!block.length)
+        throw std::runtime_error(std::string("gzip : deflateBound exceeded"));
+    }
+
+    void run() {
+      size_t i;
+      while ((i = next++) < nbBlocks) {
+        if (!failed) {
+          try {
+            compressBlock(i);
+          } catch (...) {
+            failed = true;
+          }
+        }
+        completed.done();
       }
     }
-  } while (strm.avail_out == 0);
+  };
 
-  /* clean up and return */
-  (void)inflateEnd(&strm);
-  return sizeDst - strm.avail_out;
+  auto job = std::make_shared<Job>(src, sizeSrc, blockSize, nbBlocks, level);
+
+  size_t nbHelpers = nbBlocks - 1 < pool.size() ? nbBlocks - 1 : pool.size();
+  for (size_t i = 0; i < nbHelpers; i++)
+    pool.push([job]() { job->run(); });
+
+  job->run();
+  job->completed.wait();
+
+  if (job->failed)
+    throw std::runtime_error(std::string("gzip : parallel deflate error"));
+
+  static const unsigned char gzipHeader[10] = {0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3};
+  size_t                     sizeDst        = sizeof gzipHeader + 8;
+  for (auto &block : job->blocks)
+    sizeDst += block.length;
+
+  if ((*dst = (unsigned char *)malloc(sizeDst * sizeof(unsigned char))) == NULL)
+    throw std::runtime_error(std::string("gzip : malloc error (1)"));
+
+  unsigned char *out = *dst;
+  memcpy(out, gzipHeader, sizeof gzipHeader);
+  out += sizeof gzipHeader;
+
+  uLong crc = crc32(0L, Z_NULL, 0);
+  for (size_t i = 0; i < nbBlocks; i++) {
+    const Block &block = job->blocks[i];
+    memcpy(out, block.data, block.length);
+    out += block.length;
+    crc = crc32_combine(crc, block.crc, (i == nbBlocks - 1) ? sizeSrc - i * blockSize : blockSize);
+  }
+
+  const uLong isize = (uLong)(sizeSrc & 0xffffffffUL);
+  for (int i = 0; i < 4; i++)
+    *out++ = (unsigned char)(crc >> (8 * i));
+  for (int i = 0; i < 4; i++)
+    *out++ = (unsigned char)(isize >> (8 * i));
+
+  return sizeDst;
 }
 
 //----------------------------------------------------------------------------------------
@@ -225,6 +497,21 @@ inline void nvj_init_stream(z_stream *pstream = nullptr, bool rawDeflateData = f
     throw std::runtime_error(std::string("gzip : deflateInit2 error"));
 }
 
+//********************************************************
+/**
+ * change the level of a stream between two flushed messages
+ */
+inline void nvj_stream_set_level(z_stream *pstream, int level, int strategy = Z_DEFAULT_STRATEGY) {
+  unsigned char unused[16];
+
+  (*pstream).next_in   = nullptr;
+  (*pstream).avail_in  = 0;
+  (*pstream).next_out  = unused;
+  (*pstream).avail_out = sizeof unused;
+  if (deflateParams(pstream, level, strategy) != Z_OK)
+    throw std::runtime_error(std::string("gzip : deflateParams error"));
+}
+
 //********************************************************
 
 inline size_t nvj_gunzip_websocket_v2(unsigned char **dst, const unsigned char *src, size_t sizeSrc,
@@ -0,0 +1,183 @@
+//********************************************************
+/**
+ * @file  nvjMimeType.h
+ *
+ * @brief mime types of the files, from their extension
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJMIMETYPE_H_
+#define NVJMIMETYPE_H_
+
+#include <cstring>
+
+//********************************************************
+/**
+ * nvj_mime_type: return valid mime_type using filename's extension
+ * @param name - filename
+ * \return mime_type or NULL is no found
+ */
+inline const char *nvj_mime_type(const char *name) {
+  char *ext = strrchr(const_cast<char *>(name), '.');
+  if (!ext) {
+    return nullptr;
+  }
+
+  char     extLowerCase[7];
+  unsigned i = 0;
+  for (; i < 6 && i < strlen(ext); i++) {
+    extLowerCase[i] = ext[i];
+    if ((extLowerCase[i] >= 'A') && (extLowerCase[i] <= 'Z')) {
+      extLowerCase[i] += 'a' - 'A';
+    }
+  }
+  extLowerCase[i] = '\0';
+
+  if (strcmp(extLowerCase, ".html") == 0 || strcmp(extLowerCase, ".htm") == 0) {
+    return "text/html";
+  }
+  if (strcmp(extLowerCase, ".js") == 0) {
+    return "application/javascript";
+  }
+  if (strcmp(extLowerCase, ".json") == 0) {
+    return "application/json";
+  }
+  if (strcmp(extLowerCase, ".xml") == 0) {
+    return "application/xml";
+  }
+  if (strcmp(extLowerCase, ".jpg") == 0 || strcmp(extLowerCase, ".jpeg") == 0) {
+    return "image/jpeg";
+  }
+  if (strcmp(extLowerCase, ".gif") == 0) {
+    return "image/gif";
+  }
+  if (strcmp(extLowerCase, ".png") == 0) {
+    return "image/png";
+  }
+  if (strcmp(extLowerCase, ".css") == 0) {
+    return "text/css";
+  }
+  if (strcmp(extLowerCase, ".txt") == 0) {
+    return "text/plain";
+  }
+  if (strcmp(extLowerCase, ".svg") == 0 || strcmp(extLowerCase, ".svgz") == 0) {
+    return "image/svg+xml";
+  }
+  if (strcmp(extLowerCase, ".cache") == 0) {
+    return "text/cache-manifest";
+  }
+
+  // ----------------------------------------------------------------------
+  // Fontes
+  // ----------------------------------------------------------------------
+  if (strcmp(extLowerCase, ".otf") == 0) {
+    return "font/otf";
+  }
+  if (strcmp(extLowerCase, ".eot") == 0) {
+    return "font/eot";
+  }
+  if (strcmp(extLowerCase, ".ttf") == 0) {
+    return "font/ttf";
+  }
+  if (strcmp(extLowerCase, ".woff") == 0) {
+    return "font/woff";
+  }
+  if (strcmp(extLowerCase, ".woff2") == 0) {
+    return "font/woff2";
+  }
+
+  if (strcmp(extLowerCase, ".au") == 0) {
+    return "audio/basic";
+  }
+  if (strcmp(extLowerCase, ".wav") == 0) {
+    return "audio/wav";
+  }
+  if (strcmp(extLowerCase, ".avi") == 0) {
+    return "video/x-msvideo";
+  }
+  if (strcmp(extLowerCase, ".mpeg") == 0 || strcmp(extLowerCase, ".mpg") == 0) {
+    return "video/mpeg";
+  }
+  if (strcmp(extLowerCase, ".mp3") == 0) {
+    return "audio/mpeg";
+  }
+  if (strcmp(extLowerCase, ".csv") == 0) {
+    return "text/csv";
+  }
+  if (strcmp(extLowerCase, ".mp4") == 0) {
+    return "application/mp4";
+  }
+  if (strcmp(extLowerCase, ".bin") == 0) {
+    return "application/octet-stream";
+  }
+  if (strcmp(extLowerCase, ".doc") == 0 || strcmp(extLowerCase, ".docx") == 0) {
+    return "application/msword";
+  }
+  if (strcmp(extLowerCase, ".pdf") == 0) {
+    return "application/pdf";
+  }
+  if (strcmp(extLowerCase, ".ps") == 0 || strcmp(extLowerCase, ".eps") == 0 || strcmp(extLowerCase, ".ai") == 0) {
+    return "application/postscript";
+  }
+  if (strcmp(extLowerCase, ".tar") == 0) {
+    return "application/x-tar";
+  }
+  if (strcmp(extLowerCase, ".h264") == 0) {
+    return "video/h264";
+  }
+  if (strcmp(extLowerCase, ".dv") == 0) {
+    return "video/dv";
+  }
+  if (strcmp(extLowerCase, ".qt") == 0 || strcmp(extLowerCase, ".mov") == 0) {
+    return "video/quicktime";
+  }
+
+  return nullptr;
+}
+
+//********************************************************
+/**
+ * nvj_is_compressible_mime_type: text formats are compressible, as well
+ *   as the structured application types. Images, audio, video and
+ *   archives are already compressed.
+ */
+inline bool nvj_is_compressible_mime_type(const char *mimetype) {
+  static const char *const compressedAppTypes[] = {
+      "octet-stream", "zip", "gzip", "x-gzip", "x-bzip2", "x-xz", "zstd", "x-7z-compressed", "x-rar-compressed",
+      "pdf",          "font-woff", nullptr};
+  static const char *const compressibleTypes[] = {"image/svg+xml", "image/x-icon", "image/bmp", "font/eot",
+                                                  "font/otf",      "font/ttf",     nullptr};
+
+  size_t len = strcspn(mimetype, "; ");
+
+  if (len >= 5 && !strncmp(mimetype, "text/", 5)) {
+    return true;
+  }
+
+  if ((len >= 5 && !strncmp(mimetype + len - 5, "+json", 5)) ||
+      (len >= 4 && !strncmp(mimetype + len - 4, "+xml", 4))) {
+    return true;
+  }
+
+  if (len >= 12 && !strncmp(mimetype, "application/", 12)) {
+    for (const char *const *t = compressedAppTypes; *t != nullptr; t++) {
+      if (len - 12 == strlen(*t) && !strncmp(mimetype + 12, *t, len - 12)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  for (const char *const *t = compressibleTypes; *t != nullptr; t++) {
+    if (len == strlen(*t) && !strncmp(mimetype, *t, len)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+#endif
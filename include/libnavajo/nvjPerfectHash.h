@@ -0,0 +1,53 @@
+//********************************************************
+/**
+ * @file  nvjPerfectHash.h
+ *
+ * @brief constexpr hash-and-displace perfect hashing,
+ *        shared by the generators and the lookups
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJPERFECTHASH_H_
+#define NVJPERFECTHASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+//********************************************************
+/**
+ * seeded FNV-1a hash, followed by a murmur3 finalizer so that
+ * two seeds give independent distributions
+ */
+constexpr uint32_t nvj_phash(std::string_view s, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  for (char c : s) {
+    h = (h ^ (unsigned char)c) * 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+//********************************************************
+/**
+ * slot of a key in a minimal perfect hash table
+ * The key is first hashed into a bucket, the seed of the bucket
+ * (chosen at generation time) then gives its slot.
+ * @param seeds: the seeds of the buckets
+ * @param nbBuckets: the number of buckets
+ * @param nbSlots: the number of keys
+ * @return the slot, to be checked against the stored key
+ */
+constexpr size_t nvj_phash_slot(std::string_view key, const uint32_t *seeds, const size_t nbBuckets,
+                                const size_t nbSlots) {
+  return nvj_phash(key, seeds[nvj_phash(key, 0) % nbBuckets]) % nbSlots;
+}
+
+#endif
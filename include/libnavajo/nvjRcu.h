@@ -0,0 +1,165 @@
+//********************************************************
+/**
+ * @file  nvjRcu.h
+ *
+ * @brief read-copy-update pointer: lock-free readers,
+ *        writers publishing new immutable snapshots
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJRCU_H_
+#define NVJRCU_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <sched.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "libnavajo/nvjThread.h"
+
+#define NVJ_RCU_STRIPES 16
+
+//********************************************************
+
+/**
+ * NvjRcuPtr - holds the current snapshot of a read-mostly object.
+ *
+ * Readers take a ReadGuard, which only increments a striped counter of
+ * the current epoch, and read the snapshot without any lock.
+ * Writers are serialized: they publish a new snapshot with an atomic
+ * exchange, switch the epoch, wait for the readers of the previous
+ * epoch to leave, then delete the old snapshot.
+ *
+ * A thread holding a ReadGuard must not update the same NvjRcuPtr.
+ */
+template <class T> class NvjRcuPtr {
+  struct alignas(64) Counter {
+    std::atomic<long> value{0};
+  };
+
+  std::atomic<T *>        mCurrent;
+  std::atomic<unsigned>   mEpoch;
+  mutable Counter         mReaders[2][NVJ_RCU_STRIPES];
+  mutable pthread_mutex_t mWriteMutex;
+
+  static inline unsigned stripe() {
+    static thread_local unsigned s = std::hash<std::thread::id>()(std::this_thread::get_id()) % NVJ_RCU_STRIPES;
+    return s;
+  }
+
+  /**
+   * publish a new snapshot and reclaim the previous one
+   * (called with mWriteMutex held)
+   */
+  void publish(T *snapshot) {
+    T       *old   = mCurrent.exchange(snapshot, std::memory_order_seq_cst);
+    unsigned epoch = mEpoch.load(std::memory_order_relaxed);
+    mEpoch.store(epoch + 1, std::memory_order_seq_cst);
+
+    // seq_cst against read(): a reader either sees the new epoch, or its
+    // increment is seen here (an acquire load could still read 0)
+    Counter *readers = mReaders[epoch & 1];
+    for (unsigned i = 0; i < NVJ_RCU_STRIPES; i++) {
+      while (readers[i].value.load(std::memory_order_seq_cst) != 0) {
+        sched_yield();
+      }
+    }
+    delete old;
+  }
+
+public:
+  class ReadGuard {
+    const T           *mPtr;
+    std::atomic<long> *mCounter;
+
+    friend class NvjRcuPtr;
+    ReadGuard(const T *p, std::atomic<long> *c) : mPtr(p), mCounter(c) {}
+
+  public:
+    ReadGuard(ReadGuard &&o) noexcept : mPtr(o.mPtr), mCounter(o.mCounter) { o.mCounter = nullptr; }
+    ReadGuard(const ReadGuard &)            = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+    ReadGuard &operator=(ReadGuard &&)      = delete;
+
+    ~ReadGuard() {
+      if (mCounter != nullptr) {
+        mCounter->fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    inline const T *get() const { return mPtr; }
+    inline const T *operator->() const { return mPtr; }
+    inline const T &operator*() const { return *mPtr; }
+  };
+
+  /**
+   * @param initial: the first snapshot, owned by the NvjRcuPtr
+   */
+  explicit NvjRcuPtr(T *initial = new T()) : mCurrent(initial), mEpoch(0) {
+    pthread_mutex_init(&mWriteMutex, nullptr);
+  }
+
+  ~NvjRcuPtr() {
+    delete mCurrent.load();
+    pthread_mutex_destroy(&mWriteMutex);
+  }
+
+  NvjRcuPtr(const NvjRcuPtr &)            = delete;
+  NvjRcuPtr &operator=(const NvjRcuPtr &) = delete;
+
+  /**
+   * @return a guard giving access to the current snapshot
+   */
+  ReadGuard read() const {
+    for (;;) {
+      unsigned           epoch   = mEpoch.load(std::memory_order_seq_cst);
+      std::atomic<long> *counter = &mReaders[epoch & 1][stripe()].value;
+      counter->fetch_add(1, std::memory_order_seq_cst);
+      if (mEpoch.load(std::memory_order_seq_cst) == epoch) {
+        return ReadGuard(mCurrent.load(std::memory_order_seq_cst), counter);
+      }
+      counter->fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  /**
+   * copy the current snapshot, modify the copy and publish it
+   * @param f: called with the copy
+   * @return what f returned
+   */
+  template <class F> auto update(F f) -> decltype(f(std::declval<T &>())) {
+    struct WriteLock {
+      pthread_mutex_t *m;
+      WriteLock(pthread_mutex_t *mutex) : m(mutex) { pthread_mutex_lock(m); }
+      ~WriteLock() { pthread_mutex_unlock(m); }
+    } lock(&mWriteMutex);
+
+    std::unique_ptr<T> copy(new T(*mCurrent.load(std::memory_order_relaxed)));
+    if constexpr (std::is_void_v<decltype(f(*copy))>) {
+      f(*copy);
+      publish(copy.release());
+    } else {
+      auto res = f(*copy);
+      publish(copy.release());
+      return res;
+    }
+  }
+
+  /**
+   * replace the current snapshot
+   * @param snapshot: the new snapshot, owned by the NvjRcuPtr
+   */
+  void reset(T *snapshot) {
+    pthread_mutex_lock(&mWriteMutex);
+    publish(snapshot);
+    pthread_mutex_unlock(&mWriteMutex);
+  }
+};
+
+#endif
@@ -0,0 +1,160 @@
+//********************************************************
+/**
+ * @file  nvjThreadPool.h
+ *
+ * @brief shared worker pool for CPU-bound background tasks
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJTHREADPOOL_H_
+#define NVJTHREADPOOL_H_
+
+#include <functional>
+#include <queue>
+#include <unistd.h>
+#include <vector>
+
+#include "libnavajo/nvjThread.h"
+
+//********************************************************
+
+class NvjThreadPool {
+  std::queue<std::function<void()>> mTasks;
+  pthread_mutex_t                   mMutex;
+  pthread_cond_t                    mCond;
+  std::vector<pthread_t>            mThreads;
+  bool                              mExiting;
+
+  inline static void *startWorker(void *t) {
+    static_cast<NvjThreadPool *>(t)->workerProcessing();
+    pthread_exit(nullptr);
+    return nullptr;
+  };
+
+  void workerProcessing() {
+    pthread_mutex_lock(&mMutex);
+    for (;;) {
+      while (mTasks.empty() && !mExiting) {
+        pthread_cond_wait(&mCond, &mMutex);
+      }
+
+      if (mTasks.empty()) { // exiting
+        break;
+      }
+
+      std::function<void()> task = std::move(mTasks.front());
+      mTasks.pop();
+      pthread_mutex_unlock(&mMutex);
+      task();
+      pthread_mutex_lock(&mMutex);
+    }
+    pthread_mutex_unlock(&mMutex);
+  }
+
+public:
+  /**
+   * @param nbThreads: number of workers
+   */
+  NvjThreadPool(size_t nbThreads) : mExiting(false) {
+    pthread_mutex_init(&mMutex, nullptr);
+    pthread_cond_init(&mCond, nullptr);
+    mThreads.resize(nbThreads ? nbThreads : 1);
+    for (auto &thread : mThreads) {
+      create_thread(&thread, NvjThreadPool::startWorker, static_cast<void *>(this));
+    }
+  }
+
+  /**
+   * the pending tasks are run before the workers exit
+   */
+  ~NvjThreadPool() {
+    pthread_mutex_lock(&mMutex);
+    mExiting = true;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mMutex);
+
+    for (auto &thread : mThreads) {
+      wait_for_thread(thread);
+    }
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mMutex);
+  }
+
+  NvjThreadPool(const NvjThreadPool &)            = delete;
+  NvjThreadPool &operator=(const NvjThreadPool &) = delete;
+
+  /**
+   * queue a task
+   */
+  void push(std::function<void()> task) {
+    pthread_mutex_lock(&mMutex);
+    mTasks.push(std::move(task));
+    pthread_mutex_unlock(&mMutex);
+    pthread_cond_signal(&mCond);
+  }
+
+  /**
+   * @return the number of workers
+   */
+  inline size_t size() const { return mThreads.size(); }
+
+  /**
+   * the process-wide pool, one worker per online cpu
+   */
+  static NvjThreadPool &shared() {
+    static NvjThreadPool pool(sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1);
+    return pool;
+  }
+};
+
+//********************************************************
+
+/**
+ * Counts the completion of a set of tasks
+ */
+class NvjWaitGroup {
+  pthread_mutex_t mMutex;
+  pthread_cond_t  mCond;
+  size_t          mPending;
+
+public:
+  NvjWaitGroup(size_t pending = 0) : mPending(pending) {
+    pthread_mutex_init(&mMutex, nullptr);
+    pthread_cond_init(&mCond, nullptr);
+  }
+
+  ~NvjWaitGroup() {
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mMutex);
+  }
+
+  NvjWaitGroup(const NvjWaitGroup &)            = delete;
+  NvjWaitGroup &operator=(const NvjWaitGroup &) = delete;
+
+  void add(size_t n = 1) {
+    pthread_mutex_lock(&mMutex);
+    mPending += n;
+    pthread_mutex_unlock(&mMutex);
+  }
+
+  void done() {
+    pthread_mutex_lock(&mMutex);
+    if (mPending && !--mPending) {
+      pthread_cond_broadcast(&mCond);
+    }
+    pthread_mutex_unlock(&mMutex);
+  }
+
+  void wait() {
+    pthread_mutex_lock(&mMutex);
+    while (mPending) {
+      pthread_cond_wait(&mCond, &mMutex);
+    }
+    pthread_mutex_unlock(&mMutex);
+  }
+};
+
+#endif
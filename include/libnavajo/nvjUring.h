@@ -0,0 +1,452 @@
+//********************************************************
+/**
+ * @file  nvjUring.h
+ *
+ * @brief minimal io_uring engine (raw system calls, no
+ *        liburing), probed at runtime
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJURING_H_
+#define NVJURING_H_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NVJ_HAVE_URING 1
+#endif
+#endif
+
+#ifdef NVJ_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+
+#define NVJ_URING_PIPE_SIZE (512 * 1024)
+
+/**
+ * NvjUring - an io_uring instance used synchronously by one thread:
+ * operations are prepared, then submitted and waited for together by a
+ * single io_uring_enter(). The ring also owns a pipe, registered as
+ * fixed files, to splice files to sockets without copy.
+ *
+ * isSupported() probes the kernel once (setup allowed, required opcodes
+ * available, NVJ_NO_URING not set in the environment); forThread()
+ * returns the ring of the calling thread, nullptr when unsupported so
+ * that the callers fall back to the classic system calls.
+ */
+class NvjUring {
+  int                  ringFd;
+  unsigned            *sqHead, *sqTail, *sqMask, *sqArray, sqEntries;
+  unsigned            *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void                *sqRing, *cqRing;
+  size_t               sqRingSize, cqRingSize, sqesSize;
+  unsigned             localTail, submittedTail;
+  int                  pipeFds[2];
+  size_t               pipeSize;
+  bool                 broken; // state unknown after a failure: replaced by forThread()
+
+  static inline int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+  }
+
+  static inline int registerOp(int fd, unsigned opcode, const void *arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+  }
+
+  void release() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+      munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+      munmap(sqRing, sqRingSize);
+    }
+    for (int fd : {ringFd, pipeFds[0], pipeFds[1]}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  void fail(const char *what) {
+    std::string msg = std::string("io_uring : ") + what + ": " + strerror(errno);
+    release();
+    throw std::runtime_error(msg);
+  }
+
+  // empty the pipe after a failed transfer, its bytes would go to the next one
+  bool drainPipe() {
+    char buf[16 * 1024];
+    int  n;
+    while (ioctl(pipeFds[0], FIONREAD, &n) == 0) {
+      if (n == 0) {
+        return true;
+      }
+      ssize_t res = read(pipeFds[0], buf, (size_t)n < sizeof buf ? n : sizeof buf);
+      if (res <= 0 && !(res < 0 && errno == EINTR)) {
+        break;
+      }
+    }
+    return false;
+  }
+
+  bool abortSend(int err) {
+    if (!drainPipe()) {
+      broken = true;
+    }
+    errno = err;
+    return false;
+  }
+
+  static bool probe() {
+    if (getenv("NVJ_NO_URING") != nullptr) {
+      return false;
+    }
+    try {
+      NvjUring                   ring(4);
+      const unsigned             nbOps = 256;
+      std::vector<unsigned char> buf(sizeof(struct io_uring_probe) + nbOps * sizeof(struct io_uring_probe_op), 0);
+      if (registerOp(ring.ringFd, IORING_REGISTER_PROBE, buf.data(), nbOps) < 0) {
+        return false;
+      }
+      const struct io_uring_probe *p = reinterpret_cast<const struct io_uring_probe *>(buf.data());
+      for (int op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_SPLICE}) {
+        if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+          return false;
+        }
+      }
+      return true;
+    } catch (std::exception &) {
+      return false;
+    }
+  }
+
+public:
+  /**
+   * @param entries: the size of the submission queue
+   * @throw std::runtime_error if the ring can't be created
+   */
+  explicit NvjUring(unsigned entries = 32)
+      : ringFd(-1), sqes((struct io_uring_sqe *)MAP_FAILED), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqesSize(0),
+        pipeFds{-1, -1}, pipeSize(0), broken(false) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    ringFd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ringFd < 0) {
+      fail("setup");
+    }
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+      fail("mmap");
+    }
+    cqRing = (p.features & IORING_FEAT_SINGLE_MMAP)
+                 ? sqRing
+                 : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_CQ_RING);
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes     = (struct io_uring_sqe *)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           ringFd, IORING_OFF_SQES);
+    if (cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+      fail("mmap");
+    }
+
+    unsigned char *sq = static_cast<unsigned char *>(sqRing), *cq = static_cast<unsigned char *>(cqRing);
+    sqHead        = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sqTail        = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sqMask        = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sqArray       = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    sqEntries     = p.sq_entries;
+    cqHead        = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cqTail        = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cqMask        = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes          = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    localTail     = *sqTail;
+    submittedTail = localTail;
+
+    // the pipe: read end is fixed file 0, write end fixed file 1
+    if (pipe2(pipeFds, O_CLOEXEC) < 0) {
+      fail("pipe");
+    }
+    int size = fcntl(pipeFds[1], F_SETPIPE_SZ, NVJ_URING_PIPE_SIZE);
+    pipeSize = size > 0 ? size : fcntl(pipeFds[1], F_GETPIPE_SZ);
+    if (registerOp(ringFd, IORING_REGISTER_FILES, pipeFds, 2) < 0) {
+      fail("register files");
+    }
+  }
+
+  ~NvjUring() { release(); }
+
+  NvjUring(const NvjUring &)            = delete;
+  NvjUring &operator=(const NvjUring &) = delete;
+
+  /**
+   * @return true if io_uring can be used (probed once)
+   */
+  static bool isSupported() {
+    static const bool supported = probe();
+    return supported;
+  }
+
+  /**
+   * @return the ring of the calling thread, nullptr if io_uring is not supported
+   */
+  static NvjUring *forThread() {
+    if (!isSupported()) {
+      return nullptr;
+    }
+    static thread_local std::unique_ptr<NvjUring> ring;
+    static thread_local bool                      failed = false;
+    if (ring != nullptr && ring->broken) {
+      ring.reset();
+    }
+    if (ring == nullptr && !failed) {
+      try {
+        ring.reset(new NvjUring());
+      } catch (std::exception &) {
+        failed = true;
+      }
+    }
+    return ring.get();
+  }
+
+  /**
+   * @return a cleared submission entry, nullptr if the queue is full
+   */
+  struct io_uring_sqe *getSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localTail - head >= sqEntries) {
+      return nullptr;
+    }
+    unsigned index = localTail++ & *sqMask;
+    sqArray[index] = index;
+    memset(&sqes[index], 0, sizeof(struct io_uring_sqe));
+    return &sqes[index];
+  }
+
+  /**
+   * Submit the prepared operations and wait for their nb completions
+   * @param results: filled with the result of each operation, indexed by
+   *   its user_data (negated errno on failure)
+   * @return false with errno set if the submission failed
+   */
+  bool run(int *results, unsigned nb) {
+    unsigned toSubmit = localTail - submittedTail;
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    submittedTail = localTail;
+
+    unsigned done = 0;
+    while (done < nb) {
+      unsigned head = *cqHead;
+      if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        int res = enter(ringFd, toSubmit, nb - done, IORING_ENTER_GETEVENTS);
+        if (res < 0 && errno != EINTR) {
+          return false;
+        }
+        if (res > 0) {
+          toSubmit -= (unsigned)res < toSubmit ? res : toSubmit;
+        }
+        continue;
+      }
+      const struct io_uring_cqe &cqe = cqes[head & *cqMask];
+      if (cqe.user_data < nb) {
+        results[cqe.user_data] = cqe.res;
+      }
+      __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+      done++;
+    }
+    return true;
+  }
+
+  /**********************************************************************/
+  // preparation of the operations, as liburing does
+
+  static inline void prep(struct io_uring_sqe *sqe, int op, int fd, uint64_t addr, unsigned len, uint64_t off,
+                          uint64_t userData) {
+    sqe->opcode    = op;
+    sqe->fd        = fd;
+    sqe->addr      = addr;
+    sqe->len       = len;
+    sqe->off       = off;
+    sqe->user_data = userData;
+  }
+
+  static inline void prepOpenat(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, mode_t mode,
+                                uint64_t userData) {
+    prep(sqe, IORING_OP_OPENAT, dirFd, (uintptr_t)path, mode, 0, userData);
+    sqe->open_flags = flags;
+  }
+
+  static inline void prepStatx(struct io_uring_sqe *sqe, int dirFd, const char *path, int flags, unsigned mask,
+                               struct statx *buf, uint64_t userData) {
+    prep(sqe, IORING_OP_STATX, dirFd, (uintptr_t)path, mask, (uintptr_t)buf, userData);
+    sqe->statx_flags = flags;
+  }
+
+  static inline void prepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len, uint64_t offset,
+                              uint64_t userData) {
+    prep(sqe, IORING_OP_READ, fd, (uintptr_t)buf, len, offset, userData);
+  }
+
+  static inline void prepSplice(struct io_uring_sqe *sqe, int fdIn, int64_t offIn, int fdOut, int64_t offOut,
+                                unsigned len, unsigned flags, uint64_t userData) {
+    prep(sqe, IORING_OP_SPLICE, fdOut, 0, len, (uint64_t)offOut, userData);
+    sqe->splice_off_in = (uint64_t)offIn;
+    sqe->splice_fd_in  = fdIn;
+    sqe->splice_flags  = flags;
+  }
+
+  /**********************************************************************/
+  // composite operations
+
+  /**
+   * Read a whole regular file: statx and openat are submitted together,
+   * then the reads.
+   * @param st: filled with the type, device, inode, size and mtime
+   * @return false with errno set on failure
+   */
+  bool readFile(const char *path, std::vector<unsigned char> &data, struct stat &st) {
+    struct statx stx;
+    int          res[2];
+
+    prepStatx(getSqe(), AT_FDCWD, path, AT_STATX_SYNC_AS_STAT, STATX_BASIC_STATS, &stx, 0);
+    prepOpenat(getSqe(), AT_FDCWD, path, O_RDONLY | O_NONBLOCK | O_CLOEXEC, 0, 1);
+    if (!run(res, 2)) {
+      broken = true; // stx and res may still be written
+      return false;
+    }
+    int fd = res[1];
+    if (fd < 0 || res[0] < 0 || !S_ISREG(stx.stx_mode)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      errno = fd < 0 ? -fd : res[0] < 0 ? -res[0] : EISDIR;
+      return false;
+    }
+
+    memset(&st, 0, sizeof st);
+    st.st_mode         = stx.stx_mode;
+    st.st_dev          = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_ino          = stx.stx_ino;
+    st.st_size         = stx.stx_size;
+    st.st_mtim.tv_sec  = stx.stx_mtime.tv_sec;
+    st.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+
+    data.resize(stx.stx_size);
+    size_t done = 0;
+    while (done < data.size()) {
+      unsigned len = data.size() - done > 1u << 30 ? 1u << 30 : data.size() - done;
+      prepRead(getSqe(), fd, data.data() + done, len, done, 0);
+      if (!run(res, 1)) {
+        broken = true; // the read may still be in flight
+        close(fd);
+        return false;
+      }
+      if (res[0] <= 0 || (unsigned)res[0] != len) {
+        close(fd);
+        errno = res[0] < 0 ? -res[0] : EIO; // changed meanwhile
+        return false;
+      }
+      done += len;
+    }
+    close(fd);
+    return true;
+  }
+
+  /**
+   * Send a part of a file to a socket without copy, by chunks spliced
+   * from the file to the pipe of the ring then from the pipe to the
+   * socket (linked, one submission per chunk). On failure, the pipe is
+   * emptied, or the ring replaced by forThread() if it can't be.
+   * @return false with errno set on failure
+   */
+  bool sendFile(int sock, int fd, off_t offset, size_t length) {
+    size_t inPipe = 0;
+    while (length > 0 || inPipe > 0) {
+      // the pipe is drained before being refilled: its capacity is counted in
+      // pages, a refill of the remaining bytes could block with unaligned data
+      unsigned chunk = inPipe > 0 ? 0 : length < pipeSize ? length : pipeSize;
+      int      res[2] = {0, 0};
+      unsigned nb     = 0;
+      if (chunk > 0) {
+        struct io_uring_sqe *sqe = getSqe();
+        prepSplice(sqe, fd, offset, 1, -1, chunk, 0, nb++);
+        sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+      }
+      // SPLICE_F_MORE corks the socket: not on the last chunk, it would wait for the timer
+      prepSplice(getSqe(), 0, -1, sock, -1, chunk > 0 ? chunk : inPipe,
+                 SPLICE_F_FD_IN_FIXED | (length > chunk ? SPLICE_F_MORE : 0), nb++);
+      if (!run(res, nb)) {
+        broken = true; // the splices may still be in flight
+        return false;
+      }
+
+      // a short splice breaks the link: what remains in the pipe is sent next
+      int fileRes = chunk > 0 ? res[0] : 0, sockRes = res[nb - 1];
+      if (fileRes < 0 || (sockRes < 0 && sockRes != -ECANCELED)) {
+        return abortSend(fileRes < 0 ? -fileRes : -sockRes);
+      }
+      if (chunk > 0 && fileRes == 0) {
+        return abortSend(EIO); // truncated meanwhile
+      }
+      inPipe += fileRes;
+      inPipe -= sockRes > 0 ? sockRes : 0;
+      offset += fileRes;
+      length -= fileRes;
+    }
+    return true;
+  }
+
+  inline size_t getPipeSize() const { return pipeSize; }
+};
+
+#else
+
+/**
+ * NvjUring - io_uring is not available on this platform
+ */
+class NvjUring {
+public:
+  static bool      isSupported() { return false; }
+  static NvjUring *forThread() { return nullptr; }
+  bool readFile(const char *, std::vector<unsigned char> &, struct stat &) {
+    errno = ENOSYS;
+    return false;
+  }
+  bool sendFile(int, int, off_t, size_t) {
+    errno = ENOSYS;
+    return false;
+  }
+};
+
+#endif
+
+#endif
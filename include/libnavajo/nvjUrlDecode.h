@@ -0,0 +1,173 @@
+//********************************************************
+/**
+ * @file  nvjUrlDecode.h
+ *
+ * @brief single pass percent-decoding and query string
+ *        splitting
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#ifndef NVJURLDECODE_H_
+#define NVJURLDECODE_H_
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define NVJ_URLDECODE_X86 1
+#include <immintrin.h>
+#endif
+
+//********************************************************
+
+inline int nvj_hex_value(const char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+//********************************************************
+/**
+ * offset of the first '%' (or '+' if plus is set) in s, len if none
+ */
+inline size_t nvj_url_find_escape_scalar(const char *s, const size_t len, const bool plus) {
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '%' || (plus && s[i] == '+'))
+      return i;
+  }
+  return len;
+}
+
+#ifdef NVJ_URLDECODE_X86
+
+inline size_t nvj_url_find_escape_sse2(const char *s, const size_t len, const bool plus) {
+  const __m128i percent = _mm_set1_epi8('%');
+  const __m128i plusc   = _mm_set1_epi8(plus ? '+' : '%');
+  size_t        i       = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(s + i));
+    int     mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, percent), _mm_cmpeq_epi8(chunk, plusc)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + nvj_url_find_escape_scalar(s + i, len - i, plus);
+}
+
+__attribute__((target("avx2"))) inline size_t nvj_url_find_escape_avx2(const char *s, const size_t len,
+                                                                        const bool plus) {
+  const __m256i percent = _mm256_set1_epi8('%');
+  const __m256i plusc   = _mm256_set1_epi8(plus ? '+' : '%');
+  size_t        i       = 0;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i  chunk = _mm256_loadu_si256((const __m256i *)(s + i));
+    unsigned mask  = (unsigned)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, percent), _mm256_cmpeq_epi8(chunk, plusc)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + nvj_url_find_escape_sse2(s + i, len - i, plus);
+}
+
+#endif
+
+//********************************************************
+/**
+ * offset of the first '%' (or '+' if plus is set) in s, len if none,
+ * using the widest vector instructions available at runtime
+ */
+inline size_t nvj_url_find_escape(const char *s, const size_t len, const bool plus) {
+#ifdef NVJ_URLDECODE_X86
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  if (len >= 32 && hasAvx2)
+    return nvj_url_find_escape_avx2(s, len, plus);
+  return nvj_url_find_escape_sse2(s, len, plus);
+#else
+  return nvj_url_find_escape_scalar(s, len, plus);
+#endif
+}
+
+//********************************************************
+/**
+ * decode the percent-escapes of src (and '+' as space if plusAsSpace)
+ * "%%" is decoded as '%', invalid escapes are kept as is.
+ * @param dst: the output buffer, at least len bytes. May be equal to src.
+ * @return the decoded length
+ */
+inline size_t nvj_url_decode(char *dst, const char *src, const size_t len, const bool plusAsSpace = true) {
+  size_t i = 0, o = 0;
+
+  while (i < len) {
+    size_t n = nvj_url_find_escape(src + i, len - i, plusAsSpace);
+    if (n) {
+      if (dst + o != src + i)
+        memmove(dst + o, src + i, n);
+      o += n;
+      i += n;
+      if (i == len)
+        break;
+    }
+
+    if (src[i] == '+') {
+      dst[o++] = ' ';
+      i++;
+      continue;
+    }
+
+    // '%'
+    int hi, lo;
+    if (i + 1 < len && src[i + 1] == '%') {
+      dst[o++] = '%';
+      i += 2;
+    } else if (i + 2 < len && (hi = nvj_hex_value(src[i + 1])) >= 0 && (lo = nvj_hex_value(src[i + 2])) >= 0) {
+      dst[o++] = (char)(hi << 4 | lo);
+      i += 3;
+    } else {
+      dst[o++] = '%';
+      i++;
+    }
+  }
+
+  return o;
+}
+
+inline std::string nvj_url_decode(std::string_view s, const bool plusAsSpace = true) {
+  std::string res(s.size(), '\0');
+  res.resize(nvj_url_decode(res.data(), s.data(), s.size(), plusAsSpace));
+  return res;
+}
+
+//********************************************************
+/**
+ * split an application/x-www-form-urlencoded string on '&' and '='
+ * without copying, and call f(key, value, hasValue) for each pair.
+ * The views are still escaped.
+ */
+template <class F> inline void nvj_split_query(std::string_view query, F f) {
+  size_t start = 0;
+  for (;;) {
+    size_t           end   = query.find('&', start);
+    std::string_view param = query.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+    size_t           posEq = param.find('=');
+
+    if (posEq == std::string_view::npos)
+      f(param, std::string_view(), false);
+    else
+      f(param.substr(0, posEq), param.substr(posEq + 1), true);
+
+    if (end == std::string_view::npos)
+      break;
+    start = end + 1;
+  }
+}
+
+#endif
@@ -0,0 +1,145 @@
+//********************************************************
+/**
+ * @file  BundleRepository.cc
+ *
+ * @brief Serves a memory-mapped bundle of web files
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#include "libnavajo/GrDebug.hpp"
+
+#include "libnavajo/BundleRepository.hh"
+#include "libnavajo/LogRecorder.hh"
+#include <sys/stat.h>
+#include <time.h>
+
+/**********************************************************************/
+
+BundleRepository::BundleRepository(const std::string &alias, const std::string &path, const unsigned interval)
+    : bundle(new BundlePtr), aliasName(alias), bundlePath(path), checkInterval(interval), lastCheck(time(nullptr)) {
+  GR_JUMP_TRACE;
+  while (aliasName.size() && aliasName[0] == '/') {
+    aliasName.erase(0, 1);
+  }
+  while (aliasName.size() && aliasName[aliasName.size() - 1] == '/') {
+    aliasName.erase(aliasName.size() - 1);
+  }
+
+  reload();
+}
+
+/**********************************************************************/
+
+bool BundleRepository::reload() {
+  GR_JUMP_TRACE;
+  try {
+    auto mapping = std::make_shared<const NvjBundle>(bundlePath);
+    spdlog::info("BundleRepository: {} files mapped from '{}'", mapping->size(), bundlePath);
+    bundle.reset(new BundlePtr(std::move(mapping)));
+    return true;
+  } catch (std::exception &e) {
+    spdlog::error("BundleRepository: {}", e.what());
+    return false;
+  }
+}
+
+/**********************************************************************/
+
+void BundleRepository::checkUpdate() {
+  GR_JUMP_TRACE;
+  time_t now = time(nullptr), last = lastCheck.load(std::memory_order_relaxed);
+  if (now - last < (time_t)checkInterval || !lastCheck.compare_exchange_strong(last, now)) {
+    return; // checked recently, or by another thread
+  }
+
+  struct stat st;
+  if (stat(bundlePath.c_str(), &st) < 0) {
+    return;
+  }
+
+  bool outdated;
+  {
+    auto current = bundle.read();
+    outdated     = *current == nullptr || (*current)->isOutdated(st);
+  }
+  if (outdated) {
+    reload();
+  }
+}
+
+/**********************************************************************/
+
+bool BundleRepository::getFile(HttpRequest *request, HttpResponse *response) {
+  GR_JUMP_TRACE;
+  std::string_view url = request->getUrl();
+  if (url.compare(0, aliasName.size(), aliasName) != 0) {
+    return false;
+  }
+
+  url.remove_prefix(aliasName.size());
+  if (url.size() && url[0] != '/' && aliasName.size()) {
+    return false;
+  }
+  while (url.size() && url[0] == '/') {
+    url.remove_prefix(1);
+  }
+  if (!url.size()) {
+    url = "index.html";
+  }
+
+  if (checkInterval) {
+    checkUpdate();
+  }
+
+  BundlePtr mapping = *bundle.read();
+  if (mapping == nullptr) {
+    return false;
+  }
+
+  const NvjBundleEntry *entry = mapping->find(url);
+  if (entry == nullptr) {
+    return false;
+  }
+
+  if (entry->mimeLength) {
+    response->setMimeType(std::string(mapping->getMimeType(*entry)));
+  }
+
+  std::string_view etag = mapping->getEtag(*entry);
+  if (request->isNotModified(etag)) {
+    response->addSpecificHeader("ETag: " + std::string(etag));
+    response->setHttpReturnCode(304);
+    response->setContent(nullptr, 0);
+    return true;
+  }
+
+  // the stored versions are sent as is, with their prerendered headers
+  const NvjBundleVariant *variants = entry->variants, *variant = nullptr;
+  if (variants[NVJ_BUNDLE_BROTLI].offset && request->acceptsEncoding("br")) {
+    variant = &variants[NVJ_BUNDLE_BROTLI];
+  } else if (variants[NVJ_BUNDLE_GZIP].offset && request->acceptsEncoding("gzip")) {
+    variant = &variants[NVJ_BUNDLE_GZIP];
+  } else if (variants[NVJ_BUNDLE_IDENTITY].offset) {
+    variant = &variants[NVJ_BUNDLE_IDENTITY];
+  }
+
+  if (variant != nullptr) {
+    response->setContent(const_cast<unsigned char *>(mapping->getData(*variant)), variant->length);
+    response->setPrerenderedHeaders(mapping->getHeaders(*variant).data());
+  } else if (variants[NVJ_BUNDLE_GZIP].offset) {
+    // gzip version only: uncompressed by the server
+    response->addSpecificHeader("ETag: " + std::string(etag));
+    response->setContent(const_cast<unsigned char *>(mapping->getData(variants[NVJ_BUNDLE_GZIP])),
+                         variants[NVJ_BUNDLE_GZIP].length);
+    response->setIsZipped(true);
+  } else {
+    response->addSpecificHeader("ETag: " + std::string(etag));
+    response->setContent(nullptr, 0);
+  }
+
+  response->setContentOwner(std::move(mapping));
+  return true;
+}
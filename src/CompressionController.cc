@@ -0,0 +1,176 @@
+//********************************************************
+/**
+ * @file  CompressionController.cc
+ *
+ * @brief Chooses the compression level of each response
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "libnavajo/CompressionController.hh"
+#include "libnavajo/GrDebug.hpp"
+#include "libnavajo/nvjMimeType.h"
+
+#define CPU_LOAD_SAMPLING_MS 1000
+
+/***********************************************************************/
+
+CompressionController *CompressionController::getInstance() {
+  static CompressionController theCompressionController;
+  return &theCompressionController;
+}
+
+/***********************************************************************/
+
+CompressionController::CompressionController()
+    : enabled(true), adaptive(true), minLevel(Z_BEST_SPEED), maxLevel(6), largeMaxLevel(3), lowWatermark(0.5),
+      highWatermark(0.9), minSize(2048), minMessageSize(64), largeSize(1024 * 1024), workers(0), busyWorkers(0),
+      cpuLoad(0), cpuLoadDate_ms(0), bytesIn(0), bytesOut(0) {
+  GR_JUMP_TRACE;
+  nbCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nbCpus < 1) {
+    nbCpus = 1;
+  }
+  for (auto &c : levelCount) {
+    c = 0;
+  }
+  for (auto &c : skipCount) {
+    c = 0;
+  }
+}
+
+/***********************************************************************/
+
+void CompressionController::setLevels(const int minL, const int maxL) {
+  GR_JUMP_TRACE;
+  int lo = minL < Z_BEST_SPEED ? Z_BEST_SPEED : minL > Z_BEST_COMPRESSION ? Z_BEST_COMPRESSION : minL;
+  int hi = maxL < lo ? lo : maxL > Z_BEST_COMPRESSION ? Z_BEST_COMPRESSION : maxL;
+  minLevel = lo;
+  maxLevel = hi;
+}
+
+/***********************************************************************/
+
+void CompressionController::setLoadWatermarks(const double low, const double high) {
+  GR_JUMP_TRACE;
+  lowWatermark  = low;
+  highWatermark = high < low ? low : high;
+}
+
+/***********************************************************************/
+/**
+ * getLoad - the workers utilization or the normalized load average,
+ *   whichever is the highest. The load average is sampled at most once
+ *   per second.
+ */
+double CompressionController::getLoad() {
+  long long now_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  long long last_ms = cpuLoadDate_ms.load(std::memory_order_relaxed);
+
+  if (now_ms - last_ms >= CPU_LOAD_SAMPLING_MS &&
+      cpuLoadDate_ms.compare_exchange_strong(last_ms, now_ms, std::memory_order_relaxed)) {
+    double loadavg;
+    if (getloadavg(&loadavg, 1) == 1) {
+      cpuLoad.store(loadavg / nbCpus, std::memory_order_relaxed);
+    }
+  }
+
+  double load = cpuLoad.load(std::memory_order_relaxed);
+  long   nb   = workers.load(std::memory_order_relaxed);
+  if (nb > 0) {
+    double utilization = (double)busyWorkers.load(std::memory_order_relaxed) / nb;
+    if (utilization > load) {
+      load = utilization;
+    }
+  }
+
+  return load > 1 ? 1 : load;
+}
+
+/***********************************************************************/
+
+int CompressionController::chooseLevel(const size_t size, const char *mimetype, const size_t minLen) {
+  SkipReason reason;
+
+  if (!enabled) {
+    reason = SKIP_DISABLED;
+  } else if (mimetype != nullptr && !isCompressibleMimeType(mimetype)) {
+    reason = SKIP_MIME;
+  } else if (size <= minLen) {
+    reason = SKIP_SIZE;
+  } else {
+    int lo = minLevel, hi = maxLevel;
+    if (size >= largeSize && largeMaxLevel < hi) {
+      hi = largeMaxLevel < lo ? lo : largeMaxLevel.load();
+    }
+
+    int level = hi;
+    if (adaptive) {
+      double load = getLoad(), low = lowWatermark, high = highWatermark;
+      if (load >= high) {
+        skipCount[SKIP_LOAD].fetch_add(1, std::memory_order_relaxed);
+        return NO_COMPRESSION;
+      }
+      if (load > low) {
+        level = hi - (int)((hi - lo) * (load - low) / (high - low) + 0.5);
+      }
+    }
+
+    levelCount[level].fetch_add(1, std::memory_order_relaxed);
+    return level;
+  }
+
+  skipCount[reason].fetch_add(1, std::memory_order_relaxed);
+  return NO_COMPRESSION;
+}
+
+/***********************************************************************/
+/**
+ * isCompressibleMimeType - see nvj_is_compressible_mime_type()
+ */
+bool CompressionController::isCompressibleMimeType(const char *mimetype) {
+  return nvj_is_compressible_mime_type(mimetype);
+}
+
+/***********************************************************************/
+
+std::string CompressionController::getMetrics() {
+  GR_JUMP_TRACE;
+  static const char *const reasons[SKIP_REASON_COUNT] = {"mime", "size", "load", "disabled"};
+  std::ostringstream       out;
+
+  out << "# HELP navajo_compression_level_total Payloads compressed, by zlib level\n"
+      << "# TYPE navajo_compression_level_total counter\n";
+  for (int l = Z_BEST_SPEED; l <= Z_BEST_COMPRESSION; l++) {
+    out << "navajo_compression_level_total{level=\"" << l << "\"} " << levelCount[l].load() << '\n';
+  }
+
+  out << "# HELP navajo_compression_skipped_total Payloads sent uncompressed, by reason\n"
+      << "# TYPE navajo_compression_skipped_total counter\n";
+  for (int r = 0; r < SKIP_REASON_COUNT; r++) {
+    out << "navajo_compression_skipped_total{reason=\"" << reasons[r] << "\"} " << skipCount[r].load() << '\n';
+  }
+
+  out << "# HELP navajo_compression_bytes_in_total Bytes given to the compressor\n"
+      << "# TYPE navajo_compression_bytes_in_total counter\n"
+      << "navajo_compression_bytes_in_total " << bytesIn.load() << '\n'
+      << "# HELP navajo_compression_bytes_out_total Bytes produced by the compressor\n"
+      << "# TYPE navajo_compression_bytes_out_total counter\n"
+      << "navajo_compression_bytes_out_total " << bytesOut.load() << '\n'
+      << "# HELP navajo_compression_load Load seen by the compression controller\n"
+      << "# TYPE navajo_compression_load gauge\n"
+      << "navajo_compression_load " << getLoad() << '\n';
+
+  return out.str();
+}
@@ -15,21 +15,57 @@
 
 #include "libnavajo/LocalRepository.hh"
 #include "libnavajo/LogRecorder.hh"
+#include "libnavajo/nvjMimeType.h"
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
+#include <poll.h>
 #include <sstream>
 #include <streambuf>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS                                                                                                   \
+  (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+#ifdef O_PATH
+#define DIRECTORY_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIRECTORY_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+#define MISSING_FILES_CACHE_SIZE 65536 // entries
+#define MISSING_FILES_TTL 2            // seconds
 
 /**********************************************************************/
 
-LocalRepository::LocalRepository(const std::string &alias, const std::string &dirPath) {
+static inline bool isSameFile(const struct stat &a, const struct stat &b) {
+#ifdef __linux__
+  return a.st_ino == b.st_ino && a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+#else
+  return a.st_ino == b.st_ino && a.st_size == b.st_size && a.st_mtime == b.st_mtime;
+#endif
+}
+
+/**********************************************************************/
+
+LocalRepository::LocalRepository(const std::string &alias, const std::string &dirPath, IndexingMode mode)
+    : indexingMode(mode), indexed(false), indexing(false), rootFd(-1), indexerStarted(false), indexerRunning(false),
+      indexerRescan(false), indexerStopping(false), maxCachedFileSize(0), sendFileThreshold(64 * 1024), inotifyFd(-1), stopFd(-1) {
   GR_JUMP_TRACE;
   char resolved_path[4096];
 
-  pthread_mutex_init(&_mutex, nullptr);
+  pthread_mutex_init(&indexMutex, nullptr);
+  pthread_mutex_init(&watchMutex, nullptr);
+  pthread_mutex_init(&updateMutex, nullptr);
 
   aliasName = alias;
   while (aliasName.size() && aliasName[0] == '/') {
@@ -39,31 +75,375 @@ LocalRepository::LocalRepository(const std::string &alias, const std::string &di
     aliasName.erase(aliasName.size() - 1);
   }
 
-  if (realpath(dirPath.c_str(), resolved_path) != nullptr) {
-    fullPathToLocalDir = resolved_path;
-    loadFilename_dir(aliasName, fullPathToLocalDir);
+  if (realpath(dirPath.c_str(), resolved_path) == nullptr) {
+    return;
+  }
+  fullPathToLocalDir = resolved_path;
+
+  if (indexingMode == FULL_SCAN) {
+    reload();
+    return;
+  }
+
+  rootFd = open(fullPathToLocalDir.c_str(), DIRECTORY_OPEN_FLAGS);
+  if (rootFd < 0) {
+    spdlog::error("LocalRepository - can't open directory '{}': {}", fullPathToLocalDir, strerror(errno));
+  }
+  missingFiles.reset(new NvjContentCache<time_t>(MISSING_FILES_CACHE_SIZE));
+  if (indexingMode == LAZY_BACKGROUND) {
+    startIndexing();
   }
 }
 
 /**********************************************************************/
 
+LocalRepository::~LocalRepository() {
+  GR_JUMP_TRACE;
+  indexerStopping = true;
+  stopWatching(); // no more reload() from the watcher
+  if (indexerStarted) {
+    wait_for_thread(indexerThread);
+  }
+  if (rootFd >= 0) {
+    close(rootFd);
+  }
+  pthread_mutex_destroy(&indexMutex);
+  pthread_mutex_destroy(&watchMutex);
+  pthread_mutex_destroy(&updateMutex);
+}
+
+/**********************************************************************/
+
+void LocalRepository::setCacheSize(size_t maxSize, size_t maxFileSize) {
+  GR_JUMP_TRACE;
+  if (!maxSize) {
+    stopWatching();
+    cache.reset();
+    return;
+  }
+
+  maxCachedFileSize = maxFileSize ? maxFileSize : maxSize / 8;
+  if (cache != nullptr) {
+    cache->setCapacity(maxSize);
+    return;
+  }
+  cache.reset(new NvjContentCache<FileContent>(maxSize));
+
+  if (fullPathToLocalDir.empty()) {
+    return;
+  }
+  int fd = -1;
+#ifdef __linux__
+  fd     = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stopFd = eventfd(0, EFD_CLOEXEC);
+#else
+  errno = ENOSYS;
+#endif
+  pthread_mutex_lock(&watchMutex); // a background scan may be adding watches
+  inotifyFd = fd;
+  pthread_mutex_unlock(&watchMutex);
+  if (inotifyFd < 0 || stopFd < 0) {
+    spdlog::warn("LocalRepository - inotify not available ({}), the cached files will be checked with stat()",
+                 strerror(errno));
+    stopWatching();
+    return;
+  }
+  reload(); // watches the directories
+  create_thread(&watcherThread, LocalRepository::startWatcher, this);
+}
+
+/**********************************************************************/
+
+void LocalRepository::stopWatching() {
+  GR_JUMP_TRACE;
+  if (inotifyFd >= 0 && stopFd >= 0) {
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof one) == sizeof one) {
+      wait_for_thread(watcherThread);
+    }
+  }
+
+  // a scan in progress may still add watches
+  pthread_mutex_lock(&watchMutex);
+  int fd    = inotifyFd;
+  inotifyFd = -1;
+  watchedDirs.clear();
+  addedWatches.clear();
+  pthread_mutex_unlock(&watchMutex);
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (stopFd >= 0) {
+    close(stopFd);
+  }
+  stopFd = -1;
+}
+
+/**********************************************************************/
+
 void LocalRepository::reload() {
   GR_JUMP_TRACE;
-  pthread_mutex_lock(&_mutex);
-  filenamesSet.clear();
-  loadFilename_dir(aliasName, fullPathToLocalDir);
-  pthread_mutex_unlock(&_mutex);
+  if (indexingMode == FULL_SCAN) {
+    index(false);
+  } else if (indexingMode == LAZY_BACKGROUND) {
+    startIndexing();
+  }
+
+  if (missingFiles != nullptr) {
+    missingFiles->clear();
+  }
+  if (cache != nullptr) {
+    cache->clear();
+  }
+}
+
+/**********************************************************************/
+
+void LocalRepository::startIndexing() {
+  GR_JUMP_TRACE;
+  if (indexerStopping) {
+    return;
+  }
+  indexerRescan = true;
+  if (indexerRunning.exchange(true)) {
+    return; // the running indexer will scan again
+  }
+  if (indexerStarted) {
+    wait_for_thread(indexerThread);
+  }
+  indexerStarted = true;
+  create_thread(&indexerThread, LocalRepository::startIndexer, this);
+}
+
+/**********************************************************************/
+
+void LocalRepository::indexInBackground() {
+  GR_JUMP_TRACE;
+  do {
+    while (indexerRescan.exchange(false) && !indexerStopping) {
+      index(true);
+    }
+    indexerRunning = false;
+  } while (indexerRescan && !indexerStopping && !indexerRunning.exchange(true));
+}
+
+/**********************************************************************/
+
+void LocalRepository::index(bool parallel) {
+  GR_JUMP_TRACE;
+  pthread_mutex_lock(&indexMutex);
+
+  pthread_mutex_lock(&updateMutex);
+  indexing = true;
+  pendingChanges.clear();
+  pthread_mutex_unlock(&updateMutex);
+
+  // the previous watches stay known during the scan: their events still
+  // invalidate the cache
+  std::map<int, std::string> previousWatches;
+  pthread_mutex_lock(&watchMutex);
+  previousWatches = watchedDirs;
+  addedWatches.clear();
+  pthread_mutex_unlock(&watchMutex);
+
+  auto *filenames = new FilenamesSet;
+  if (parallel) {
+    ParallelScan scan;
+    loadFilename_dir(*filenames, aliasName, fullPathToLocalDir, "", &scan);
+    scan.pending.wait();
+  } else {
+    loadFilename_dir(*filenames, aliasName, fullPathToLocalDir);
+  }
+
+  // the files created or deleted during the scan may have been missed
+  pthread_mutex_lock(&updateMutex);
+  for (const auto &change : pendingChanges) {
+    if (change.second) {
+      filenames->insert(change.first);
+    } else {
+      filenames->erase(change.first);
+    }
+  }
+  pendingChanges.clear();
+  indexing = false;
+  filenamesSet.reset(filenames);
+  if (!indexerStopping) {
+    indexed.store(true, std::memory_order_release);
+  }
+  pthread_mutex_unlock(&updateMutex);
+
+#ifdef __linux__
+  // the directories which disappeared are no longer watched
+  pthread_mutex_lock(&watchMutex);
+  for (const auto &watch : previousWatches) {
+    if (inotifyFd >= 0 && !addedWatches.count(watch.first) && watchedDirs.erase(watch.first)) {
+      inotify_rm_watch(inotifyFd, watch.first);
+    }
+  }
+  addedWatches.clear();
+  pthread_mutex_unlock(&watchMutex);
+#endif
+
+  if (parallel) {
+    spdlog::info("LocalRepository: {} files indexed in '{}'", filenamesSet.read()->size(), fullPathToLocalDir);
+  }
+  pthread_mutex_unlock(&indexMutex);
+}
+
+/**********************************************************************/
+
+void LocalRepository::updateFilenames(const FilenamesChanges &changes) {
+  GR_JUMP_TRACE;
+  pthread_mutex_lock(&updateMutex);
+  if (indexing) {
+    pendingChanges.insert(pendingChanges.end(), changes.begin(), changes.end());
+  }
+  auto *filenames = new FilenamesSet(*filenamesSet.read());
+  for (const auto &change : changes) {
+    if (change.second) {
+      filenames->insert(change.first);
+    } else {
+      filenames->erase(change.first);
+    }
+  }
+  filenamesSet.reset(filenames);
+  pthread_mutex_unlock(&updateMutex);
+}
+
+/**********************************************************************/
+
+void LocalRepository::watchDirectory(const std::string &subpath) {
+  GR_JUMP_TRACE;
+#ifdef __linux__
+  std::string fullPath = fullPathToLocalDir + subpath;
+  pthread_mutex_lock(&watchMutex);
+  if (inotifyFd >= 0) {
+    int wd = inotify_add_watch(inotifyFd, fullPath.c_str(), WATCH_EVENTS);
+    if (wd >= 0) {
+      watchedDirs[wd] = subpath; // the same descriptor if already watched
+      addedWatches.insert(wd);
+    } else {
+      spdlog::error("LocalRepository - can't watch directory '{}': {}", fullPath, strerror(errno));
+    }
+  }
+  pthread_mutex_unlock(&watchMutex);
+#endif
 }
 
 /**********************************************************************/
 
-bool LocalRepository::loadFilename_dir(const std::string &alias, const std::string &path, const std::string &subpath) {
+void LocalRepository::watchEvents() {
   GR_JUMP_TRACE;
-  struct dirent *entry;
-  DIR           *dir;
-  struct stat    s;
-  std::string    fullPath = path + subpath;
+#ifdef __linux__
+  alignas(struct inotify_event) char buffer[16 * 1024];
+  struct pollfd                      fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("LocalRepository - poll error: {}", strerror(errno));
+      return;
+    }
+    if (fds[1].revents) {
+      return;
+    }
+
+    ssize_t len = read(inotifyFd, buffer, sizeof buffer);
+    if (len <= 0) {
+      continue;
+    }
+
+    // the changes of the whole batch are applied at once to the list of files
+    FilenamesChanges changes;
+    bool             rescan = false;
+
+    for (char *p = buffer; p < buffer + len;) {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        rescan = true;
+        continue;
+      }
+
+      std::string subpath;
+      pthread_mutex_lock(&watchMutex);
+      auto watch = watchedDirs.find(event->wd);
+      bool known = watch != watchedDirs.end();
+      if (known) {
+        subpath = watch->second;
+        if (event->mask & IN_IGNORED) {
+          watchedDirs.erase(watch);
+        }
+      }
+      pthread_mutex_unlock(&watchMutex);
+
+      if (!known || !event->len) {
+        continue; // event on the watched directory itself
+      }
+      subpath += std::string("/") + event->name;
+
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & IN_MOVED_FROM) {
+          rescan = true; // its files moved with it
+        } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          FilenamesSet created;
+          loadFilename_dir(created, aliasName, fullPathToLocalDir, subpath);
+          for (const auto &url : created) {
+            changes.emplace_back(url, true);
+          }
+        }
+        continue;
+      }
+
+      std::string url = aliasName + subpath;
+      while (url.size() && url[0] == '/') {
+        url.erase(0, 1);
+      }
+      cache->erase(url);
+      if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        changes.emplace_back(url, true);
+      } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        changes.emplace_back(url, false);
+      }
+    }
+
+    if (missingFiles != nullptr) {
+      for (const auto &change : changes) {
+        if (change.second) {
+          missingFiles->erase(change.first);
+        }
+      }
+    }
+
+    if (rescan) {
+      reload();
+    } else if (changes.size()) {
+      updateFilenames(changes);
+    }
+  }
+#endif
+}
+
+/**********************************************************************/
+
+bool LocalRepository::loadFilename_dir(FilenamesSet &filenames, const std::string &alias, const std::string &path,
+                                       const std::string &subpath, ParallelScan *parallel) {
+  GR_JUMP_TRACE;
+  struct dirent           *entry;
+  DIR                     *dir;
+  struct stat              s;
+  std::string              fullPath = path + subpath;
+  std::vector<std::string> found;
+
+  if (indexerStopping) {
+    return false;
+  }
 
+  watchDirectory(subpath); // before the scan, not to miss the files created meanwhile
   dir = opendir(fullPath.c_str());
   if (dir == nullptr) {
     return false;
@@ -73,29 +453,52 @@ bool LocalRepository::loadFilename_dir(const std::string &alias, const std::stri
       continue;
     }
 
-    std::string filepath = fullPath + '/' + entry->d_name;
-
-    if (stat(filepath.c_str(), &s) == -1) {
-      spdlog::error("LocalRepository - stat error reading file '{}': {}", filepath, strerror(errno));
+    // the type given by readdir saves a stat, the links are followed
+    int type;
+    if (entry->d_type == DT_REG) {
+      type = S_IFREG;
+    } else if (entry->d_type == DT_DIR) {
+      type = S_IFDIR;
+    } else if (fstatat(dirfd(dir), entry->d_name, &s, 0) == -1) {
+      spdlog::error("LocalRepository - stat error reading file '{}/{}': {}", fullPath, entry->d_name,
+                    strerror(errno));
       continue;
+    } else {
+      type = s.st_mode & S_IFMT;
     }
 
-    int type = s.st_mode & S_IFMT;
-    if (type == S_IFREG || type == S_IFLNK) {
+    if (type == S_IFREG) {
       std::string filename = alias + subpath + "/" + entry->d_name;
       while (filename.size() && filename[0] == '/') {
         filename.erase(0, 1);
       }
-      filenamesSet.insert(filename);
+      found.push_back(std::move(filename));
     }
 
     if (type == S_IFDIR) {
-      loadFilename_dir(alias, path, subpath + "/" + entry->d_name);
+      std::string dirSubpath = subpath + "/" + entry->d_name;
+      if (parallel != nullptr) {
+        parallel->pending.add();
+        parallel->pool.push([this, &filenames, &alias, &path, dirSubpath, parallel]() {
+          loadFilename_dir(filenames, alias, path, dirSubpath, parallel);
+          parallel->pending.done();
+        });
+      } else {
+        loadFilename_dir(filenames, alias, path, dirSubpath);
+      }
     }
   }
 
   closedir(dir);
 
+  if (parallel != nullptr) {
+    pthread_mutex_lock(&parallel->mutex);
+  }
+  filenames.insert(found.begin(), found.end());
+  if (parallel != nullptr) {
+    pthread_mutex_unlock(&parallel->mutex);
+  }
+
   return true;
 }
 
@@ -103,24 +506,73 @@ bool LocalRepository::loadFilename_dir(const std::string &alias, const std::stri
 
 bool LocalRepository::fileExist(const std::string &url) {
   GR_JUMP_TRACE;
-  return filenamesSet.find(url) != filenamesSet.end();
+  auto filenames = filenamesSet.read();
+  return filenames->find(url) != filenames->end();
+}
+
+/**********************************************************************/
+
+int LocalRepository::openBeneath(const std::string &relativePath) {
+  GR_JUMP_TRACE;
+  if (rootFd < 0) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  // one component at a time, from the root of the repository
+  int    dirFd = rootFd;
+  size_t start = 0;
+  for (;;) {
+    size_t      end       = relativePath.find('/', start);
+    std::string component = relativePath.substr(start, end == std::string::npos ? end : end - start);
+    int         fd        = -1;
+    if (component.empty() || component == "." || component == "..") {
+      errno = ENOENT;
+    } else {
+      fd = openat(dirFd, component.c_str(),
+                  end == std::string::npos ? O_RDONLY | O_NONBLOCK | O_CLOEXEC : DIRECTORY_OPEN_FLAGS);
+    }
+
+    int error = errno;
+    if (dirFd != rootFd) {
+      close(dirFd);
+    }
+    errno = error;
+
+    if (fd < 0 || end == std::string::npos) {
+      return fd;
+    }
+    dirFd = fd;
+    start = end + 1;
+  }
 }
 
 /**********************************************************************/
 
 bool LocalRepository::getFile(HttpRequest *request, HttpResponse *response) {
   GR_JUMP_TRACE;
-  std::string    url = request->getUrl();
-  size_t         webpageLen;
-  unsigned char *webpage;
-  pthread_mutex_lock(&_mutex);
+  std::string url  = request->getUrl();
+  bool        lazy = !indexed.load(std::memory_order_acquire);
 
-  if (url.compare(0, aliasName.size(), aliasName) || !fileExist(url)) {
-    pthread_mutex_unlock(&_mutex);
+  if (url.compare(0, aliasName.size(), aliasName)) {
     return false;
   };
 
-  pthread_mutex_unlock(&_mutex);
+  uint64_t missingGeneration = 0;
+  if (lazy) {
+    if (aliasName.size() && url.size() > aliasName.size() && url[aliasName.size()] != '/') {
+      return false;
+    }
+    if (missingFiles != nullptr) {
+      std::shared_ptr<const time_t> expiration = missingFiles->get(url);
+      if (expiration != nullptr && *expiration > time(nullptr)) {
+        return false;
+      }
+      missingGeneration = missingFiles->getGeneration();
+    }
+  } else if (!fileExist(url)) {
+    return false;
+  }
 
   std::string filename = url;
 
@@ -132,33 +584,87 @@ bool LocalRepository::getFile(HttpRequest *request, HttpResponse *response) {
     filename = fullPathToLocalDir + '/' + filename;
   }
 
-  FILE *pFile = fopen(filename.c_str(), "rb");
-  if (pFile == nullptr) {
-    GR_JUMP_TRACE;
-    spdlog::error("Webserver : Error opening file '{}'", filename);
-    return false;
+  // the directories are only all watched once indexed
+  uint64_t generation = 0;
+  if (cache != nullptr) {
+    std::shared_ptr<const FileContent> file = cache->get(url);
+    struct stat                        st;
+    if (file != nullptr &&
+        ((inotifyFd >= 0 && !lazy) || (stat(filename.c_str(), &st) == 0 && isSameFile(st, file->st)))) {
+      response->setContent(const_cast<unsigned char *>(file->data.data()), file->data.size());
+      response->setContentOwner(std::move(file));
+      return true;
+    }
+    generation = cache->getGeneration();
   }
 
-  // obtain file size.
-  fseek(pFile, 0, SEEK_END);
-  webpageLen = ftell(pFile);
-  rewind(pFile);
+  int fd;
+  if (lazy) {
+    size_t start = aliasName.size();
+    while (start < url.size() && url[start] == '/') {
+      start++;
+    }
+    fd = openBeneath(url.substr(start));
+  } else {
+    fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  }
 
-  if ((webpage = (unsigned char *)malloc(webpageLen + 1 * sizeof(char))) == nullptr) {
+  auto file = std::make_shared<FileContent>();
+  if (fd >= 0 && fstat(fd, &file->st) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd >= 0 && !S_ISREG(file->st.st_mode)) {
+    close(fd);
+    fd    = -1;
+    errno = EISDIR;
+  }
+
+  if (fd < 0) {
     GR_JUMP_TRACE;
-    // fclose( pFile ); // GLSR FIXME resource leak
+    if (lazy) {
+      if (missingFiles != nullptr && (errno == ENOENT || errno == ENOTDIR || errno == EISDIR)) {
+        missingFiles->put(url, std::make_shared<const time_t>(time(nullptr) + MISSING_FILES_TTL), 1,
+                          missingGeneration);
+      }
+    } else {
+      spdlog::error("Webserver : Error opening file '{}'", filename);
+    }
     return false;
   }
-  size_t nb = fread(webpage, 1, webpageLen, pFile);
-  if (nb != webpageLen) {
+
+  // large files not cached, and not compressed on the fly, are sent without being read
+  size_t size = file->st.st_size;
+  if (sendFileThreshold && size >= sendFileThreshold && (cache == nullptr || size > maxCachedFileSize) &&
+      (!request->acceptsEncoding("gzip") || !nvj_is_compressible_mime_type(response->getMimeType().c_str()))) {
+    response->setContentFile(fd, size);
+    return true;
+  }
+
+  file->data.resize(size);
+  size_t nb = 0;
+  while (nb < file->data.size()) {
+    ssize_t n = read(fd, file->data.data() + nb, file->data.size() - nb);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    nb += n;
+  }
+  close(fd);
+  if (nb != file->data.size()) {
     GR_JUMP_TRACE;
     spdlog::error("Webserver : Error accessing file '{}'", filename);
-    // free( webpage );
-    // fclose( pFile );
     return false;
   }
 
-  fclose(pFile);
-  response->setContent(webpage, webpageLen);
+  if (cache != nullptr && file->data.size() <= maxCachedFileSize) {
+    cache->put(url, file, file->data.size(), generation);
+  }
+
+  response->setContent(file->data.data(), file->data.size());
+  response->setContentOwner(std::move(file));
   return true;
 }
@@ -0,0 +1,383 @@
+//********************************************************
+/**
+ * @file  MemcachedAsyncClient.cc
+ *
+ * @brief Pipelined non-blocking memcached gets
+ *
+ * @version 1
+ * @date 18/10/26
+ */
+//********************************************************
+
+#include "libnavajo/MemcachedAsyncClient.hh"
+#include "libnavajo/GrDebug.hpp"
+#include "libnavajo/LogRecorder.hh"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MEMCACHED_MAX_KEY_LENGTH 250
+
+static int64_t nowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedAsyncClient::MemcachedAsyncClient(unsigned ioTimeout, unsigned retryTimeout)
+    : mIoTimeout(ioTimeout), mRetryTimeout(retryTimeout), mExiting(false) {
+  GR_JUMP_TRACE;
+  if (pipe2(mWakeup, O_NONBLOCK | O_CLOEXEC) < 0) {
+    throw std::runtime_error("MemcachedAsyncClient: pipe failed");
+  }
+  pthread_mutex_init(&mQueueMutex, nullptr);
+  if (pthread_create(&mThread, nullptr, startRoutine, this) != 0) {
+    close(mWakeup[0]);
+    close(mWakeup[1]);
+    pthread_mutex_destroy(&mQueueMutex);
+    throw std::runtime_error("MemcachedAsyncClient: can't start the I/O thread");
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedAsyncClient::~MemcachedAsyncClient() {
+  GR_JUMP_TRACE;
+  mExiting = true;
+  if (write(mWakeup[1], "x", 1) < 0) {
+    // the pipe is full: the thread is already awake
+  }
+  pthread_join(mThread, nullptr);
+  close(mWakeup[0]);
+  close(mWakeup[1]);
+  pthread_mutex_destroy(&mQueueMutex);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedAsyncClient::get(const std::string &host, int port, const std::string &key, Completion done) {
+  if (key.empty() || key.size() > MEMCACHED_MAX_KEY_LENGTH) {
+    return false;
+  }
+  for (unsigned char c : key) {
+    if (c <= ' ' || c == 0x7f) {
+      return false;
+    }
+  }
+
+  pthread_mutex_lock(&mQueueMutex);
+  bool wakeup = mQueue.empty();
+  mQueue.push_back(Request{host, port, key, std::move(done), nowMs() + mIoTimeout});
+  pthread_mutex_unlock(&mQueueMutex);
+  if (wakeup && write(mWakeup[1], "x", 1) < 0) {
+    // the pipe is full: the thread is already awake
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void *MemcachedAsyncClient::startRoutine(void *p) {
+  static_cast<MemcachedAsyncClient *>(p)->run();
+  return nullptr;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedAsyncClient::Server *MemcachedAsyncClient::server(const std::string &host, int port) {
+  std::unique_ptr<Server> &srv = mServers[host + ":" + std::to_string(port)];
+  if (srv == nullptr) {
+    srv.reset(new Server());
+    srv->host       = host;
+    srv->port       = port;
+    srv->fd         = -1;
+    srv->connecting = false;
+    srv->retryAt    = 0;
+    srv->outPos     = 0;
+    srv->valueSeen  = false;
+    srv->length     = 0;
+    srv->flags      = 0;
+  }
+  return srv.get();
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedAsyncClient::connect(Server *srv) {
+  struct addrinfo hints, *result = nullptr;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(srv->host.c_str(), std::to_string(srv->port).c_str(), &hints, &result) != 0) {
+    spdlog::warn("MemcachedAsyncClient: can't resolve {}", srv->host);
+    return false;
+  }
+
+  for (struct addrinfo *rp = result; rp != nullptr && srv->fd < 0; rp = rp->ai_next) {
+    int fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+      srv->fd = fd;
+    } else if (errno == EINPROGRESS) {
+      srv->fd         = fd;
+      srv->connecting = true;
+    } else {
+      close(fd);
+    }
+  }
+  freeaddrinfo(result);
+  if (srv->fd < 0) {
+    spdlog::warn("MemcachedAsyncClient: can't connect to {}:{}", srv->host, srv->port);
+  }
+  return srv->fd >= 0;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedAsyncClient::fail(Server *srv, int64_t now) {
+  if (srv->fd >= 0) {
+    close(srv->fd);
+  }
+  // an idle connection closed by the server is reopened at once
+  srv->retryAt    = srv->pending.empty() && !srv->connecting ? 0 : now + 1000 * (int64_t)mRetryTimeout;
+  srv->fd         = -1;
+  srv->connecting = false;
+  srv->out.clear();
+  srv->in.clear();
+  srv->outPos    = 0;
+  srv->valueSeen = false;
+  srv->data.reset();
+
+  std::deque<Request> pending;
+  pending.swap(srv->pending);
+  for (Request &request : pending) {
+    request.done(MEMCACHED_ASYNC_ERROR, nullptr, 0, 0);
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedAsyncClient::submit(Request &request, int64_t now) {
+  Server *srv = server(request.host, request.port);
+  if (srv->fd < 0) {
+    if (now < srv->retryAt) {
+      request.done(MEMCACHED_ASYNC_ERROR, nullptr, 0, 0);
+      return;
+    }
+    if (!connect(srv)) {
+      srv->retryAt = now + 1000 * (int64_t)mRetryTimeout;
+      request.done(MEMCACHED_ASYNC_ERROR, nullptr, 0, 0);
+      return;
+    }
+  }
+  srv->out += "get " + request.key + "\r\n";
+  srv->pending.push_back(std::move(request));
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedAsyncClient::writeSome(Server *srv) {
+  while (srv->outPos < srv->out.size()) {
+    ssize_t n = send(srv->fd, srv->out.data() + srv->outPos, srv->out.size() - srv->outPos, MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    srv->outPos += n;
+  }
+  srv->out.clear();
+  srv->outPos = 0;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedAsyncClient::readSome(Server *srv) {
+  char buf[65536];
+  for (;;) {
+    ssize_t n = recv(srv->fd, buf, sizeof buf, 0);
+    if (n == 0) {
+      return false;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+      break;
+    }
+    srv->in.append(buf, n);
+  }
+  return parse(srv);
+}
+
+// ----------------------------------------------------------------------
+// the responses, in the order of the requests:
+//   [VALUE <key> <flags> <bytes>[ <cas>]\r\n<data>\r\n]END\r\n
+//   or an error line
+// ----------------------------------------------------------------------
+bool MemcachedAsyncClient::parse(Server *srv) {
+  size_t pos = 0;
+  while (!srv->pending.empty()) {
+    size_t eol = srv->in.find("\r\n", pos);
+    if (eol == std::string::npos) {
+      break;
+    }
+    std::string line = srv->in.substr(pos, eol - pos);
+
+    if (line.compare(0, 6, "VALUE ") == 0) {
+      unsigned long flags, bytes;
+      if (sscanf(line.c_str() + 6, "%*s %lu %lu", &flags, &bytes) != 2) {
+        spdlog::warn("MemcachedAsyncClient: bad response from {}:{}", srv->host, srv->port);
+        return false;
+      }
+      if (srv->in.size() < eol + 2 + bytes + 2) {
+        break; // wait for the data
+      }
+      srv->data      = std::shared_ptr<char>((char *)malloc(bytes ? bytes : 1), ::free);
+      srv->length    = bytes;
+      srv->flags     = (uint32_t)flags;
+      srv->valueSeen = true;
+      memcpy(srv->data.get(), srv->in.data() + eol + 2, bytes);
+      pos = eol + 2 + bytes + 2;
+      continue;
+    }
+
+    Request request = std::move(srv->pending.front());
+    srv->pending.pop_front();
+    pos = eol + 2;
+    if (line == "END") {
+      if (srv->valueSeen) {
+        request.done(MEMCACHED_ASYNC_FOUND, std::move(srv->data), srv->length, srv->flags);
+      } else {
+        request.done(MEMCACHED_ASYNC_NOTFOUND, nullptr, 0, 0);
+      }
+    } else {
+      spdlog::warn("MemcachedAsyncClient: {}:{} answered '{}'", srv->host, srv->port, line);
+      request.done(MEMCACHED_ASYNC_ERROR, nullptr, 0, 0);
+    }
+    srv->valueSeen = false;
+    srv->data.reset();
+  }
+  srv->in.erase(0, pos);
+  return srv->in.empty() || !srv->pending.empty();
+}
+
+// ----------------------------------------------------------------------
+// I/O thread
+// ----------------------------------------------------------------------
+void MemcachedAsyncClient::run() {
+  std::vector<Request>       requests;
+  std::vector<struct pollfd> pfds;
+  std::vector<Server *>      polled;
+
+  while (!mExiting) {
+    int64_t now = nowMs();
+
+    pthread_mutex_lock(&mQueueMutex);
+    requests.swap(mQueue);
+    pthread_mutex_unlock(&mQueueMutex);
+    for (Request &request : requests) {
+      submit(request, now);
+    }
+    requests.clear();
+
+    pfds.assign(1, {mWakeup[0], POLLIN, 0});
+    polled.clear();
+    int64_t next = now + 1000;
+    for (auto &it : mServers) {
+      Server *srv = it.second.get();
+      if (!srv->pending.empty() && srv->pending.front().deadline <= now) {
+        spdlog::warn("MemcachedAsyncClient: {}:{} timed out", srv->host, srv->port);
+        fail(srv, now);
+      }
+      if (srv->fd < 0) {
+        continue;
+      }
+      short events = POLLIN;
+      if (srv->connecting || srv->outPos < srv->out.size()) {
+        events |= POLLOUT;
+      }
+      pfds.push_back({srv->fd, events, 0});
+      polled.push_back(srv);
+      if (!srv->pending.empty() && srv->pending.front().deadline < next) {
+        next = srv->pending.front().deadline;
+      }
+    }
+
+    if (poll(pfds.data(), pfds.size(), (int)(next > now ? next - now : 0)) < 0 && errno != EINTR) {
+      spdlog::error("MemcachedAsyncClient: poll failed: {}", strerror(errno));
+      break;
+    }
+    now = nowMs();
+
+    if (pfds[0].revents & POLLIN) {
+      char buf[256];
+      while (read(mWakeup[0], buf, sizeof buf) > 0)
+        ;
+    }
+
+    for (size_t i = 0; i < polled.size(); i++) {
+      Server *srv     = polled[i];
+      short   revents = pfds[i + 1].revents;
+      if (!revents) {
+        continue;
+      }
+      if (srv->connecting) {
+        int       err = 0;
+        socklen_t len = sizeof err;
+        if (getsockopt(srv->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+          spdlog::warn("MemcachedAsyncClient: can't connect to {}:{}: {}", srv->host, srv->port, strerror(err));
+          fail(srv, now);
+          continue;
+        }
+        srv->connecting = false;
+      }
+      if (((revents & POLLIN) && !readSome(srv)) || ((revents & (POLLERR | POLLHUP | POLLNVAL)) && !(revents & POLLIN))) {
+        fail(srv, now);
+        continue;
+      }
+      if (!writeSome(srv)) {
+        fail(srv, now);
+      }
+    }
+  }
+
+  // exiting: the requests still in progress fail
+  int64_t now = nowMs();
+  pthread_mutex_lock(&mQueueMutex);
+  requests.swap(mQueue);
+  pthread_mutex_unlock(&mQueueMutex);
+  for (Request &request : requests) {
+    request.done(MEMCACHED_ASYNC_ERROR, nullptr, 0, 0);
+  }
+  for (auto &it : mServers) {
+    fail(it.second.get(), now);
+  }
+}
@@ -4,39 +4,361 @@
 
 #include "libnavajo/MemcachedRepository.hh"
 #include "libnavajo/GrDebug.hpp"
+#include "libnavajo/LogRecorder.hh"
+#include "libnavajo/nvjGzip.h"
+#include "libnavajo/nvjMimeType.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-MemcachedRepository::MemcachedRepository(const std::string &prefix, const std::string &server, const int port)
-    : mPrefix(prefix), mServer(server), mPort(port) {
+MemcachedRepository::MemcachedRepository(const std::string &prefix, const std::string &server, const int port,
+                                         const size_t poolSize)
+    : MemcachedRepository(prefix, std::vector<MemcachedServer>{MemcachedServer(server, port)}, poolSize) {}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::MemcachedRepository(const std::string &prefix, const std::vector<MemcachedServer> &servers,
+                                         const size_t poolSize)
+    : mMemc(nullptr), mPool(nullptr), mPrefix(prefix), mServers(servers),
+      mCheckoutTimeout(MEMCACHED_DEFAULT_CHECKOUT_TIMEOUT), mIoTimeout(MEMCACHED_DEFAULT_IO_TIMEOUT),
+      mRetryTimeout(MEMCACHED_DEFAULT_RETRY_TIMEOUT), mLocalTtl(MEMCACHED_DEFAULT_L1_TTL),
+      mLocalNegativeTtl(MEMCACHED_DEFAULT_L1_NEGATIVE_TTL), mEarlyRefresh(MEMCACHED_DEFAULT_EARLY_REFRESH),
+      mRegenerationLease(0), mFlightsSweep(0), mCompressionMin(0), mCompressionLevel(MEMCACHED_DEFAULT_COMPRESSION_LEVEL),
+      mAsyncWait(0) {
   GR_JUMP_TRACE;
-  mMemCacheClient = std::make_shared<memcache::Memcache>(mServer, mPort);
+  pthread_mutex_init(&mFlightsMutex, nullptr);
+  mMemc = memcached_create(nullptr);
+  if (mMemc == nullptr) {
+    throw std::runtime_error("MemcachedRepository: memcached_create failed");
+  }
+  // weighted ketama: consistent hashing, the servers having weight times more points
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_KETAMA_WEIGHTED, 1);
+  for (const MemcachedServer &server : mServers) {
+    if (memcached_failed(memcached_server_add_with_weight(mMemc, server.host.c_str(), (in_port_t)server.port,
+                                                          server.weight ? server.weight : 1))) {
+      spdlog::error("MemcachedRepository: can't add the server {}:{}", server.host, server.port);
+    }
+  }
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_TCP_NODELAY, 1);
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, MEMCACHED_DEFAULT_CONNECT_TIMEOUT);
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, MEMCACHED_DEFAULT_IO_TIMEOUT);
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_RETRY_TIMEOUT, MEMCACHED_DEFAULT_RETRY_TIMEOUT);
+  // failing servers are ejected from the continuum until the retry timeout
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_SERVER_FAILURE_LIMIT, MEMCACHED_DEFAULT_FAILURE_LIMIT);
+  memcached_behavior_set(mMemc, MEMCACHED_BEHAVIOR_REMOVE_FAILED_SERVERS, 1);
+
+  // the connections are created on demand, up to poolSize
+  mPool = memcached_pool_create(mMemc, 1, poolSize ? poolSize : 1);
+  if (mPool == nullptr) {
+    memcached_free(mMemc);
+    throw std::runtime_error("MemcachedRepository: memcached_pool_create failed");
+  }
 }
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-bool MemcachedRepository::getFile(HttpRequest *request, HttpResponse *response) {
+MemcachedRepository::~MemcachedRepository() {
   GR_JUMP_TRACE;
-  std::string webpage;
+  mAsync.reset(); // its last completions use the local cache
+  memcached_pool_destroy(mPool);
+  memcached_free(mMemc);
+  pthread_mutex_destroy(&mFlightsMutex);
+}
 
-  if (!get(request->getUrl(), webpage)) {
-    return false;
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::Flight::Flight() : done(false), regenerating(false), deadline{0, 0} {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::AsyncFetch::AsyncFetch() : done(false), abandoned(false), status(MEMCACHED_ASYNC_ERROR), value() {
+  pthread_mutex_init(&mutex, nullptr);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::AsyncFetch::~AsyncFetch() {
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+int64_t MemcachedRepository::nowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::Connection::Connection(const MemcachedRepository &repo) : mPool(repo.mPool) {
+  struct timespec timeout;
+  timeout.tv_sec  = repo.mCheckoutTimeout / 1000;
+  timeout.tv_nsec = (repo.mCheckoutTimeout % 1000) * 1000000L;
+
+  memcached_return_t rc;
+  mMemc = memcached_pool_fetch(mPool, &timeout, &rc);
+  if (mMemc == nullptr) {
+    spdlog::warn("MemcachedRepository: no connection available: {}", memcached_strerror(nullptr, rc));
   }
+}
 
-  unsigned char *buffer = new unsigned char[webpage.size() + 1];
-  copy(webpage.begin(), webpage.end(), buffer);
-  response->setContent(buffer, webpage.size());
-  return true;
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+MemcachedRepository::Connection::~Connection() {
+  if (mMemc != nullptr) {
+    memcached_pool_release(mPool, mMemc);
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setTimeouts(unsigned connectTimeout, unsigned ioTimeout, unsigned checkoutTimeout) {
+  // applied to the connections of the pool as they are checked out
+  memcached_pool_behavior_set(mPool, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, connectTimeout);
+  memcached_pool_behavior_set(mPool, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, ioTimeout);
+  mCheckoutTimeout = checkoutTimeout;
+  mIoTimeout       = ioTimeout;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setRetryTimeout(unsigned seconds) {
+  memcached_pool_behavior_set(mPool, MEMCACHED_BEHAVIOR_RETRY_TIMEOUT, seconds);
+  mRetryTimeout = seconds;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setServerFailureLimit(unsigned failures) {
+  memcached_pool_behavior_set(mPool, MEMCACHED_BEHAVIOR_SERVER_FAILURE_LIMIT, failures);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setBinaryProtocol(bool binary) {
+  memcached_pool_behavior_set(mPool, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, binary ? 1 : 0);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setAsync(unsigned maxWait) {
+  GR_JUMP_TRACE;
+  mAsync.reset();
+  mAsyncWait = maxWait;
+  if (maxWait) {
+    mAsync.reset(new MemcachedAsyncClient(mIoTimeout, mRetryTimeout));
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setLocalCache(size_t maxSize, unsigned ttl, unsigned negativeTtl, unsigned shards) {
+  GR_JUMP_TRACE;
+  mLocalCache.clear();
+  mLocalTtl         = ttl;
+  mLocalNegativeTtl = negativeTtl;
+  if (!maxSize || !ttl) {
+    return;
+  }
+  shards = shards ? shards : 1;
+  for (unsigned i = 0; i < shards; i++) {
+    mLocalCache.emplace_back(new LocalCache(maxSize / shards));
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::setCompression(size_t minSize, int level) {
+  mCompressionMin   = minSize;
+  mCompressionLevel = level;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::invalidate(const std::string &url) {
+  LocalCache *shard = localCacheShard(url);
+  if (shard != nullptr) {
+    shard->erase(url);
+  }
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::land(const std::string &url, const std::shared_ptr<Flight> &flight,
+                               std::shared_ptr<const Value> value) {
+  // mFlightsMutex locked
+  flight->value = std::move(value);
+  flight->done  = true;
+  auto it       = mFlights.find(url);
+  if (it != mFlights.end() && it->second == flight) {
+    mFlights.erase(it);
+  }
+  pthread_cond_broadcast(&flight->cond);
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+void MemcachedRepository::sweepFlights(int64_t now) {
+  // mFlightsMutex locked
+  // the misses nobody regenerated: without waiters, they would stay forever
+  for (auto it = mFlights.begin(); it != mFlights.end();) {
+    if (it->second->isExpired(now)) {
+      it->second->done = true;
+      pthread_cond_broadcast(&it->second->cond);
+      it = mFlights.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  mFlightsSweep = now + mRegenerationLease;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+std::shared_ptr<const MemcachedRepository::Value> MemcachedRepository::lookup(const std::string &url) {
+  LocalCache                  *shard      = localCacheShard(url);
+  uint64_t                     generation = 0;
+  std::shared_ptr<const Value> cached; // still valid, refreshed early
+  if (shard != nullptr) {
+    std::shared_ptr<const Value> entry = shard->get(url);
+    int64_t                      now   = nowMs();
+    if (entry != nullptr && entry->expiration > now) {
+      // probabilistic early refresh (XFetch): now - delta * beta * ln(rand) >= expiration
+      static thread_local std::minstd_rand random(std::random_device{}());
+      double                               r = (double)random() / ((double)random.max() + 1);
+      if (!entry->found || mEarlyRefresh <= 0 ||
+          now - entry->delta * mEarlyRefresh * std::log(r) < (double)entry->expiration) {
+        return entry;
+      }
+      cached = std::move(entry);
+    }
+    generation = shard->getGeneration();
+  }
+
+  pthread_mutex_lock(&mFlightsMutex);
+  auto it = mFlights.find(url);
+  if (it != mFlights.end() && it->second->isExpired(nowMs())) {
+    // lease expired: memcached is asked again, it may have been set by another process
+    std::shared_ptr<Flight> expired = it->second;
+    land(url, expired, nullptr);
+    it = mFlights.end();
+  }
+  if (it != mFlights.end()) {
+    if (cached != nullptr) {
+      pthread_mutex_unlock(&mFlightsMutex);
+      return cached; // already being refreshed
+    }
+    // wait for the fetch in progress, or for the regeneration of the key
+    std::shared_ptr<Flight> flight = it->second;
+    int                     rc     = 0;
+    while (!flight->done && rc != ETIMEDOUT) {
+      rc = flight->regenerating ? pthread_cond_timedwait(&flight->cond, &mFlightsMutex, &flight->deadline)
+                                : pthread_cond_wait(&flight->cond, &mFlightsMutex);
+    }
+    if (!flight->done) {
+      land(url, flight, nullptr); // not regenerated in time: everyone goes on
+    }
+    std::shared_ptr<const Value> value = flight->value;
+    pthread_mutex_unlock(&mFlightsMutex);
+    return value;
+  }
+  if (mRegenerationLease && nowMs() >= mFlightsSweep) {
+    sweepFlights(nowMs());
+  }
+  auto flight    = std::make_shared<Flight>();
+  mFlights[url]  = flight;
+  pthread_mutex_unlock(&mFlightsMutex);
+
+  if (shard != nullptr) {
+    // a flight may have landed since the local cache was read
+    std::shared_ptr<const Value> entry = shard->get(url);
+    if (entry != nullptr && entry != cached && entry->expiration > nowMs()) {
+      pthread_mutex_lock(&mFlightsMutex);
+      land(url, flight, entry);
+      pthread_mutex_unlock(&mFlightsMutex);
+      return entry;
+    }
+  }
+
+  int64_t start    = nowMs();
+  auto    value    = std::make_shared<Value>();
+  bool    answered = mAsync != nullptr ? fetchAsync(url, *value, generation) : fetch(url, *value);
+  value->delta     = nowMs() - start;
+
+  if (answered && shard != nullptr && (value->found || (mLocalNegativeTtl && !mRegenerationLease))) {
+    value->expiration = nowMs() + 1000 * (int64_t)(value->found ? mLocalTtl : mLocalNegativeTtl);
+    shard->put(url, value, sizeof(Value) + url.size() + value->length, generation);
+  }
+
+  pthread_mutex_lock(&mFlightsMutex);
+  if (answered && !value->found && mRegenerationLease) {
+    // this request goes on to regenerate the key, the others wait for set()
+    int64_t deadline             = nowMs() + mRegenerationLease;
+    flight->deadline.tv_sec      = deadline / 1000;
+    flight->deadline.tv_nsec     = (deadline % 1000) * 1000000;
+    flight->regenerating         = true;
+    pthread_cond_broadcast(&flight->cond);
+  } else {
+    land(url, flight, answered ? value : cached); // memcached unavailable: the cached value if any
+  }
+  pthread_mutex_unlock(&mFlightsMutex);
+  return answered ? value : cached;
 }
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-void MemcachedRepository::freeFile(unsigned char *webpage) {
+bool MemcachedRepository::getFile(HttpRequest *request, HttpResponse *response) {
   GR_JUMP_TRACE;
-  ::free(webpage);
+  std::shared_ptr<const Value> value = lookup(request->getUrl());
+  if (value == nullptr || !value->found) {
+    return false;
+  }
+
+  // the buffer allocated by libmemcached is sent as is
+  response->setContent(reinterpret_cast<unsigned char *>(value->data.get()), value->length);
+  if (value->flags & MEMCACHED_FLAG_GZIP) {
+    response->setIsZipped(true);
+  }
+  response->setContentOwner(std::move(value));
+  return true;
 }
 
 // ----------------------------------------------------------------------
@@ -53,35 +375,282 @@ time_t MemcachedRepository::expiryTime(const time_t t) {
 //
 // ----------------------------------------------------------------------
 bool MemcachedRepository::set(const std::string &url, const std::string &value, time_t expiry, uint32_t flags) {
-  auto vec = std::vector<char>(value.begin(), value.end());
-  return mMemCacheClient->set(mPrefix + url, vec, expiryTime(expiry), flags);
+  return store(url, value.data(), value.size(), expiry, flags);
 }
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
 bool MemcachedRepository::set(const std::string &url, const std::vector<char> &vec, time_t expiry, uint32_t flags) {
-  return mMemCacheClient->set(mPrefix + url, vec, expiryTime(expiry), flags);
+  return store(url, vec.data(), vec.size(), expiry, flags);
 }
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-bool MemcachedRepository::get(const std::string &url, std::string &value) {
-  std::vector<char> vec;
-  if (mMemCacheClient->get(mPrefix + url, vec)) {
-    value = std::string{vec.begin(), vec.end()};
-    return true;
+bool MemcachedRepository::store(const std::string &url, const char *data, size_t length, time_t expiry,
+                                uint32_t flags) {
+  std::unique_ptr<unsigned char, void (*)(void *)> gzipped(nullptr, ::free);
+  if (mCompressionMin && length >= mCompressionMin && !(flags & MEMCACHED_FLAG_GZIP)) {
+    const char *mimeType = nvj_mime_type(url.c_str());
+    if (mimeType == nullptr || nvj_is_compressible_mime_type(mimeType)) {
+      unsigned char *dst  = nullptr;
+      size_t         size = 0;
+      try {
+        size = nvj_gzip(&dst, reinterpret_cast<const unsigned char *>(data), length, false, mCompressionLevel);
+        gzipped.reset(dst);
+      } catch (std::exception &e) {
+        spdlog::warn("MemcachedRepository: can't compress '{}': {}", url, e.what());
+      }
+      if (gzipped != nullptr && size < length) {
+        data   = reinterpret_cast<const char *>(gzipped.get());
+        length = size;
+        flags |= MEMCACHED_FLAG_GZIP;
+      }
+    }
+  }
+
+  std::string key = mPrefix + url;
+  bool        res = false;
+  {
+    Connection conn(*this);
+    if (conn.get() != nullptr) {
+      res = memcached_success(
+          memcached_set(conn.get(), key.data(), key.size(), data, length, expiryTime(expiry), flags));
+    }
+  }
+  invalidate(url);
+
+  // the requests waiting for the regeneration of the key get the new value
+  std::shared_ptr<Flight> flight;
+  pthread_mutex_lock(&mFlightsMutex);
+  auto it = mFlights.find(url);
+  if (res && it != mFlights.end() && it->second->regenerating) {
+    flight = it->second;
+  }
+  pthread_mutex_unlock(&mFlightsMutex);
+
+  if (flight != nullptr) {
+    auto value    = std::make_shared<Value>();
+    value->data   = std::shared_ptr<char>(new char[length ? length : 1], std::default_delete<char[]>());
+    value->length = length;
+    value->flags  = flags;
+    value->found  = true;
+    memcpy(value->data.get(), data, length);
+
+    pthread_mutex_lock(&mFlightsMutex);
+    if (!flight->done) {
+      land(url, flight, std::move(value));
+    }
+    pthread_mutex_unlock(&mFlightsMutex);
+  }
+  return res;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedRepository::fetch(const std::string &url, Value &value) {
+  Connection conn(*this);
+  if (conn.get() == nullptr) {
+    return false;
+  }
+  std::string        key = mPrefix + url;
+  memcached_return_t rc;
+  char *data  = memcached_get(conn.get(), key.data(), key.size(), &value.length, &value.flags, &rc);
+  value.data  = std::shared_ptr<char>(data, ::free);
+  value.found = data != nullptr || rc == MEMCACHED_SUCCESS; // nullptr for an empty value
+  if (data == nullptr) {
+    value.length = 0;
+    value.flags  = 0;
+  }
+  return value.found || rc == MEMCACHED_NOTFOUND;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedRepository::fetchAsync(const std::string &url, Value &value, uint64_t generation) {
+  // the server of the key, resolved on a connection of the pool: the master
+  // handle is shared, and only the connections see the failed servers ejected
+  std::string key = mPrefix + url, host;
+  in_port_t   port = 0;
+  {
+    Connection conn(*this);
+    if (conn.get() == nullptr) {
+      return false;
+    }
+    memcached_return_t rc;
+    auto               server = memcached_server_by_key(conn.get(), key.data(), key.size(), &rc);
+    if (server != nullptr) {
+      host = memcached_server_name(server);
+      port = memcached_server_port(server);
+    }
+  }
+  if (host.empty()) {
+    return fetch(url, value);
+  }
+
+  auto    pending = std::make_shared<AsyncFetch>();
+  int64_t start   = nowMs();
+  bool    sent    = mAsync->get(
+      host, port, key,
+      [this, url, generation, pending, start](MemcachedAsyncStatus status, std::shared_ptr<char> data, size_t length,
+                                               uint32_t flags) {
+        pthread_mutex_lock(&pending->mutex);
+        pending->status       = status;
+        pending->value.data   = data;
+        pending->value.length = length;
+        pending->value.flags  = flags;
+        pending->value.found  = status == MEMCACHED_ASYNC_FOUND;
+        pending->done         = true;
+        bool abandoned        = pending->abandoned;
+        pthread_cond_signal(&pending->cond);
+        pthread_mutex_unlock(&pending->mutex);
+
+        // too late for the request: kept for the next ones
+        LocalCache *shard = localCacheShard(url);
+        if (abandoned && status == MEMCACHED_ASYNC_FOUND && shard != nullptr) {
+          auto late        = std::make_shared<Value>();
+          late->data       = std::move(data);
+          late->length     = length;
+          late->flags      = flags;
+          late->found      = true;
+          late->delta      = nowMs() - start;
+          late->expiration = nowMs() + 1000 * (int64_t)mLocalTtl;
+          shard->put(url, late, sizeof(Value) + url.size() + length, generation);
+        }
+      });
+  if (!sent) {
+    return fetch(url, value); // a key the text protocol can't carry
+  }
+
+  int64_t         deadline = start + mAsyncWait;
+  struct timespec ts;
+  ts.tv_sec  = deadline / 1000;
+  ts.tv_nsec = (deadline % 1000) * 1000000;
+  int waited = 0;
+  pthread_mutex_lock(&pending->mutex);
+  while (!pending->done && waited != ETIMEDOUT) {
+    waited = pthread_cond_timedwait(&pending->cond, &pending->mutex, &ts);
+  }
+  bool failed   = pending->done && pending->status == MEMCACHED_ASYNC_ERROR;
+  bool answered = pending->done && !failed;
+  if (pending->done) {
+    value.data   = pending->value.data;
+    value.length = pending->value.length;
+    value.flags  = pending->value.flags;
+    value.found  = pending->value.found;
+  } else {
+    pending->abandoned = true;
+  }
+  pthread_mutex_unlock(&pending->mutex);
+  if (failed) {
+    return fetch(url, value); // counted as a failure of the server, ejected once over the limit
+  }
+  return answered;
+}
+
+// ----------------------------------------------------------------------
+//
+// ----------------------------------------------------------------------
+bool MemcachedRepository::remove(const std::string &url) {
+  std::string key = mPrefix + url;
+  bool        res = false;
+  {
+    Connection conn(*this);
+    if (conn.get() != nullptr) {
+      res = memcached_success(memcached_delete(conn.get(), key.data(), key.size(), 0));
+    }
   }
-  return false;
+  invalidate(url);
+  return res;
 }
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-bool MemcachedRepository::get(const std::string &url, std::vector<char> &vec) { return mMemCacheClient->get(mPrefix + url, vec); }
+bool MemcachedRepository::decode(const char *data, size_t length, uint32_t flags, std::string &value) {
+  if (!(flags & MEMCACHED_FLAG_GZIP)) {
+    value.assign(data, length);
+    return true;
+  }
+  unsigned char *raw = nullptr;
+  try {
+    size_t size = nvj_gunzip(&raw, reinterpret_cast<const unsigned char *>(data), length);
+    value.assign(reinterpret_cast<const char *>(raw), size);
+    free(raw);
+    return true;
+  } catch (std::exception &e) {
+    spdlog::error("MemcachedRepository: can't uncompress a value: {}", e.what());
+    return false;
+  }
+}
 
 // ----------------------------------------------------------------------
 //
 // ----------------------------------------------------------------------
-bool MemcachedRepository::remove(const std::string &url) { return mMemCacheClient->remove(mPrefix + url); }
+size_t MemcachedRepository::getMulti(const std::vector<std::string> &urls, std::map<std::string, std::string> &values) {
+  GR_JUMP_TRACE;
+  size_t nb = 0;
+
+  // the local cache first
+  std::vector<std::string>                  keys;
+  std::unordered_map<std::string, uint64_t> generations; // of the local cache, by key
+  for (const std::string &url : urls) {
+    LocalCache *shard = localCacheShard(url);
+    if (shard != nullptr) {
+      std::shared_ptr<const Value> cached = shard->get(url);
+      if (cached != nullptr && cached->expiration > nowMs()) {
+        if (cached->found) {
+          nb += decode(cached->data.get(), cached->length, cached->flags, values[url]);
+        }
+        continue;
+      }
+    }
+    keys.push_back(mPrefix + url);
+    generations[keys.back()] = shard != nullptr ? shard->getGeneration() : 0;
+  }
+  if (keys.empty()) {
+    return nb;
+  }
+
+  Connection conn(*this);
+  if (conn.get() == nullptr) {
+    return nb;
+  }
+  std::vector<const char *> keyPtrs;
+  std::vector<size_t>       keyLengths;
+  for (const std::string &key : keys) {
+    keyPtrs.push_back(key.data());
+    keyLengths.push_back(key.size());
+  }
+  memcached_return_t rc = memcached_mget(conn.get(), keyPtrs.data(), keyLengths.data(), keys.size());
+  if (memcached_failed(rc)) {
+    return nb;
+  }
+
+  memcached_result_st *result;
+  while ((result = memcached_fetch_result(conn.get(), nullptr, &rc)) != nullptr) {
+    std::string key(memcached_result_key_value(result), memcached_result_key_length(result));
+    if (key.compare(0, mPrefix.size(), mPrefix) == 0) {
+      std::string url    = key.substr(mPrefix.size());
+      size_t      length = memcached_result_length(result);
+      nb += decode(memcached_result_value(result), length, memcached_result_flags(result), values[url]);
+
+      LocalCache *shard = localCacheShard(url);
+      if (shard != nullptr) {
+        auto value        = std::make_shared<Value>();
+        value->data       = std::shared_ptr<char>(new char[length ? length : 1], std::default_delete<char[]>());
+        value->length     = length;
+        value->flags      = memcached_result_flags(result);
+        value->found      = true;
+        value->expiration = nowMs() + 1000 * (int64_t)mLocalTtl;
+        memcpy(value->data.get(), memcached_result_value(result), length);
+        shard->put(url, value, sizeof(Value) + url.size() + length, generations[key]);
+      }
+    }
+    memcached_result_free(result);
+  }
+  return nb;
+}
@@ -14,6 +14,9 @@
 //********************************************************
 
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include <cctype>
 #include <csignal>
@@ -34,12 +37,16 @@
 
 #include <libnavajo/HttpRequest.hh>
 
+#include "libnavajo/CompressionController.hh"
 #include "libnavajo/GrDebug.hpp"
 #include "libnavajo/WebServer.hh"
 #include "libnavajo/WebSocket.hh"
 #include "libnavajo/htonll.h"
 #include "libnavajo/nvjGzip.h"
+#include "libnavajo/nvjMimeType.h"
 #include "libnavajo/nvjSocket.h"
+#include "libnavajo/nvjUring.h"
+#include "libnavajo/nvjUrlDecode.h"
 
 #include "MPFDParser/Parser.h"
 
@@ -48,6 +55,7 @@
 #define LOGHIST_EXPIRATION_DELAY           600
 #define BUFSIZE                            32768
 #define KEEPALIVE_MAX_NB_QUERY             25
+#define DEFAULT_PARALLEL_GZIP_THRESHOLD    (1024 * 1024)
 
 const char                            WebServer::authStr[]       = "Authorization: Basic ";
 const char                            WebServer::authBearerStr[] = "Authorization: Bearer ";
@@ -55,16 +63,23 @@ const int                             WebServer::verify_depth    = 512;
 char                                 *WebServer::certpass        = nullptr;
 std::string                           WebServer::webServerName;
 pthread_mutex_t                       IpAddress::resolvIP_mutex = PTHREAD_MUTEX_INITIALIZER;
-HttpSession::HttpSessionsContainerMap HttpSession::sessions;
-pthread_mutex_t                       HttpSession::sessions_mutex     = PTHREAD_MUTEX_INITIALIZER;
+HttpSession::Shard                    HttpSession::shards[HTTP_SESSION_SHARDS];
 const std::string                     WebServer::base64_chars         = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                                                         "abcdefghijklmnopqrstuvwxyz"
                                                                         "0123456789+/";
 const std::string                     WebServer::webSocketMagicString = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
 std::map<unsigned, const char *> HttpResponse::mHttpReturnCodes;
-time_t                           HttpSession::lastExpirationSearchTime = 0;
+std::atomic<time_t>              HttpSession::lastExpirationSearchTime(0);
 time_t                           HttpSession::sessionLifeTime          = 20 * 60;
+std::vector<HttpSession::Timer>  HttpSession::wheel[HTTP_SESSION_WHEEL_SLOTS];
+pthread_mutex_t                  HttpSession::wheelMutex    = PTHREAD_MUTEX_INITIALIZER;
+time_t                           HttpSession::wheelTime     = 0;
+pthread_t                        HttpSession::reaperThread;
+std::atomic<unsigned>            HttpSession::reaperUsers(0);
+bool                             HttpSession::reaperExiting = false;
+pthread_mutex_t                  HttpSession::reaperMutex   = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t                   HttpSession::reaperCond    = PTHREAD_COND_INITIALIZER;
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
@@ -89,6 +104,8 @@ WebServer::WebServer() :
   socketTimeoutInSecond(DEFAULT_HTTP_SERVER_SOCKET_TIMEOUT),
   tcpPort(DEFAULT_HTTP_PORT),
   threadsPoolSize(64),
+  parallelGzipThreshold(DEFAULT_PARALLEL_GZIP_THRESHOLD),
+  ioUring(false),
   multipartMaxCollectedDataLength(20 * 1024),
   mIsSSLEnabled(false),
   mIsAuthPeerSSL(false)
@@ -338,44 +355,6 @@ size_t WebServer::recvLine(int client, char *bufLine, size_t nsize) {
   return bufLineLen;
 }
 
-/**********************************************************************/
-/**
- * trim from start, thanks to https://stackoverflow.com/a/217605
- */
-static inline std::string &ltrim(std::string &s) {
-  s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) { return !std::isspace(ch); }));
-  return s;
-}
-
-/**********************************************************************/
-/**
- * trim from end, thanks to https://stackoverflow.com/a/217605
- */
-static inline std::string &rtrim(std::string &s) {
-  s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) { return !std::isspace(ch); }).base(), s.end());
-  return s;
-}
-
-/**********************************************************************/
-/**
- * trim from both ends, thanks to https://stackoverflow.com/a/217605
- */
-static inline std::string &trim(std::string &s) { return ltrim(rtrim(s)); }
-
-/**********************************************************************/
-/**
- * fill extra http headers Map
- * @param c: raw string containing a header line made of "Header: Value"
- */
-static void addExtraHeader(const char *l, HttpRequestHeadersMap &m) {
-  std::stringstream ss(l);
-  std::string       header;
-  std::string       val;
-  if (std::getline(ss, header, ':') && std::getline(ss, val, ':')) {
-    m[header] = trim(val);
-  }
-};
-
 /***********************************************************************
  * accept_request:  Process a request
  * @param c - the socket connected to the client
@@ -399,7 +378,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
   char         *requestParams          = nullptr;
   char         *requestCookies         = nullptr;
   char         *requestOrigin          = nullptr;
-  HttpRequestHeadersMap requestExtraHeaders;
+  HttpRequestHeaders requestExtraHeaders;
   char         *webSocketClientKey     = nullptr;
   bool          websocket              = false;
   std::string   username;
@@ -412,6 +391,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
   bool        keepAlive   = false;
   bool        closing     = false;
   bool        isQueryStr  = false;
+  bool        busy        = false; // counted by the CompressionController from the request line to the response
   std::string authRespHeader;
 
   if (authBearerEnabled) {
@@ -422,6 +402,10 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
   do {
     GR_JUMP_TRACE;
     // Initialisation /////////
+    if (busy) {
+      CompressionController::getInstance()->workerIdle();
+      busy = false;
+    }
     requestMethod        = UNKNOWN_METHOD;
     requestContentLength = 0;
     urlencodedForm       = false;
@@ -429,6 +413,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
     keepAlive            = false;
     closing              = false;
     isQueryStr           = false;
+    requestExtraHeaders.clear();
 
     if (urlBuffer != nullptr) {
       GR_JUMP_TRACE;
@@ -525,6 +510,9 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
           j++;
         }
 
+        // keep all the header lines (the request line is rejected)
+        requestExtraHeaders.addLine(bufLine + j);
+
         // decode login/passwd
         if (strncmp(bufLine + j, authStr, sizeof authStr - 1) == 0) {
           GR_JUMP_TRACE;
@@ -647,7 +635,6 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
           continue;
         }
 
-        addExtraHeader(bufLine + j, requestExtraHeaders);
         isQueryStr = false;
         if (strncmp(bufLine + j, "GET", 3) == 0) {
           GR_JUMP_TRACE;
@@ -688,6 +675,10 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
 
         if (isQueryStr) {
           GR_JUMP_TRACE;
+          if (!busy) {
+            CompressionController::getInstance()->workerBusy();
+            busy = true;
+          }
           while (j < (unsigned)bufLineLen && isspace((int)(bufLine[j]))) {
             GR_JUMP_TRACE;
             j++;
@@ -774,34 +765,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
     }
 
     // Interpret '%' character
-    std::string urlString(urlBuffer);
-    size_t      start = 0, end = 0;
-
-    while ((end = urlString.find_first_of('%', start)) != std::string::npos) {
-      GR_JUMP_TRACE;
-      size_t len = urlString.length() - end - 1;
-      if (urlString[end] == '%' && len >= 1) {
-        GR_JUMP_TRACE;
-        if (urlString[end + 1] == '%') {
-          GR_JUMP_TRACE;
-          urlString = urlString.erase(end + 1, 1);
-        } else {
-          GR_JUMP_TRACE;
-          if (len >= 2) {
-            GR_JUMP_TRACE;
-            unsigned int      specar;
-            std::string       hexChar = urlString.substr(end + 1, 2);
-            std::stringstream ss;
-            ss << std::hex << hexChar.c_str();
-            ss >> specar;
-            urlString[end] = (char)specar;
-            urlString      = urlString.erase(end + 1, 2);
-          }
-        }
-      }
-      start = end + 1;
-    }
-    strcpy(urlBuffer, urlString.c_str());
+    urlBuffer[nvj_url_decode(urlBuffer, urlBuffer, strlen(urlBuffer), false)] = '\0';
 
 #ifdef DEBUG_TRACES
     char logBuffer[BUFSIZE];
@@ -944,7 +908,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
         }
 
         GR_JUMP_TRACE;
-        auto *request = new HttpRequest(requestMethod, urlBuffer, requestParams, requestCookies, requestExtraHeaders, requestOrigin,
+        auto *request = new HttpRequest(requestMethod, urlBuffer, requestParams, requestCookies, std::move(requestExtraHeaders), requestOrigin,
                                         username, clientSockData, mimeType, &payload, multipartContentParser);
 
         GR_JUMP_TRACE;
@@ -971,6 +935,9 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
         if (multipartContentParser != nullptr) {
           delete multipartContentParser;
         }
+        if (busy) {
+          CompressionController::getInstance()->workerIdle();
+        }
         GR_JUMP_TRACE;
         return false;
       } else {
@@ -994,7 +961,7 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
     bool           zippedFile  = false;
 
     GR_JUMP_TRACE;
-    HttpRequest request(requestMethod, urlBuffer, requestParams, requestCookies, requestExtraHeaders, requestOrigin, username,
+    HttpRequest request(requestMethod, urlBuffer, requestParams, requestCookies, std::move(requestExtraHeaders), requestOrigin, username,
                         clientSockData, mimeType, &payload, multipartContentParser);
 
     GR_JUMP_TRACE;
@@ -1042,8 +1009,9 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
       --repo;
       response.getContent(&webpage, &webpageLen, &zippedFile);
 
-      if (webpage == nullptr || !webpageLen) {
-        std::string msg = getHttpHeader(response.getHttpReturnCodeStr().c_str(), 0, false); // getNoContentErrorMsg();
+      if (response.getContentFd() < 0 && (webpage == nullptr || !webpageLen)) {
+        std::string msg = getHttpHeader(response.getHttpReturnCodeStr().c_str(), 0, false, nullptr, false,
+                                        &response); // getNoContentErrorMsg(), 304 Not Modified
         httpSend(clientSockData, (const void *)msg.c_str(), msg.length());
         if (webpage != nullptr) {
           (*repo)->freeFile(webpage);
@@ -1082,11 +1050,19 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
     }
 
     // Need to compress
-    if (!zippedFile && (clientSockData->compression == GZIP) && (webpageLen > 2048)) {
-      const char *mimetype = response.getMimeType().c_str();
-      if (mimetype != nullptr && (strncmp(mimetype, "application", 11) == 0 || strncmp(mimetype, "text", 4) == 0)) {
+    if (!zippedFile && (clientSockData->compression == GZIP) && response.getPrerenderedHeaders() == nullptr &&
+        response.getContentFd() < 0) {
+      CompressionController *compressionCtrl = CompressionController::getInstance();
+      int level = compressionCtrl->chooseLevel(webpageLen, response.getMimeType().c_str());
+      if (level != CompressionController::NO_COMPRESSION) {
         try {
-          if ((int)(sizeZip = nvj_gzip(&gzipWebPage, webpage, webpageLen)) < 0) {
+          if (parallelGzipThreshold && webpageLen >= parallelGzipThreshold) {
+            sizeZip = nvj_gzip_parallel(&gzipWebPage, webpage, webpageLen, level);
+          } else {
+            sizeZip = nvj_gzip(&gzipWebPage, webpage, webpageLen, false, level);
+          }
+          compressionCtrl->recordCompressed(webpageLen, sizeZip);
+          if (sizeZip < 0) {
             spdlog::error("Webserver: gunzip compression failed !");
             std::string msg = getInternalServerErrorMsg();
             httpSend(clientSockData, (const void *)msg.c_str(), msg.length());
@@ -1110,7 +1086,15 @@ bool WebServer::accept_request(ClientSockData *clientSockData, bool /*authSSL*/)
       closing = true;
     }
 
-    if (sizeZip > 0 && (clientSockData->compression == GZIP)) {
+    if (response.getContentFd() >= 0) {
+      std::string header =
+          getHttpHeader(response.getHttpReturnCodeStr().c_str(), webpageLen, keepAlive, nullptr, false, &response);
+      if (!httpSend(clientSockData, (const void *)header.c_str(), header.length()) ||
+          !httpSendFile(clientSockData, response.getContentFd(), webpageLen, ioUring)) {
+        spdlog::error("Webserver: httpSendFile failed sending the page: {}- err: {}", urlBuffer, strerror(errno));
+        closing = true;
+      }
+    } else if (sizeZip > 0 && (clientSockData->compression == GZIP)) {
       std::string header =
           getHttpHeader(response.getHttpReturnCodeStr().c_str(), sizeZip, keepAlive, nullptr, true, &response);
       if (!httpSend(clientSockData, (const void *)header.c_str(), header.length()) ||
@@ -1165,6 +1149,9 @@ FREE_RETURN_TRUE:
   if (multipartContentParser != nullptr) {
     delete multipartContentParser;
   }
+  if (busy) {
+    CompressionController::getInstance()->workerIdle();
+  }
 
   return true;
 }
@@ -1251,6 +1238,62 @@ bool WebServer::httpSend(ClientSockData *client, const void *buf, size_t len) {
   return totalSent == len;
 }
 
+/***********************************************************************
+ * httpSendFile - send the beginning of a file to the socket, without
+ *   copy if the connection is not encrypted
+ * @param client - the ClientSockData to use
+ * @param fd - the file descriptor
+ * @param len - the length to send
+ * @param useIoUring - splice through io_uring rather than sendfile()
+ * \return false if it's failed
+ ***********************************************************************/
+
+bool WebServer::httpSendFile(ClientSockData *client, int fd, size_t len, bool useIoUring) {
+  GR_JUMP_TRACE;
+  if (!client->socketId) {
+    return false;
+  }
+
+  off_t offset = 0;
+  if (client->bio == nullptr) {
+    NvjUring *ring = useIoUring ? NvjUring::forThread() : nullptr;
+    if (ring != nullptr) {
+      return ring->sendFile(client->socketId, fd, 0, len);
+    }
+#ifdef __linux__
+    while ((size_t)offset < len) {
+      ssize_t sent = sendfile(client->socketId, fd, &offset, len - offset);
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent <= 0) {
+        break;
+      }
+    }
+    if ((size_t)offset == len) {
+      return true;
+    }
+    if (offset > 0 || (errno != EINVAL && errno != ENOSYS)) {
+      return false;
+    }
+    // not supported by this file system: copied
+#endif
+  }
+
+  std::vector<unsigned char> buffer(len < 64 * 1024 ? len : 64 * 1024);
+  while ((size_t)offset < len) {
+    ssize_t n = pread(fd, buffer.data(), len - offset < buffer.size() ? len - offset : buffer.size(), offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0 || !httpSend(client, buffer.data(), n)) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
 /***********************************************************************
  * fatalError:  Print out a system error and exit
  * @param s - error message
@@ -1270,121 +1313,7 @@ void WebServer::fatalError(const char *s) {
 
 const char *WebServer::get_mime_type(const char *name) {
   GR_JUMP_TRACE;
-  char *ext = strrchr(const_cast<char *>(name), '.');
-  if (!ext) {
-    return nullptr;
-  }
-
-  char     extLowerCase[6];
-  unsigned i = 0;
-  for (; i < 5 && i < strlen(ext); i++) {
-    extLowerCase[i] = ext[i];
-    if ((extLowerCase[i] >= 'A') && (extLowerCase[i] <= 'Z')) {
-      extLowerCase[i] += 'a' - 'A';
-    }
-  }
-  extLowerCase[i] = '\0';
-
-  if (strcmp(extLowerCase, ".html") == 0 || strcmp(extLowerCase, ".htm") == 0) {
-    return "text/html";
-  }
-  if (strcmp(extLowerCase, ".js") == 0) {
-    return "application/javascript";
-  }
-  if (strcmp(extLowerCase, ".json") == 0) {
-    return "application/json";
-  }
-  if (strcmp(extLowerCase, ".xml") == 0) {
-    return "application/xml";
-  }
-  if (strcmp(extLowerCase, ".jpg") == 0 || strcmp(extLowerCase, ".jpeg") == 0) {
-    return "image/jpeg";
-  }
-  if (strcmp(extLowerCase, ".gif") == 0) {
-    return "image/gif";
-  }
-  if (strcmp(extLowerCase, ".png") == 0) {
-    return "image/png";
-  }
-  if (strcmp(extLowerCase, ".css") == 0) {
-    return "text/css";
-  }
-  if (strcmp(extLowerCase, ".txt") == 0) {
-    return "text/plain";
-  }
-  if (strcmp(extLowerCase, ".svg") == 0 || strcmp(extLowerCase, ".svgz") == 0) {
-    return "image/svg+xml";
-  }
-  if (strcmp(extLowerCase, ".cache") == 0) {
-    return "text/cache-manifest";
-  }
-
-  // ----------------------------------------------------------------------
-  // Fontes
-  // ----------------------------------------------------------------------
-  if (strcmp(extLowerCase, ".otf") == 0) {
-    return "font/otf";
-  }
-  if (strcmp(extLowerCase, ".eot") == 0) {
-    return "font/eot";
-  }
-  if (strcmp(extLowerCase, ".ttf") == 0) {
-    return "font/ttf";
-  }
-  if (strcmp(extLowerCase, ".woff") == 0) {
-    return "font/woff";
-  }
-  if (strcmp(extLowerCase, ".woff2") == 0) {
-    return "font/woff2";
-  }
-
-  if (strcmp(extLowerCase, ".au") == 0) {
-    return "audio/basic";
-  }
-  if (strcmp(extLowerCase, ".wav") == 0) {
-    return "audio/wav";
-  }
-  if (strcmp(extLowerCase, ".avi") == 0) {
-    return "video/x-msvideo";
-  }
-  if (strcmp(extLowerCase, ".mpeg") == 0 || strcmp(extLowerCase, ".mpg") == 0) {
-    return "video/mpeg";
-  }
-  if (strcmp(extLowerCase, ".mp3") == 0) {
-    return "audio/mpeg";
-  }
-  if (strcmp(extLowerCase, ".csv") == 0) {
-    return "text/csv";
-  }
-  if (strcmp(extLowerCase, ".mp4") == 0) {
-    return "application/mp4";
-  }
-  if (strcmp(extLowerCase, ".bin") == 0) {
-    return "application/octet-stream";
-  }
-  if (strcmp(extLowerCase, ".doc") == 0 || strcmp(extLowerCase, ".docx") == 0) {
-    return "application/msword";
-  }
-  if (strcmp(extLowerCase, ".pdf") == 0) {
-    return "application/pdf";
-  }
-  if (strcmp(extLowerCase, ".ps") == 0 || strcmp(extLowerCase, ".eps") == 0 || strcmp(extLowerCase, ".ai") == 0) {
-    return "application/postscript";
-  }
-  if (strcmp(extLowerCase, ".tar") == 0) {
-    return "application/x-tar";
-  }
-  if (strcmp(extLowerCase, ".h264") == 0) {
-    return "video/h264";
-  }
-  if (strcmp(extLowerCase, ".dv") == 0) {
-    return "video/dv";
-  }
-  if (strcmp(extLowerCase, ".qt") == 0 || strcmp(extLowerCase, ".mov") == 0) {
-    return "video/quicktime";
-  }
-
-  return nullptr;
+  return nvj_mime_type(name);
 }
 
 /***********************************************************************
@@ -1451,6 +1380,12 @@ std::string WebServer::getHttpHeader(const char *messageType, const size_t len,
     header += "Connection: close\r\n";
   }
 
+  if (response != nullptr && response->getPrerenderedHeaders() != nullptr) {
+    header += response->getPrerenderedHeaders();
+    header += "\r\n";
+    return header;
+  }
+
   std::string mimetype = "text/html";
   if (response != nullptr) {
     mimetype = response->getMimeType();
@@ -1927,6 +1862,7 @@ void WebServer::poolThreadProcessing() {
       freeClientSockData(clientSockData);
     }
   }
+  CompressionController::getInstance()->removeWorkers(1);
   pthread_mutex_lock(&clientsQueue_mutex);
   exitedThread++;
   pthread_mutex_unlock(&clientsQueue_mutex);
@@ -1939,6 +1875,7 @@ void WebServer::poolThreadProcessing() {
 void WebServer::initPoolThreads() {
   GR_JUMP_TRACE;
   pthread_t newthread;
+  CompressionController::getInstance()->addWorkers(threadsPoolSize);
   for (unsigned i = 0; i < threadsPoolSize; i++) {
     create_thread(&newthread, WebServer::startPoolThread, static_cast<void *>(this));
     usleep(500);
@@ -1978,6 +1915,7 @@ void WebServer::threadProcessing() {
   ushort port = init();
 
   initPoolThreads();
+  HttpSession::startReaper();
   httpdAuth = authLoginPwdList.size();
 
   spdlog::info("WebServer listen on port {}", port);
@@ -2068,6 +2006,7 @@ void WebServer::threadProcessing() {
     pthread_cond_broadcast(&clientsQueue_cond);
     usleep(500);
   }
+  HttpSession::stopReaper();
 
   // Exiting...
   free(pfd);
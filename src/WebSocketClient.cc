@@ -12,6 +12,7 @@
  */
 //********************************************************
 
+#include "libnavajo/CompressionController.hh"
 #include "libnavajo/GrDebug.hpp"
 #include "libnavajo/WebServer.hh"
 #include "libnavajo/WebSocket.hh"
@@ -28,7 +29,8 @@ WebSocketClient::WebSocketClient(WebSocket *ws, HttpRequest *req) : mWebsocket(w
   pthread_mutex_init(&sendingQueueMutex, nullptr);
   pthread_cond_init(&sendingNotification, nullptr);
   gzipcontext.dictInfLength = 0;
-  nvj_init_stream(&(gzipcontext.strm_deflate), true);
+  gzipcontext.level         = Z_BEST_COMPRESSION;
+  nvj_init_stream(&(gzipcontext.strm_deflate), true, gzipcontext.level);
   noSessionExpiration(mRequest);
   startWebSocketThreads();
 }
@@ -381,15 +383,26 @@ bool WebSocketClient::sendMessage(const MessageContent *msgContent) {
     return false;
   }
 
+  // control frames (opcode >= 0x8) are never compressed
+  int level = CompressionController::NO_COMPRESSION;
+  if (client->compression == ZLIB && !(msgContent->opcode & 0x8)) {
+    level = CompressionController::getInstance()->chooseMessageLevel(msgContent->length);
+  }
+
   headerBuffer[0] = 0x80 | (msgContent->opcode & 0xf); // FIN & OPCODE:0x1
-  if (client->compression == ZLIB) {
+  if (level != CompressionController::NO_COMPRESSION) {
     headerBuffer[0] |= 0x40; // Set RSV1
     try {
+      if (level != gzipcontext.level) {
+        nvj_stream_set_level(&(gzipcontext.strm_deflate), level);
+        gzipcontext.level = level;
+      }
       msgLen = nvj_gzip_websocket_v2(&msg, msgContent->message, msgContent->length, &(gzipcontext.strm_deflate));
     } catch (...) {
       spdlog::error("Websocket: nvj_gzip raised an exception");
       return false;
     }
+    CompressionController::getInstance()->recordCompressed(msgContent->length, msgLen);
   } else {
     msg    = msgContent->message;
     msgLen = msgContent->length;
@@ -413,7 +426,7 @@ bool WebSocketClient::sendMessage(const MessageContent *msgContent) {
     result = false;
   }
 
-  if (client->compression == ZLIB) {
+  if (level != CompressionController::NO_COMPRESSION) {
     free(msg);
   }
 
@@ -12,31 +12,56 @@
 //********************************************************
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
 #include <iostream>
+#include <map>
+#include <openssl/evp.h>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
 #include "libnavajo/GrDebug.hpp"
+#include "libnavajo/nvjBundle.h"
+#include "libnavajo/nvjGzip.h"
+#include "libnavajo/nvjMimeType.h"
+#include "libnavajo/nvjPerfectHash.h"
 
-void dump_buffer(FILE *f, unsigned n, const unsigned char *buf) {
+void dump_buffer(FILE *f, size_t n, const unsigned char *buf) {
   GR_JUMP_TRACE;
-  int cptLine = 0;
+  static const char hex[] = "0123456789ABCDEF";
+  char              line[16 * 6 + 8];
+
   fputs("    ", f);
-  while (n-- > 0) {
-    cptLine++;
-    fprintf(f, "0x%02X", *buf++);
-    if (n > 0) {
-      fprintf(f, ", ");
+  while (n > 0) {
+    // one line of 16 bytes "0xXX, " formatted at once
+    size_t len = 0;
+    for (int cptLine = 0; cptLine < 16 && n > 0; cptLine++, n--) {
+      line[len++] = '0';
+      line[len++] = 'x';
+      line[len++] = hex[*buf >> 4];
+      line[len++] = hex[*buf++ & 0xF];
+      if (n > 1) {
+        line[len++] = ',';
+        line[len++] = ' ';
+      }
     }
-    if (cptLine == 16) {
-      fputs("\n    ", f);
-      cptLine = 0;
+    if (n > 0) {
+      memcpy(line + len, "\n    ", 5);
+      len += 5;
     }
+    fwrite(line, 1, len, f);
   }
 }
 
@@ -64,14 +89,37 @@ char *str_replace_first(char *buffer, const char *s, const char *by) {
 }
 
 typedef struct {
-  std::string *URL;
-  std::string *varName;
-  size_t       length;
+  std::string                URL;
+  std::string                varName;
+  std::string                etag;
+  std::vector<unsigned char> content;
 } ConversionEntry;
 
+typedef struct {
+  std::string                name;
+  int                        file;     // index of the plain file, -1 if none
+  int                        gzipFile; // index of the gzip version, -1 if none
+  std::vector<unsigned char> gzip;     // generated gzip version, empty if none
+  std::vector<unsigned char> brotli;   // generated brotli version, empty if none
+} AssetEntry;
+
+typedef struct {
+  const std::vector<unsigned char> *content; // nullptr if the version doesn't exist
+  const char                       *encoding;
+  std::string                       headers;
+} VariantEntry;
+
+typedef enum { HEX_OUTPUT, ASM_OUTPUT, EMBED_OUTPUT, BUNDLE_OUTPUT } OutputMode;
+
 std::vector<std::string> filenamesVec;
 std::vector<std::string> listExcludeDir;
 
+OutputMode            outputMode = HEX_OUTPUT;
+FILE                 *asmFile = nullptr, *asmDataFile = nullptr;
+std::string           asmFilename, asmDataFilename, bundleFilename;
+size_t                asmDataOffset = 0;
+std::set<std::string> varNames;
+
 /**********************************************************************/
 
 bool loadFilename_dir(const std::string &path, const std::string &subpath = "") {
@@ -134,6 +182,408 @@ void parseDirectory(const std::string &dirPath) {
   }
 }
 
+/**********************************************************************/
+/**
+ * quoted strong ETag: sha1 of the content
+ */
+std::string computeEtag(const unsigned char *buf, size_t len) {
+  GR_JUMP_TRACE;
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int  digestLen = 0;
+
+  if (EVP_Digest(buf, len, digest, &digestLen, EVP_sha1(), nullptr) != 1) {
+    fprintf(stderr, "ERROR: sha1 computation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  std::string etag = "\"";
+  char        hex[3];
+  for (unsigned int i = 0; i < digestLen; i++) {
+    snprintf(hex, sizeof hex, "%02x", digest[i]);
+    etag += hex;
+  }
+  return etag + "\"";
+}
+
+/**********************************************************************/
+/**
+ * escape a string for a C string literal
+ */
+std::string cString(const std::string &s) {
+  GR_JUMP_TRACE;
+  std::string res;
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\') {
+      res += '\\';
+      res += (char)c;
+    } else if (c == '\r') {
+      res += "\\r";
+    } else if (c == '\n') {
+      res += "\\n";
+    } else if (c < 0x20 || c >= 0x7f) {
+      char oct[5];
+      snprintf(oct, sizeof oct, "\\%03o", c);
+      res += oct;
+    } else {
+      res += (char)c;
+    }
+  }
+  return res;
+}
+
+/**********************************************************************/
+/**
+ * escape a path for a .incbin or #embed directive
+ */
+std::string quotedPath(const std::string &path) {
+  GR_JUMP_TRACE;
+  std::string res = "\"";
+  for (char c : path) {
+    if (c == '"' || c == '\\') {
+      res += '\\';
+    }
+    res += c;
+  }
+  return res + '"';
+}
+
+/**********************************************************************/
+/**
+ * write the assembler prologue: NVJ_ASSET(symbol, "path"[, skip, count])
+ * defines a global read-only symbol holding the content of the file
+ */
+void asmPrologue(FILE *f) {
+  GR_JUMP_TRACE;
+  fputs("/* generated by navajoPrecompiler --asm, assemble with the C preprocessor (.S) */\n\n"
+        "#if defined(__APPLE__)\n"
+        "#define NVJ_ASSET(sym, ...) \\\n"
+        "  .const_data; .globl _##sym; .p2align 4; _##sym: .incbin __VA_ARGS__\n"
+        "#else\n"
+        "#define NVJ_ASSET(sym, ...) \\\n"
+        "  .section .rodata; .globl sym; .hidden sym; .type sym, \"object\"; .balign 16; \\\n"
+        "  sym: .incbin __VA_ARGS__; .size sym, . - sym\n"
+        "#endif\n\n",
+        f);
+}
+
+void asmEpilogue(FILE *f) {
+  GR_JUMP_TRACE;
+  fputs("\n#if defined(__linux__) && defined(__ELF__)\n"
+        ".section .note.GNU-stack, \"\", %progbits\n"
+        "#endif\n",
+        f);
+}
+
+/**********************************************************************/
+/**
+ * write a content in the current output mode
+ * @param name: the base of the identifier
+ * @param path: the file holding the content, empty for a generated content
+ * @return the identifier of the content, "nullptr" if empty
+ */
+std::string emitContent(const std::string &name, const std::vector<unsigned char> &content, const std::string &path) {
+  GR_JUMP_TRACE;
+  if (content.empty()) {
+    return "nullptr";
+  }
+
+  std::string varName = name;
+  for (char &c : varName) {
+    if (!isalnum((unsigned char)c)) {
+      c = '_';
+    }
+  }
+  if (isdigit((unsigned char)varName[0])) {
+    varName = "_" + varName;
+  }
+  if (outputMode == ASM_OUTPUT) {
+    varName = "nvj_precompiled_" + varName; // global symbol
+  }
+  for (int n = 2; !varNames.insert(varName).second; n++) {
+    varName += '_' + std::to_string(n);
+  }
+
+  if (outputMode == ASM_OUTPUT) {
+    if (path.size()) {
+      fprintf(asmFile, "NVJ_ASSET(%s, %s)\n", varName.c_str(), quotedPath(path).c_str());
+    } else {
+      // generated contents are gathered in a single data file
+      if (fwrite(content.data(), 1, content.size(), asmDataFile) != content.size()) {
+        fprintf(stderr, "ERROR: can't write file: %s\n", asmDataFilename.c_str());
+        exit(EXIT_FAILURE);
+      }
+      fprintf(asmFile, "NVJ_ASSET(%s, %s, %zu, %zu)\n", varName.c_str(), quotedPath(asmDataFilename).c_str(),
+              asmDataOffset, content.size());
+      asmDataOffset += content.size();
+    }
+    fprintf(stdout, "  extern \"C\" const unsigned char %s[%zu];\n", varName.c_str(), content.size());
+  } else if (outputMode == EMBED_OUTPUT && path.size()) {
+    fprintf(stdout, "  static const unsigned char %s[] =\n", varName.c_str());
+    fprintf(stdout, "  {\n#embed %s\n  };\n\n", quotedPath(path).c_str());
+  } else {
+    fprintf(stdout, "  static const unsigned char %s[] =\n", varName.c_str());
+    fprintf(stdout, "  {\n");
+    dump_buffer(stdout, content.size(), content.data());
+    fprintf(stdout, "\n  };\n\n");
+  }
+
+  return varName;
+}
+
+/**********************************************************************/
+/**
+ * compress with gzip and brotli at their maximum level
+ * @return the compressed content, empty if not smaller than maxSize
+ */
+std::vector<unsigned char> gzipContent(const std::vector<unsigned char> &content, size_t maxSize) {
+  GR_JUMP_TRACE;
+  unsigned char *buf;
+  size_t         len = nvj_gzip(&buf, content.data(), content.size(), false, Z_BEST_COMPRESSION);
+
+  std::vector<unsigned char> res;
+  if (len < maxSize) {
+    res.assign(buf, buf + len);
+  }
+  free(buf);
+  return res;
+}
+
+std::vector<unsigned char> brotliContent(const std::vector<unsigned char> &content, size_t maxSize, bool text) {
+  GR_JUMP_TRACE;
+  std::vector<unsigned char> res;
+#ifdef HAVE_BROTLI
+  size_t len = BrotliEncoderMaxCompressedSize(content.size());
+  if (!len) {
+    return res;
+  }
+  res.resize(len);
+  if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_MAX_WINDOW_BITS, text ? BROTLI_MODE_TEXT : BROTLI_MODE_GENERIC,
+                             content.size(), content.data(), &len, res.data())) {
+    throw std::runtime_error("brotli : compression failed");
+  }
+  res.resize(len < maxSize ? len : 0);
+#else
+  (void)content;
+  (void)maxSize;
+  (void)text;
+#endif
+  return res;
+}
+
+/**********************************************************************/
+/**
+ * headers of a variant, sent as is by the server
+ */
+std::string renderHeaders(const char *mime, size_t length, const char *encoding, const std::string &etag,
+                          bool vary) {
+  GR_JUMP_TRACE;
+  std::string headers = std::string("Content-Type: ") + (mime != nullptr ? mime : "application/octet-stream") + "\r\n";
+  headers += "Content-Length: " + std::to_string(length) + "\r\n";
+  if (encoding != nullptr) {
+    headers += std::string("Content-Encoding: ") + encoding + "\r\n";
+  }
+  headers += "ETag: " + etag + "\r\n";
+  if (vary) {
+    headers += "Vary: Accept-Encoding\r\n";
+  }
+  return headers;
+}
+
+/**********************************************************************/
+/**
+ * identity, gzip and brotli versions of a file, with their headers
+ */
+void getVariants(const AssetEntry &asset, const std::vector<ConversionEntry> &conversionTable,
+                 VariantEntry variants[NVJ_BUNDLE_NB_VARIANTS]) {
+  GR_JUMP_TRACE;
+  const ConversionEntry *plain = asset.file >= 0 ? &conversionTable[asset.file] : nullptr;
+  const ConversionEntry *gzip  = asset.gzipFile >= 0 ? &conversionTable[asset.gzipFile] : nullptr;
+  const char            *mime  = nvj_mime_type(asset.name.c_str());
+  const std::string     &etag  = (plain != nullptr ? plain : gzip)->etag;
+
+  variants[NVJ_BUNDLE_IDENTITY] = {plain != nullptr ? &plain->content : nullptr, nullptr, ""};
+  variants[NVJ_BUNDLE_GZIP]     = {gzip != nullptr ? &gzip->content : &asset.gzip, "gzip", ""};
+  variants[NVJ_BUNDLE_BROTLI]   = {&asset.brotli, "br", ""};
+
+  int nbVariants = 0;
+  for (int i = 0; i < NVJ_BUNDLE_NB_VARIANTS; i++) {
+    if (variants[i].content != nullptr && variants[i].content->empty()) {
+      variants[i].content = nullptr;
+    }
+    nbVariants += variants[i].content != nullptr;
+  }
+
+  for (int i = 0; i < NVJ_BUNDLE_NB_VARIANTS; i++) {
+    if (variants[i].content == nullptr) {
+      continue;
+    }
+    std::string variantEtag = etag;
+    if (i != NVJ_BUNDLE_IDENTITY) {
+      variantEtag.insert(variantEtag.size() - 1, i == NVJ_BUNDLE_GZIP ? "-gz" : "-br");
+    }
+    variants[i].headers =
+        renderHeaders(mime, variants[i].content->size(), variants[i].encoding, variantEtag, nbVariants > 1);
+  }
+}
+
+/**********************************************************************/
+/**
+ * write a bundle file (see nvjBundle.h), replaced atomically
+ */
+void writeBundle(const std::string &path, const std::vector<ConversionEntry> &conversionTable,
+                 const std::vector<AssetEntry> &assets, const std::vector<uint32_t> &seeds,
+                 const std::vector<size_t> &slots) {
+  GR_JUMP_TRACE;
+  auto align = [](uint64_t offset, uint64_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+
+  std::string strings(1, '\0'); // offset 0: the empty string
+  auto        addString = [&strings](const std::string &str, uint32_t &offset, uint32_t &length) {
+    offset = str.empty() ? 0 : strings.size();
+    length = str.size();
+    if (!str.empty()) {
+      strings += str;
+      strings += '\0';
+    }
+  };
+
+  NvjBundleHeader header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, NVJ_BUNDLE_MAGIC, sizeof NVJ_BUNDLE_MAGIC);
+  header.version       = NVJ_BUNDLE_VERSION;
+  header.byteOrder     = NVJ_BUNDLE_BYTE_ORDER;
+  header.nbEntries     = slots.size();
+  header.nbBuckets     = seeds.size();
+  header.seedsOffset   = sizeof header;
+  header.entriesOffset = align(header.seedsOffset + seeds.size() * sizeof(uint32_t), alignof(NvjBundleEntry));
+  header.stringsOffset = header.entriesOffset + slots.size() * sizeof(NvjBundleEntry);
+
+  std::vector<NvjBundleEntry> entries(slots.size());
+  std::vector<std::pair<const std::vector<unsigned char> *, uint64_t *>> blobs;
+  memset(entries.data(), 0, entries.size() * sizeof(NvjBundleEntry));
+
+  for (size_t i = 0; i < slots.size(); i++) {
+    const AssetEntry &asset = assets[slots[i]];
+    const char       *mime  = nvj_mime_type(asset.name.c_str());
+    VariantEntry      variants[NVJ_BUNDLE_NB_VARIANTS];
+    getVariants(asset, conversionTable, variants);
+
+    addString(asset.name, entries[i].nameOffset, entries[i].nameLength);
+    addString(mime != nullptr ? mime : "", entries[i].mimeOffset, entries[i].mimeLength);
+    addString((asset.file >= 0 ? conversionTable[asset.file] : conversionTable[asset.gzipFile]).etag,
+              entries[i].etagOffset, entries[i].etagLength);
+    for (int v = 0; v < NVJ_BUNDLE_NB_VARIANTS; v++) {
+      if (variants[v].content != nullptr) {
+        entries[i].variants[v].length = variants[v].content->size();
+        addString(variants[v].headers, entries[i].variants[v].headersOffset, entries[i].variants[v].headersLength);
+        blobs.emplace_back(variants[v].content, &entries[i].variants[v].offset);
+      }
+    }
+  }
+  header.stringsLength = strings.size();
+
+  // blobs: from a page boundary, the ones of a page or more page-aligned
+  uint64_t offset = align(header.stringsOffset + header.stringsLength, NVJ_BUNDLE_PAGE_SIZE);
+  for (auto &blob : blobs) {
+    offset        = align(offset, blob.first->size() >= NVJ_BUNDLE_PAGE_SIZE ? NVJ_BUNDLE_PAGE_SIZE : 16);
+    *blob.second  = offset;
+    offset       += blob.first->size();
+  }
+  header.fileLength = offset;
+
+  std::string tmpPath = path + ".tmp";
+  FILE       *f       = fopen(tmpPath.c_str(), "wb");
+  if (f == nullptr) {
+    fprintf(stderr, "ERROR: can't write file: %s\n", tmpPath.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t written = 0;
+  auto     write   = [f, &written](const void *data, size_t len, uint64_t at) {
+    static const char zeros[NVJ_BUNDLE_PAGE_SIZE] = {};
+    for (; written < at; written += std::min<uint64_t>(at - written, sizeof zeros)) {
+      fwrite(zeros, 1, std::min<uint64_t>(at - written, sizeof zeros), f);
+    }
+    fwrite(data, 1, len, f);
+    written += len;
+  };
+
+  write(&header, sizeof header, 0);
+  write(seeds.data(), seeds.size() * sizeof(uint32_t), header.seedsOffset);
+  write(entries.data(), entries.size() * sizeof(NvjBundleEntry), header.entriesOffset);
+  write(strings.data(), strings.size(), header.stringsOffset);
+  for (auto &blob : blobs) {
+    write(blob.first->data(), blob.first->size(), *blob.second);
+  }
+
+  if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) != 0 || fclose(f) != 0 ||
+      rename(tmpPath.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "ERROR: can't write file: %s\n", path.c_str());
+    unlink(tmpPath.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**********************************************************************/
+/**
+ * build a minimal perfect hash (hash and displace)
+ * @param names: the keys
+ * @param seeds: filled with the seed of each bucket
+ * @param slots: filled with the key index of each slot
+ */
+void buildPerfectHash(const std::vector<std::string> &names, std::vector<uint32_t> &seeds, std::vector<size_t> &slots) {
+  GR_JUMP_TRACE;
+  const size_t nbSlots   = names.size();
+  const size_t nbBuckets = std::max<size_t>(1, nbSlots / 2);
+
+  std::vector<std::vector<size_t>> buckets(nbBuckets);
+  for (size_t i = 0; i < nbSlots; i++) {
+    buckets[nvj_phash(names[i], 0) % nbBuckets].push_back(i);
+  }
+
+  std::vector<size_t> order(nbBuckets);
+  for (size_t b = 0; b < nbBuckets; b++) {
+    order[b] = b;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+  seeds.assign(nbBuckets, 0);
+  slots.assign(nbSlots, (size_t)-1);
+
+  for (size_t b : order) {
+    if (buckets[b].empty()) {
+      break;
+    }
+
+    uint32_t            seed = 1;
+    std::vector<size_t> bucketSlots;
+    for (;; seed++) {
+      if (seed == 0) {
+        fprintf(stderr, "ERROR: can't build the perfect hash table\n");
+        exit(EXIT_FAILURE);
+      }
+      bucketSlots.clear();
+      bool ok = true;
+      for (size_t i : buckets[b]) {
+        size_t slot = nvj_phash(names[i], seed) % nbSlots;
+        if (slots[slot] != (size_t)-1 || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end()) {
+          ok = false;
+          break;
+        }
+        bucketSlots.push_back(slot);
+      }
+      if (ok) {
+        break;
+      }
+    }
+
+    seeds[b] = seed;
+    for (size_t k = 0; k < buckets[b].size(); k++) {
+      slots[bucketSlots[k]] = buckets[b][k];
+    }
+  }
+}
+
 /**********************************************************************/
 /**
  * @brief  Main function
@@ -144,24 +594,52 @@ void parseDirectory(const std::string &dirPath) {
 int main(int argc, char *argv[]) {
   GR_JUMP_TRACE;
   if (argc <= 1) {
-    printf("Usage: %s htmlRepository [--exclude [file directory ...]] \n", argv[0]);
+    printf("Usage: %s htmlRepository [--asm file.S | --embed | --bundle file.nvjb] [--no-compress] "
+           "[--exclude [file directory ...]] \n",
+           argv[0]);
+    printf("  default: the content of the files is written as hexadecimal literals\n");
+    printf("  --asm file.S: the content is included by file.S (.incbin), the index is written on stdout\n");
+    printf("  --embed: the content is included with #embed (C++26, gcc >= 15, clang >= 19)\n");
+    printf("  --bundle file.nvjb: the files are packed into a bundle, served by BundleRepository\n");
+    printf("  --no-compress: don't generate the gzip and brotli versions of the files\n");
     fflush(nullptr);
     exit(EXIT_FAILURE);
   }
 
-  int param = 1;
+  int  param    = 1;
+  bool compress = true;
 
-  std::string directory = argv[param];
+  std::string directory = argv[param++];
   while (directory.length() && directory[directory.length() - 1] == '/') {
     directory = directory.substr(0, directory.length() - 1);
   }
 
-  if (strcmp(argv[param], "--exclude") != 0) {
-    for (; param < argc; param++) {
-      listExcludeDir.emplace_back(argv[param]);
+  for (; param < argc; param++) {
+    if (!strcmp(argv[param], "--asm") && param + 1 < argc) {
+      outputMode  = ASM_OUTPUT;
+      asmFilename = argv[++param];
+    } else if (!strcmp(argv[param], "--bundle") && param + 1 < argc) {
+      outputMode     = BUNDLE_OUTPUT;
+      bundleFilename = argv[++param];
+    } else if (!strcmp(argv[param], "--embed")) {
+      outputMode = EMBED_OUTPUT;
+    } else if (!strcmp(argv[param], "--no-compress")) {
+      compress = false;
+    } else if (!strcmp(argv[param], "--exclude")) {
+      for (param++; param < argc; param++) {
+        listExcludeDir.emplace_back(argv[param]);
+      }
+    } else {
+      fprintf(stderr, "ERROR: unknown option: %s\n", argv[param]);
+      exit(EXIT_FAILURE);
     }
   }
 
+  char resolved_path[4096];
+  if ((outputMode == ASM_OUTPUT || outputMode == EMBED_OUTPUT) && realpath(directory.c_str(), resolved_path) != nullptr) {
+    directory = resolved_path; // .incbin and #embed paths are resolved from elsewhere
+  }
+
   parseDirectory(directory);
 
   if (!filenamesVec.size()) {
@@ -169,15 +647,11 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  auto *conversionTable = static_cast<ConversionEntry *>(malloc(filenamesVec.size() * sizeof(ConversionEntry)));
-
-  fprintf(stdout, "#include \"libnavajo/PrecompiledRepository.hh\"\n\n");
-  fprintf(stdout, "namespace webRepository\n{\n");
+  std::vector<ConversionEntry> conversionTable(filenamesVec.size());
 
   for (size_t i = 0; i < filenamesVec.size(); i++) {
-    FILE          *pFile;
-    size_t         lSize;
-    unsigned char *buffer;
+    FILE  *pFile;
+    size_t lSize;
 
     std::string filename = directory + '/' + filenamesVec[i];
 
@@ -192,58 +666,192 @@ int main(int argc, char *argv[]) {
     lSize = ftell(pFile);
     rewind(pFile);
 
-    // allocate memory to contain the whole file.
-    buffer = (unsigned char *)malloc((lSize + 1) * sizeof(unsigned char));
-    if (buffer == nullptr) {
-      fprintf(stderr, "ERROR: can't malloc reading file: %s\n", filenamesVec[i].c_str());
-      fclose(pFile);
-      exit(EXIT_FAILURE);
-    }
-
     // copy the file into the buffer.
-    if (fread(buffer, 1, lSize, pFile) != lSize) {
+    conversionTable[i].content.resize(lSize);
+    if (fread(conversionTable[i].content.data(), 1, lSize, pFile) != lSize) {
       fprintf(stderr, "\nCan't read file %s ... ABORT !\n", filenamesVec[i].c_str());
       fclose(pFile);
       exit(EXIT_FAILURE);
     };
+    fclose(pFile);
 
-    std::string outFilename = filenamesVec[i];
-    std::replace(outFilename.begin(), outFilename.end(), '.', '_');
-    std::replace(outFilename.begin(), outFilename.end(), '/', '_');
-    std::replace(outFilename.begin(), outFilename.end(), ' ', '_');
-    std::replace(outFilename.begin(), outFilename.end(), '-', '_');
+    conversionTable[i].URL  = filenamesVec[i];
+    conversionTable[i].etag = computeEtag(conversionTable[i].content.data(), lSize);
+  }
 
-    fprintf(stdout, "  static const unsigned char %s[] =\n", outFilename.c_str());
-    fprintf(stdout, "  {\n");
-    dump_buffer(stdout, lSize, const_cast<unsigned char *>(buffer));
-    fprintf(stdout, "\n  };\n\n");
-    fclose(pFile);
-    free(buffer);
+  // each file is served under its name, "file.gz" is also the gzip version of "file"
+  std::vector<AssetEntry>       assets;
+  std::map<std::string, size_t> assetsByName;
+  for (size_t i = 0; i < conversionTable.size(); i++) {
+    assetsByName[conversionTable[i].URL] = assets.size();
+    assets.push_back({conversionTable[i].URL, (int)i, -1, {}, {}});
+  }
+  for (size_t i = 0; i < conversionTable.size(); i++) {
+    const std::string &url = conversionTable[i].URL;
+    if (url.size() <= 3 || url.compare(url.size() - 3, 3, ".gz") != 0) {
+      continue;
+    }
+    std::string name = url.substr(0, url.size() - 3);
+    auto        it   = assetsByName.find(name);
+    if (it == assetsByName.end()) {
+      assetsByName[name] = assets.size();
+      assets.push_back({name, -1, (int)i, {}, {}});
+    } else {
+      assets[it->second].gzipFile = (int)i;
+    }
+  }
+
+  // compress the compressible files in parallel, keeping the smaller versions only
+  if (compress) {
+    NvjThreadPool     pool(sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1);
+    NvjWaitGroup      completed;
+    std::atomic<bool> failed(false);
+
+    for (auto &asset : assets) {
+      const char *mime = nvj_mime_type(asset.name.c_str());
+      if (asset.file < 0 || conversionTable[asset.file].content.empty() || mime == nullptr ||
+          !nvj_is_compressible_mime_type(mime)) {
+        continue;
+      }
+
+      const std::vector<unsigned char> &content = conversionTable[asset.file].content;
+      const bool                        text    = !strncmp(mime, "text/", 5);
+      completed.add(asset.gzipFile < 0 ? 2 : 1);
+      if (asset.gzipFile < 0) {
+        pool.push([&asset, &content, &completed, &failed]() {
+          try {
+            asset.gzip = gzipContent(content, content.size());
+          } catch (std::exception &e) {
+            fprintf(stderr, "ERROR: %s: %s\n", asset.name.c_str(), e.what());
+            failed = true;
+          }
+          completed.done();
+        });
+      }
+      pool.push([&asset, &content, text, &completed, &failed]() {
+        try {
+          asset.brotli = brotliContent(content, content.size(), text);
+        } catch (std::exception &e) {
+          fprintf(stderr, "ERROR: %s: %s\n", asset.name.c_str(), e.what());
+          failed = true;
+        }
+        completed.done();
+      });
+    }
+
+    completed.wait();
+    if (failed) {
+      exit(EXIT_FAILURE);
+    }
+
+    // brotli is only kept if smaller than gzip
+    for (auto &asset : assets) {
+      size_t gzipLength = asset.gzipFile >= 0 ? conversionTable[asset.gzipFile].content.size() : asset.gzip.size();
+      if (gzipLength && asset.brotli.size() >= gzipLength) {
+        asset.brotli.clear();
+      }
+    }
+  }
+
+  std::vector<std::string> names;
+  for (const auto &asset : assets) {
+    names.push_back(asset.name);
+  }
+  std::vector<uint32_t> seeds;
+  std::vector<size_t>   slots;
+  buildPerfectHash(names, seeds, slots);
+
+  if (outputMode == BUNDLE_OUTPUT) {
+    writeBundle(bundleFilename, conversionTable, assets, seeds, slots);
+    return (EXIT_SUCCESS);
+  }
+
+  if (outputMode == ASM_OUTPUT) {
+    asmFile         = fopen(asmFilename.c_str(), "w");
+    asmDataFilename = asmFilename + ".bin";
+    asmDataFile     = fopen(asmDataFilename.c_str(), "wb");
+    if (asmFile == nullptr || asmDataFile == nullptr) {
+      fprintf(stderr, "ERROR: can't write file: %s\n", asmFile == nullptr ? asmFilename.c_str() : asmDataFilename.c_str());
+      exit(EXIT_FAILURE);
+    }
+    if (realpath(asmDataFilename.c_str(), resolved_path) != nullptr) {
+      asmDataFilename = resolved_path;
+    }
+    asmPrologue(asmFile);
+  }
+
+  fprintf(stdout, "#include \"libnavajo/PrecompiledRepository.hh\"\n\n");
+  if (outputMode == EMBED_OUTPUT) {
+    fprintf(stdout, "#if !defined(__has_embed)\n");
+    fprintf(stdout, "#error \"#embed is not supported by this compiler, use navajoPrecompiler --asm\"\n");
+    fprintf(stdout, "#endif\n\n");
+  }
+  if (outputMode == ASM_OUTPUT) {
+    fprintf(stdout, "// content of the files, defined in %s\n", asmFilename.c_str());
+  }
+  fprintf(stdout, "namespace webRepository\n{\n");
+
+  for (auto &entry : conversionTable) {
+    entry.varName = emitContent(entry.URL, entry.content, directory + '/' + entry.URL);
+  }
+  std::vector<std::string> gzipVarNames(assets.size()), brotliVarNames(assets.size());
+  for (size_t i = 0; i < assets.size(); i++) {
+    gzipVarNames[i]   = emitContent(assets[i].name + ".gz", assets[i].gzip, "");
+    brotliVarNames[i] = emitContent(assets[i].name + ".br", assets[i].brotli, "");
+  }
+
+  if (asmFile != nullptr) {
+    asmEpilogue(asmFile);
+    if (fclose(asmFile) != 0 || fclose(asmDataFile) != 0) {
+      fprintf(stderr, "ERROR: can't write file: %s\n", asmFilename.c_str());
+      exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "\n");
+  }
 
-    (*(conversionTable + i)).URL     = new std::string(filenamesVec[i]);
-    (*(conversionTable + i)).varName = new std::string(outFilename);
-    (*(conversionTable + i)).length  = lSize;
+  fprintf(stdout, "  static constexpr PrecompiledRepository::Asset assets[] =\n  {\n");
+  for (size_t slot : slots) {
+    const AssetEntry &asset = assets[slot];
+    const char       *mime  = nvj_mime_type(asset.name.c_str());
+    VariantEntry      variants[NVJ_BUNDLE_NB_VARIANTS];
+    getVariants(asset, conversionTable, variants);
+
+    const std::string variantVars[NVJ_BUNDLE_NB_VARIANTS] = {
+        asset.file >= 0 ? conversionTable[asset.file].varName : "nullptr",
+        asset.gzipFile >= 0 ? conversionTable[asset.gzipFile].varName : gzipVarNames[slot], brotliVarNames[slot]};
+
+    fprintf(stdout, "    {\"%s\",\n", cString(asset.name).c_str());
+    for (int v = 0; v < NVJ_BUNDLE_NB_VARIANTS; v++) {
+      if (variants[v].content == nullptr) {
+        fprintf(stdout, "     {nullptr, 0, nullptr},\n");
+      } else {
+        fprintf(stdout, "     {%s, %zu, \"%s\"},\n", variantVars[v].c_str(), variants[v].content->size(),
+                cString(variants[v].headers).c_str());
+      }
+    }
+    if (mime != nullptr) {
+      fprintf(stdout, "     \"%s\", ", mime);
+    } else {
+      fprintf(stdout, "     nullptr, ");
+    }
+    fprintf(stdout, "\"%s\"},\n",
+            cString((asset.file >= 0 ? conversionTable[asset.file] : conversionTable[asset.gzipFile]).etag).c_str());
+  }
+  fprintf(stdout, "  };\n\n");
+
+  fprintf(stdout, "  static constexpr uint32_t seeds[] =\n  {\n   ");
+  for (uint32_t seed : seeds) {
+    fprintf(stdout, " %u,", seed);
   }
+  fprintf(stdout, "\n  };\n\n");
 
+  fprintf(stdout, "  static constexpr PrecompiledRepository::Index assetsIndex = {assets, %zu, seeds, %zu};\n",
+          slots.size(), seeds.size());
+  fprintf(stdout, "  static_assert(PrecompiledRepository::checkIndex(assetsIndex), \"invalid perfect hash table\");\n");
   fprintf(stdout, "}\n\n");
 
-  fprintf(stdout, "PrecompiledRepository::IndexMap PrecompiledRepository::indexMap;\n");
+  fprintf(stdout, "const PrecompiledRepository::Index PrecompiledRepository::index = webRepository::assetsIndex;\n");
   fprintf(stdout, "std::string PrecompiledRepository::location;\n");
-  fprintf(stdout, "\nvoid PrecompiledRepository::initIndexMap()\n{\n");
-
-  for (size_t i = 0; i < filenamesVec.size(); i++) {
-    fprintf(stdout,
-            "    "
-            "indexMap.insert(IndexMap::value_type(\"%s\","
-            "PrecompiledRepository::WebStaticPage((const unsigned "
-            "char*)&webRepository::%s, sizeof webRepository::%s)));\n",
-            (*(conversionTable + i)).URL->c_str(), (*(conversionTable + i)).varName->c_str(),
-            (*(conversionTable + i)).varName->c_str());
-    delete (*(conversionTable + i)).URL;
-    delete (*(conversionTable + i)).varName;
-  }
-  fprintf(stdout, "}\n");
-  free(conversionTable);
 
   return (EXIT_SUCCESS);
 }
@@ -0,0 +1,164 @@
+//********************************************************
+/**
+ * @file  bench_gzip.cpp
+ *
+ * @brief nvj_gzip / nvj_gunzip benchmark
+ *        (1 KB, 100 KB and 10 MB inputs)
+ *        and nvj_gzip_parallel latency on large inputs
+ *
+ *   make bench_gzip && ./bench_gzip
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../include/libnavajo/nvjGzip.h"
+
+/**********************************************************************/
+/**
+ * reference implementation: one zlib state per call and output
+ * growing by CHUNK
+ */
+static size_t legacy_gzip(unsigned char **dst, const unsigned char *src, const size_t sizeSrc) {
+  z_stream strm;
+  size_t   sizeDst = CHUNK;
+
+  strm.zalloc = Z_NULL;
+  strm.zfree  = Z_NULL;
+  strm.opaque = Z_NULL;
+  if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("deflateInit2");
+
+  *dst          = (unsigned char *)malloc(CHUNK);
+  strm.avail_in = sizeSrc;
+  strm.next_in  = (Bytef *)src;
+
+  int i = 0;
+  do {
+    strm.avail_out = CHUNK;
+    strm.next_out  = (Bytef *)*dst + i * CHUNK;
+    sizeDst        = CHUNK * (i + 1);
+    deflate(&strm, Z_FINISH);
+    i++;
+    if (strm.avail_out == 0)
+      *dst = (unsigned char *)realloc(*dst, CHUNK * (i + 1));
+  } while (strm.avail_out == 0);
+
+  (void)deflateEnd(&strm);
+  return sizeDst - strm.avail_out;
+}
+
+/**********************************************************************/
+
+static std::vector<unsigned char> makeInput(size_t len) {
+  std::vector<unsigned char> v;
+  v.reserve(len + 64);
+  unsigned seed = 42;
+  while (v.size() < len) {
+    seed = seed * 1103515245 + 12345;
+    char line[64];
+    int  n = snprintf(line, sizeof line, "{\"id\":%u,\"name\":\"item-%u\",\"ok\":%s},", seed % 100000,
+                      (seed >> 8) % 1000, (seed & 1) ? "true" : "false");
+    v.insert(v.end(), line, line + n);
+  }
+  v.resize(len);
+  return v;
+}
+
+template <class F> static double usPerOp(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    f();
+  std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - start;
+  return d.count() / iterations;
+}
+
+/**********************************************************************/
+
+int main() {
+  const size_t sizes[] = {1024, 100 * 1024, 10 * 1024 * 1024};
+
+  printf("%-10s %14s %14s %14s %14s %8s\n", "input", "legacy(us)", "nvj_gzip(us)", "gzip_into(us)", "gunzip(us)",
+         "ratio");
+
+  for (size_t len : sizes) {
+    std::vector<unsigned char> in         = makeInput(len);
+    size_t                     iterations = len <= 1024 ? 20000 : len <= 100 * 1024 ? 500 : 5;
+
+    // round trip check
+    unsigned char *zipped = nullptr, *unzipped = nullptr;
+    size_t         zlen   = nvj_gzip(&zipped, in.data(), len);
+    size_t         uzlen  = nvj_gunzip(&unzipped, zipped, zlen);
+    if (uzlen != len || memcmp(unzipped, in.data(), len)) {
+      fprintf(stderr, "round trip failed for %zu bytes\n", len);
+      return 1;
+    }
+    free(unzipped);
+
+    double legacy = usPerOp(iterations, [&]() {
+      unsigned char *out = nullptr;
+      legacy_gzip(&out, in.data(), len);
+      free(out);
+    });
+
+    double pooled = usPerOp(iterations, [&]() {
+      unsigned char *out = nullptr;
+      nvj_gzip(&out, in.data(), len);
+      free(out);
+    });
+
+    std::vector<unsigned char> buffer(nvj_gzip_bound(len));
+    double                     into = usPerOp(iterations, [&]() {
+      if (!nvj_gzip_into(buffer.data(), buffer.size(), in.data(), len))
+        abort();
+    });
+
+    double gunzip = usPerOp(iterations, [&]() {
+      unsigned char *out = nullptr;
+      nvj_gunzip(&out, zipped, zlen);
+      free(out);
+    });
+    free(zipped);
+
+    printf("%-10zu %14.1f %14.1f %14.1f %14.1f %8.3f\n", len, legacy, pooled, into, gunzip, (double)zlen / len);
+  }
+
+  const size_t largeSizes[] = {4 * 1024 * 1024, 32 * 1024 * 1024};
+
+  printf("\nparallel gzip (%zu workers)\n", NvjThreadPool::shared().size());
+  printf("%-10s %14s %14s %10s %10s\n", "input", "serial(ms)", "parallel(ms)", "speedup", "ratio");
+
+  for (size_t len : largeSizes) {
+    std::vector<unsigned char> in = makeInput(len);
+
+    unsigned char *zipped = nullptr, *unzipped = nullptr;
+    size_t         zlen   = nvj_gzip_parallel(&zipped, in.data(), len);
+    size_t         uzlen  = nvj_gunzip(&unzipped, zipped, zlen);
+    if (uzlen != len || memcmp(unzipped, in.data(), len)) {
+      fprintf(stderr, "parallel round trip failed for %zu bytes\n", len);
+      return 1;
+    }
+    free(unzipped);
+    free(zipped);
+
+    double serial = usPerOp(3, [&]() {
+      unsigned char *out = nullptr;
+      nvj_gzip(&out, in.data(), len);
+      free(out);
+    });
+
+    double parallel = usPerOp(3, [&]() {
+      unsigned char *out = nullptr;
+      nvj_gzip_parallel(&out, in.data(), len);
+      free(out);
+    });
+
+    printf("%-10zu %14.1f %14.1f %10.2f %10.3f\n", len, serial / 1000, parallel / 1000, serial / parallel,
+           (double)zlen / len);
+  }
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+//********************************************************
+/**
+ * @file  bench_io.cpp
+ *
+ * @brief file reading (fopen/fread, open/fstat/read, io_uring)
+ *        and file sending to a TCP socket (read/send, sendfile,
+ *        io_uring splice) benchmark
+ *
+ *   make bench_io && ./bench_io [NVJ_NO_URING=1 to compare]
+ */
+//********************************************************
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/sendfile.h>
+#include <thread>
+#include <vector>
+
+#include "../include/libnavajo/nvjUring.h"
+
+template <class F> static double usPerOp(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    f(i);
+  std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - start;
+  return d.count() / iterations;
+}
+
+static std::string makeFile(const std::string &path, size_t len) {
+  std::vector<char> buf(len);
+  for (size_t i = 0; i < len; i++)
+    buf[i] = 'a' + (i * 7 + len) % 26;
+  FILE *f = fopen(path.c_str(), "wb");
+  fwrite(buf.data(), 1, len, f);
+  fclose(f);
+  return path;
+}
+
+/**********************************************************************/
+// readers
+
+static bool readStdio(const char *path, std::vector<unsigned char> &data) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data.resize(size);
+  bool ok = fread(data.data(), 1, size, f) == (size_t)size;
+  fclose(f);
+  return ok;
+}
+
+static bool readPosix(const char *path, std::vector<unsigned char> &data) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  fstat(fd, &st);
+  data.resize(st.st_size);
+  bool ok = read(fd, data.data(), st.st_size) == st.st_size;
+  close(fd);
+  return ok;
+}
+
+/**********************************************************************/
+// senders
+
+static bool sendCopy(int sock, int fd, size_t length) {
+  static std::vector<char> buf(64 * 1024);
+  off_t                    offset = 0;
+  while (length > 0) {
+    ssize_t n = pread(fd, buf.data(), length < buf.size() ? length : buf.size(), offset);
+    if (n <= 0)
+      return false;
+    for (ssize_t sent = 0; sent < n;) {
+      ssize_t s = send(sock, buf.data() + sent, n - sent, MSG_NOSIGNAL);
+      if (s <= 0)
+        return false;
+      sent += s;
+    }
+    offset += n;
+    length -= n;
+  }
+  return true;
+}
+
+static bool sendSendfile(int sock, int fd, size_t length) {
+  off_t offset = 0;
+  while (length > 0) {
+    ssize_t n = sendfile(sock, fd, &offset, length);
+    if (n <= 0)
+      return false;
+    length -= n;
+  }
+  return true;
+}
+
+static bool sendUring(int sock, int fd, size_t length) { return NvjUring::forThread()->sendFile(sock, fd, 0, length); }
+
+/**********************************************************************/
+
+int main() {
+  printf("io_uring supported: %s\n\n", NvjUring::isSupported() ? "yes" : "no");
+
+  const size_t nbFiles = 1000, sizes[] = {1024, 64 * 1024};
+  std::string  dir     = "/tmp/bench_io." + std::to_string(getpid());
+  mkdir(dir.c_str(), 0755);
+
+  printf("read %zu files\n%-10s %14s %14s %14s\n", nbFiles, "size", "stdio(us)", "posix(us)", "io_uring(us)");
+  for (size_t len : sizes) {
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < nbFiles; i++)
+      paths.push_back(makeFile(dir + "/" + std::to_string(len) + "_" + std::to_string(i), len));
+
+    std::vector<unsigned char> data;
+    struct stat                st;
+    double                     stdio = usPerOp(10 * nbFiles, [&](size_t i) {
+      if (!readStdio(paths[i % nbFiles].c_str(), data))
+        abort();
+    });
+    double posix = usPerOp(10 * nbFiles, [&](size_t i) {
+      if (!readPosix(paths[i % nbFiles].c_str(), data))
+        abort();
+    });
+    double uring = NAN;
+    if (NvjUring::isSupported())
+      uring = usPerOp(10 * nbFiles, [&](size_t i) {
+        if (!NvjUring::forThread()->readFile(paths[i % nbFiles].c_str(), data, st) || data.size() != len)
+          abort();
+      });
+    printf("%-10zu %14.2f %14.2f %14.2f\n", len, stdio, posix, uring);
+
+    for (const std::string &path : paths)
+      unlink(path.c_str());
+  }
+
+  // a TCP connection on the loopback, drained by a thread
+  int                listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  socklen_t          addrLen = sizeof addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listener, (struct sockaddr *)&addr, sizeof addr);
+  listen(listener, 1);
+  getsockname(listener, (struct sockaddr *)&addr, &addrLen);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  connect(client, (struct sockaddr *)&addr, sizeof addr);
+  int         sock = accept(listener, nullptr, nullptr);
+  std::thread drain([client]() {
+    std::vector<char> buf(256 * 1024);
+    while (read(client, buf.data(), buf.size()) > 0)
+      ;
+  });
+
+  const size_t sendSizes[] = {16 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+  printf("\nsend a file to a TCP socket\n%-10s %14s %14s %14s\n", "size", "read+send(us)", "sendfile(us)",
+         "io_uring(us)");
+  for (size_t len : sendSizes) {
+    std::string path = makeFile(dir + "/send", len);
+    int         fd   = open(path.c_str(), O_RDONLY);
+    size_t      it   = len <= 16 * 1024 ? 20000 : len <= 1024 * 1024 ? 500 : 30;
+
+    double copy = usPerOp(it, [&](size_t) {
+      if (!sendCopy(sock, fd, len))
+        abort();
+    });
+    double sf = usPerOp(it, [&](size_t) {
+      if (!sendSendfile(sock, fd, len))
+        abort();
+    });
+    double uring = NAN;
+    if (NvjUring::isSupported())
+      uring = usPerOp(it, [&](size_t) {
+        if (!sendUring(sock, fd, len))
+          abort();
+      });
+    printf("%-10zu %14.1f %14.1f %14.1f\n", len, copy, sf, uring);
+
+    close(fd);
+    unlink(path.c_str());
+  }
+
+  shutdown(sock, SHUT_WR);
+  drain.join();
+  close(sock);
+  close(client);
+  close(listener);
+  rmdir(dir.c_str());
+  return 0;
+}
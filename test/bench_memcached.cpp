@@ -0,0 +1,149 @@
+//********************************************************
+/**
+ * @file  bench_memcached.cpp
+ *
+ * @brief MemcachedRepository::getFile benchmark against the
+ *        in-process memcached of memcached_fixture.h: hit and
+ *        miss latency (text and binary protocols, local cache),
+ *        scaling with the number of threads, and the pool of
+ *        connections when the server is slow
+ *
+ *   make bench_memcached && LD_LIBRARY_PATH=../build/lib ./bench_memcached
+ */
+//********************************************************
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/libnavajo/MemcachedRepository.hh"
+#include "memcached_fixture.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Stats {
+  size_t              ok = 0, failed = 0;
+  double              seconds = 0;
+  std::vector<double> us; // latency of each getFile
+
+  double percentile(double p) {
+    if (us.empty())
+      return 0;
+    std::sort(us.begin(), us.end());
+    return us[std::min(us.size() - 1, (size_t)(p * us.size()))];
+  }
+  double mean() const {
+    double sum = 0;
+    for (double d : us)
+      sum += d;
+    return us.empty() ? 0 : sum / us.size();
+  }
+};
+
+static bool getFile(MemcachedRepository &repo, const std::string &url) {
+  HttpRequest  request(GET_METHOD, url.c_str(), nullptr, nullptr, HttpRequestHeaders(), nullptr, "", nullptr,
+                       nullptr);
+  HttpResponse response;
+  return repo.getFile(&request, &response);
+}
+
+// nbThreads threads getting the urls for a while
+static Stats run(MemcachedRepository &repo, const std::vector<std::string> &urls, unsigned nbThreads,
+                 size_t iterations) {
+  std::vector<Stats>       stats(nbThreads);
+  std::vector<std::thread> threads;
+  Clock::time_point        start = Clock::now();
+  for (unsigned t = 0; t < nbThreads; t++)
+    threads.emplace_back([&, t]() {
+      stats[t].us.reserve(iterations);
+      for (size_t i = 0; i < iterations; i++) {
+        Clock::time_point                          before = Clock::now();
+        bool                                       found  = getFile(repo, urls[(i * nbThreads + t) % urls.size()]);
+        std::chrono::duration<double, std::micro> d      = Clock::now() - before;
+        stats[t].us.push_back(d.count());
+        found ? stats[t].ok++ : stats[t].failed++;
+      }
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+
+  Stats total;
+  total.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  for (Stats &s : stats) {
+    total.ok += s.ok;
+    total.failed += s.failed;
+    total.us.insert(total.us.end(), s.us.begin(), s.us.end());
+  }
+  return total;
+}
+
+static std::vector<std::string> fill(MemcachedRepository &repo, const std::string &name, size_t nb, size_t len) {
+  std::vector<std::string> urls;
+  for (size_t i = 0; i < nb; i++) {
+    urls.push_back("/" + name + std::to_string(i) + ".bin");
+    repo.set(urls.back(), std::string(len, 'a' + i % 26));
+  }
+  return urls;
+}
+
+/**********************************************************************/
+
+int main() {
+  MemcachedFixture memcached;
+  const int        port = memcached.getPort();
+  const size_t     nbKeys = 1000;
+
+  printf("getFile latency, 1 thread\n%-26s %10s %10s %10s\n", "", "mean(us)", "p50(us)", "p99(us)");
+  for (bool binary : {false, true}) {
+    MemcachedRepository repo("bench", "127.0.0.1", port);
+    repo.setBinaryProtocol(binary);
+    const char *protocol = binary ? "binary" : "text";
+    for (size_t len : {1024, 64 * 1024}) {
+      Stats s = run(repo, fill(repo, "hit" + std::to_string(len) + "_", nbKeys, len), 1, 10000);
+      printf("%-6s hit %-18s %10.1f %10.1f %10.1f\n", protocol, (std::to_string(len / 1024) + "KB").c_str(), s.mean(),
+             s.percentile(0.5), s.percentile(0.99));
+    }
+    std::vector<std::string> missing;
+    for (size_t i = 0; i < nbKeys; i++)
+      missing.push_back("/missing" + std::to_string(i));
+    Stats s = run(repo, missing, 1, 10000);
+    printf("%-6s miss %17s %10.1f %10.1f %10.1f\n", protocol, "", s.mean(), s.percentile(0.5), s.percentile(0.99));
+  }
+  {
+    MemcachedRepository repo("bench", "127.0.0.1", port);
+    repo.setLocalCache(64 * 1024 * 1024);
+    Stats s = run(repo, fill(repo, "local", nbKeys, 1024), 1, 10000);
+    printf("%-6s hit %-18s %10.1f %10.1f %10.1f\n", "local", "1KB", s.mean(), s.percentile(0.5), s.percentile(0.99));
+  }
+
+  printf("\nscaling: 1KB hits\n%-10s %14s %10s %14s\n", "threads", "getFile/s", "p99(us)", "connections");
+  {
+    MemcachedRepository      repo("bench", "127.0.0.1", port);
+    std::vector<std::string> urls = fill(repo, "scale", nbKeys, 1024);
+    for (unsigned nbThreads : {1, 2, 4, 8, 16, 32, 64}) {
+      unsigned long connections = memcached.connections;
+      Stats         s           = run(repo, urls, nbThreads, 20000 / nbThreads);
+      printf("%-10u %14.0f %10.1f %14lu\n", nbThreads, s.ok / s.seconds, s.percentile(0.99),
+             memcached.connections - connections);
+    }
+  }
+
+  const unsigned latency = 1000, nbThreads = 32;
+  printf("\npool of connections: %u threads, server latency %uus, checkout timeout 100ms\n%-10s %14s %10s %10s %10s\n",
+         nbThreads, latency, "pool size", "getFile/s", "p50(us)", "p99(us)", "failed");
+  memcached.setLatency(latency);
+  for (size_t poolSize : {1, 4, 16, 32, 64}) {
+    MemcachedRepository repo("bench", "127.0.0.1", port, poolSize);
+    repo.setTimeouts(MEMCACHED_DEFAULT_CONNECT_TIMEOUT, MEMCACHED_DEFAULT_IO_TIMEOUT, 100);
+    std::vector<std::string> urls = fill(repo, "pool", 100, 1024);
+    Stats                    s    = run(repo, urls, nbThreads, 100);
+    printf("%-10zu %14.0f %10.1f %10.1f %10zu\n", poolSize, s.ok / s.seconds, s.percentile(0.5), s.percentile(0.99),
+           s.failed);
+  }
+  memcached.setLatency(0);
+  return 0;
+}
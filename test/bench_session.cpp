@@ -0,0 +1,152 @@
+//********************************************************
+/**
+ * @file  bench_session.cpp
+ *
+ * @brief HttpSession contention benchmark: the requests of
+ *        many threads resolving their session and reading or
+ *        setting attributes, against a single map behind a
+ *        global mutex (the previous store), and the cost of an
+ *        expiration sweep
+ *
+ *   make bench_session && LD_LIBRARY_PATH=../build/lib ./bench_session
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/libnavajo/HttpSession.hh"
+
+/**********************************************************************/
+// the previous store: one map of maps, one mutex
+
+class GlobalStore {
+  std::map<std::string, std::map<std::string, void *> *> sessions;
+  pthread_mutex_t                                        mutex = PTHREAD_MUTEX_INITIALIZER;
+
+public:
+  void create(const std::string &id) {
+    pthread_mutex_lock(&mutex);
+    sessions[id] = new std::map<std::string, void *>();
+    pthread_mutex_unlock(&mutex);
+  }
+  bool touch(const std::string &id) {
+    pthread_mutex_lock(&mutex);
+    bool res = sessions.find(id) != sessions.end();
+    pthread_mutex_unlock(&mutex);
+    return res;
+  }
+  // copied under the lock: a pointer could be freed by another thread
+  bool getLong(const std::string &id, const std::string &name, long &value) {
+    bool res = false;
+    pthread_mutex_lock(&mutex);
+    auto it = sessions.find(id);
+    if (it != sessions.end()) {
+      auto it2 = it->second->find(name);
+      if (it2 != it->second->end() && it2->second != nullptr) {
+        value = *(long *)it2->second;
+        res   = true;
+      }
+    }
+    pthread_mutex_unlock(&mutex);
+    return res;
+  }
+  void set(const std::string &id, const std::string &name, void *value) {
+    pthread_mutex_lock(&mutex);
+    auto it = sessions.find(id);
+    if (it != sessions.end()) {
+      void *&slot = (*it->second)[name];
+      free(slot);
+      slot = value;
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+  ~GlobalStore() {
+    for (auto &session : sessions) {
+      for (auto &attribute : *session.second)
+        free(attribute.second);
+      delete session.second;
+    }
+  }
+};
+
+/**********************************************************************/
+
+// a request: resolve the session, read an attribute, set one every 16 requests
+template <class F> static double run(unsigned nbThreads, size_t requestsPerThread, F request) {
+  std::vector<std::thread> threads;
+  auto                     start = std::chrono::steady_clock::now();
+  for (unsigned t = 0; t < nbThreads; t++)
+    threads.emplace_back([&, t]() {
+      std::minstd_rand random(t + 1);
+      for (size_t i = 0; i < requestsPerThread; i++)
+        request(random(), i % 16 == 0);
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return nbThreads * requestsPerThread / d.count();
+}
+
+int main() {
+  const size_t             nbSessions = 10000, requests = 2000000;
+  std::vector<std::string> ids(nbSessions);
+  GlobalStore              global;
+  for (std::string &id : ids) {
+    HttpSession::create(id);
+    HttpSession::find(id).set("counter", 0L);
+    global.create(id);
+  }
+
+  printf("%zu sessions, %zu requests\n%-10s %16s %16s %10s\n", nbSessions, requests, "threads", "global(req/s)",
+         "sharded(req/s)", "speedup");
+  for (unsigned nbThreads : {1, 4, 16, 64}) {
+    size_t perThread = requests / nbThreads;
+
+    double globalRate = run(nbThreads, perThread, [&](unsigned r, bool write) {
+      const std::string &id = ids[r % nbSessions];
+      if (!global.touch(id))
+        abort();
+      long counter = 0;
+      global.getLong(id, "counter", counter);
+      if (write) {
+        long *value = (long *)malloc(sizeof(long));
+        *value      = counter + 1;
+        global.set(id, "counter", value);
+      }
+    });
+
+    double shardedRate = run(nbThreads, perThread, [&](unsigned r, bool write) {
+      const std::string &id = ids[r % nbSessions];
+      if (!HttpSession::updateExpirationIfExists(id))
+        abort();
+      HttpSession::Handle   session = HttpSession::find(id);
+      std::shared_ptr<long> counter = session.get<long>("counter");
+      if (write)
+        session.set("counter", counter ? *counter + 1 : 1L);
+    });
+
+    printf("%-10u %16.0f %16.0f %10.2f\n", nbThreads, globalRate, shardedRate, shardedRate / globalRate);
+  }
+
+  // the sweep only visits the sessions falling due
+  auto sweep = []() {
+    auto start = std::chrono::steady_clock::now();
+    HttpSession::removeExpiredSession();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  };
+  printf("\nexpiration sweep, %zu live sessions, none due: %10.1f us\n", nbSessions, sweep());
+  HttpSession::setSessionLifeTime(1);
+  std::vector<std::string> expiring(nbSessions);
+  for (std::string &id : expiring)
+    HttpSession::create(id);
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  printf("expiration sweep, %zu live sessions, %zu due: %10.1f us\n", 2 * nbSessions, nbSessions, sweep());
+  return 0;
+}
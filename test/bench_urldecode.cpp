@@ -0,0 +1,170 @@
+//********************************************************
+/**
+ * @file  bench_urldecode.cpp
+ *
+ * @brief nvj_url_decode / nvj_split_query benchmark
+ *        on long urlencoded form posts
+ *
+ *   make bench_urldecode && ./bench_urldecode
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "../include/libnavajo/nvjUrlDecode.h"
+
+typedef std::map<std::string, std::string> ParametersMap;
+
+/**********************************************************************/
+/**
+ * reference implementation: erase-based decoding of the whole string,
+ * then substr splitting
+ */
+static void legacy_decode_params(const std::string &p, ParametersMap &params) {
+  size_t      start = 0, end = 0;
+  std::string paramstr = p;
+
+  while ((end = paramstr.find_first_of("%+", start)) != std::string::npos) {
+    size_t len = paramstr.length() - end - 1;
+    switch (paramstr[end]) {
+    case '%':
+      if (paramstr[end + 1] == '%' && len) {
+        paramstr = paramstr.erase(end + 1, 1);
+      } else {
+        if (len < 2) {
+          break;
+        }
+        unsigned int      specar;
+        std::string       hexChar = paramstr.substr(end + 1, 2);
+        std::stringstream ss;
+        ss << std::hex << hexChar.c_str();
+        ss >> specar;
+        paramstr[end] = (char)specar;
+        paramstr      = paramstr.erase(end + 1, 2);
+      }
+      break;
+    case '+':
+      paramstr[end] = ' ';
+      break;
+    }
+    start = end + 1;
+  }
+
+  start            = 0;
+  end              = 0;
+  bool islastParam = false;
+  while (!islastParam) {
+    islastParam = (end = paramstr.find('&', start)) == std::string::npos;
+    if (islastParam) {
+      end = paramstr.size();
+    }
+    std::string theParam = paramstr.substr(start, end - start);
+    size_t      posEq    = theParam.find('=');
+    if (posEq == std::string::npos) {
+      params[theParam] = "";
+    } else {
+      params[theParam.substr(0, posEq)] = theParam.substr(posEq + 1);
+    }
+    start = end + 1;
+  }
+}
+
+static void decode_params(const std::string &p, ParametersMap &params) {
+  nvj_split_query(p, [&params](std::string_view key, std::string_view value, bool) {
+    params[nvj_url_decode(key)] = nvj_url_decode(value);
+  });
+}
+
+/**********************************************************************/
+/**
+ * form post of nbFields fields, escapeRatio of the value chars escaped
+ */
+static std::string makeForm(size_t nbFields, size_t valueLen, unsigned escapeEvery) {
+  static const char hex[] = "0123456789ABCDEF";
+  std::string       form;
+  unsigned          seed = 7;
+
+  for (size_t f = 0; f < nbFields; f++) {
+    if (f)
+      form += '&';
+    form += "field" + std::to_string(f) + '=';
+    for (size_t c = 0; c < valueLen; c++) {
+      seed = seed * 1103515245 + 12345;
+      if (escapeEvery && (seed >> 16) % escapeEvery == 0) {
+        unsigned char e = 0x80 | ((seed >> 8) & 0x7f);
+        form += '%';
+        form += hex[e >> 4];
+        form += hex[e & 0xf];
+      } else if ((seed >> 16) % 11 == 0) {
+        form += '+';
+      } else {
+        form += (char)('a' + (seed >> 20) % 26);
+      }
+    }
+  }
+  return form;
+}
+
+template <class F> static double usPerOp(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    f();
+  std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - start;
+  return d.count() / iterations;
+}
+
+/**********************************************************************/
+
+int main() {
+  struct {
+    const char *name;
+    size_t      nbFields, valueLen;
+    unsigned    escapeEvery;
+  } cases[] = {
+      {"query 10x16 plain", 10, 16, 0},       {"form 100x64 light", 100, 64, 20},
+      {"form 100x1K heavy", 100, 1024, 2},    {"form 10x64K light", 10, 64 * 1024, 20},
+      {"form 10x64K heavy", 10, 64 * 1024, 2},
+  };
+
+  // corner cases
+  const char *checks[][2] = {{"a%41b", "aAb"}, {"%%41", "%41"}, {"%4", "%4"},     {"%zz+x", "%zz x"},
+                             {"%", "%"},       {"%2f%2F", "//"}, {"++%20", "   "}, {"", ""}};
+  for (auto &c : checks) {
+    if (nvj_url_decode(c[0]) != c[1]) {
+      fprintf(stderr, "decode('%s') = '%s', expected '%s'\n", c[0], nvj_url_decode(c[0]).c_str(), c[1]);
+      return 1;
+    }
+  }
+
+  printf("%-20s %10s %14s %14s %8s\n", "input", "bytes", "legacy(us)", "nvj(us)", "speedup");
+
+  for (auto &c : cases) {
+    std::string form       = makeForm(c.nbFields, c.valueLen, c.escapeEvery);
+    size_t      iterations = form.size() < 10000 ? 20000 : form.size() < 200000 ? 200 : 10;
+
+    ParametersMap legacyParams, params;
+    legacy_decode_params(form, legacyParams);
+    decode_params(form, params);
+    if (legacyParams != params) {
+      fprintf(stderr, "%s: results differ\n", c.name);
+      return 1;
+    }
+
+    double legacy = usPerOp(iterations, [&]() {
+      ParametersMap m;
+      legacy_decode_params(form, m);
+    });
+    double nvj = usPerOp(iterations, [&]() {
+      ParametersMap m;
+      decode_params(form, m);
+    });
+
+    printf("%-20s %10zu %14.1f %14.1f %8.1f\n", c.name, form.size(), legacy, nvj, legacy / nvj);
+  }
+
+  return 0;
+}
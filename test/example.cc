@@ -116,7 +116,7 @@ class MyDynamicRepository : public DynamicRepository {
   class ListUploadedFiles : public DynamicPage {
     bool getPage(HttpRequest *request, HttpResponse *response) override {
       std::string                     json      = "{ \"data\" : [";
-      std::set<std::string>          *filenames = myUploadRepo->getFilenames();
+      auto                            filenames = myUploadRepo->getFilenames();
       std::set<std::string>::iterator it        = filenames->begin();
       while (it != filenames->end()) {
         json += std::string("\"") + escape_json(it->c_str()) + '\"';
@@ -0,0 +1,411 @@
+//********************************************************
+/**
+ * @file  memcached_fixture.h
+ *
+ * @brief in-process memcached server for the tests and
+ *        benchmarks: the text and binary protocols, enough
+ *        of them for libmemcached (get/gets/getk[q], set,
+ *        delete, noop, version, flush_all, quit), with an
+ *        injectable latency and responses sent in pieces
+ *
+ *   MemcachedFixture memcached;       // listens on a free port
+ *   MemcachedRepository repo("p", "127.0.0.1", memcached.getPort());
+ */
+//********************************************************
+
+#ifndef MEMCACHED_FIXTURE_H_
+#define MEMCACHED_FIXTURE_H_
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class MemcachedFixture {
+  struct Item {
+    std::string data;
+    uint32_t    flags;
+    time_t      expiry; // 0: never
+  };
+
+  int                      mListener;
+  int                      mPort;
+  std::thread              mAcceptThread;
+  std::vector<std::thread> mThreads;
+  std::set<int>            mClients;
+  std::mutex               mClientsMutex;
+
+  std::map<std::string, Item> mItems;
+  std::mutex                  mItemsMutex;
+  std::atomic<unsigned>       mLatency; // us, before each response
+  std::atomic<size_t>         mSplit;   // bytes sent at once, 0: the whole response
+
+  /**********************************************************************/
+  // connection buffer
+
+  struct Conn {
+    int         fd;
+    std::string in, out;
+
+    bool fill() {
+      char    buf[16384];
+      ssize_t n = recv(fd, buf, sizeof buf, 0);
+      if (n <= 0)
+        return false;
+      in.append(buf, n);
+      return true;
+    }
+    bool need(size_t len) {
+      while (in.size() < len)
+        if (!fill())
+          return false;
+      return true;
+    }
+    bool flush(size_t split) {
+      for (size_t sent = 0; sent < out.size();) {
+        size_t len = split && split < out.size() - sent ? split : out.size() - sent;
+        if (split && sent)
+          usleep(1000); // read apart by the client
+        ssize_t n = send(fd, out.data() + sent, len, MSG_NOSIGNAL);
+        if (n <= 0)
+          return false;
+        sent += n;
+      }
+      out.clear();
+      return true;
+    }
+  };
+
+  /**********************************************************************/
+  // items
+
+  static time_t absoluteExpiry(uint32_t exptime) {
+    if (exptime == 0)
+      return 0;
+    // up to 30 days: relative, else a unix time
+    return exptime <= 30 * 24 * 3600 ? time(nullptr) + exptime : (time_t)exptime;
+  }
+
+  bool find(const std::string &key, Item &item) {
+    std::lock_guard<std::mutex> lock(mItemsMutex);
+    gets++;
+    auto it = mItems.find(key);
+    if (it == mItems.end())
+      return false;
+    if (it->second.expiry && it->second.expiry <= time(nullptr)) {
+      mItems.erase(it);
+      return false;
+    }
+    hits++;
+    item = it->second;
+    return true;
+  }
+
+  void store(const std::string &key, std::string data, uint32_t flags, uint32_t exptime) {
+    std::lock_guard<std::mutex> lock(mItemsMutex);
+    sets++;
+    mItems[key] = Item{std::move(data), flags, absoluteExpiry(exptime)};
+  }
+
+  bool erase(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mItemsMutex);
+    return mItems.erase(key) > 0;
+  }
+
+  void delay() {
+    unsigned us = mLatency;
+    if (us)
+      usleep(us);
+  }
+
+  /**********************************************************************/
+  // text protocol
+
+  static std::vector<std::string> split(const std::string &line) {
+    std::vector<std::string> words;
+    for (size_t pos = 0; pos < line.size();) {
+      size_t end = line.find(' ', pos);
+      if (end == std::string::npos)
+        end = line.size();
+      if (end > pos)
+        words.push_back(line.substr(pos, end - pos));
+      pos = end + 1;
+    }
+    return words;
+  }
+
+  bool textCommand(Conn &c) {
+    size_t eol;
+    while ((eol = c.in.find("\r\n")) == std::string::npos)
+      if (!c.fill())
+        return false;
+    std::vector<std::string> w = split(c.in.substr(0, eol));
+    c.in.erase(0, eol + 2);
+    if (w.empty()) {
+      c.out += "ERROR\r\n";
+    } else if (w[0] == "get" || w[0] == "gets") {
+      Item item;
+      for (size_t i = 1; i < w.size(); i++)
+        if (find(w[i], item)) {
+          c.out += "VALUE " + w[i] + " " + std::to_string(item.flags) + " " + std::to_string(item.data.size());
+          if (w[0] == "gets")
+            c.out += " 1";
+          c.out += "\r\n" + item.data + "\r\n";
+        }
+      c.out += "END\r\n";
+    } else if ((w[0] == "set" || w[0] == "add" || w[0] == "replace") && w.size() >= 5) {
+      size_t len = strtoul(w[4].c_str(), nullptr, 10);
+      if (!c.need(len + 2))
+        return false;
+      store(w[1], c.in.substr(0, len), strtoul(w[2].c_str(), nullptr, 10), strtoul(w[3].c_str(), nullptr, 10));
+      c.in.erase(0, len + 2);
+      if (w.back() != "noreply")
+        c.out += "STORED\r\n";
+    } else if (w[0] == "delete" && w.size() >= 2) {
+      bool found = erase(w[1]);
+      if (w.back() != "noreply")
+        c.out += found ? "DELETED\r\n" : "NOT_FOUND\r\n";
+    } else if (w[0] == "flush_all") {
+      clear();
+      if (w.back() != "noreply")
+        c.out += "OK\r\n";
+    } else if (w[0] == "version") {
+      c.out += "VERSION 1.6.0\r\n";
+    } else if (w[0] == "quit") {
+      return false;
+    } else {
+      c.out += "ERROR\r\n";
+    }
+    delay();
+    return c.flush(mSplit);
+  }
+
+  /**********************************************************************/
+  // binary protocol
+
+  enum : uint8_t {
+    OP_GET     = 0x00,
+    OP_SET     = 0x01,
+    OP_ADD     = 0x02,
+    OP_REPLACE = 0x03,
+    OP_DELETE  = 0x04,
+    OP_QUIT    = 0x07,
+    OP_FLUSH   = 0x08,
+    OP_GETQ    = 0x09,
+    OP_NOOP    = 0x0a,
+    OP_VERSION = 0x0b,
+    OP_GETK    = 0x0c,
+    OP_GETKQ   = 0x0d,
+    OP_SETQ    = 0x11,
+    OP_DELETEQ = 0x14
+  };
+
+  static uint16_t get16(const std::string &s, size_t pos) {
+    return (uint16_t)((uint8_t)s[pos] << 8 | (uint8_t)s[pos + 1]);
+  }
+  static uint32_t get32(const std::string &s, size_t pos) { return (uint32_t)get16(s, pos) << 16 | get16(s, pos + 2); }
+  static void     put16(std::string &s, uint16_t v) {
+    s += (char)(v >> 8);
+    s += (char)v;
+  }
+  static void put32(std::string &s, uint32_t v) {
+    put16(s, v >> 16);
+    put16(s, v);
+  }
+
+  static void response(std::string &out, uint8_t opcode, uint16_t status, uint32_t opaque, const std::string &extras,
+                       const std::string &key, const std::string &value) {
+    out += (char)0x81;
+    out += (char)opcode;
+    put16(out, key.size());
+    out += (char)extras.size();
+    out += (char)0; // datatype
+    put16(out, status);
+    put32(out, extras.size() + key.size() + value.size());
+    put32(out, opaque);
+    put32(out, 0); // cas
+    put32(out, status ? 0 : 1);
+    out += extras + key + value;
+  }
+
+  bool binaryCommand(Conn &c) {
+    if (!c.need(24))
+      return false;
+    uint8_t  opcode  = c.in[1];
+    uint16_t keyLen  = get16(c.in, 2);
+    uint8_t  extLen  = c.in[4];
+    uint32_t bodyLen = get32(c.in, 8);
+    uint32_t opaque  = get32(c.in, 12);
+    if (!c.need(24 + (size_t)bodyLen))
+      return false;
+    std::string extras = c.in.substr(24, extLen);
+    std::string key    = c.in.substr(24 + extLen, keyLen);
+    std::string value  = c.in.substr(24 + extLen + keyLen, bodyLen - extLen - keyLen);
+    c.in.erase(0, 24 + (size_t)bodyLen);
+
+    bool quiet = false;
+    switch (opcode) {
+    case OP_GETQ:
+    case OP_GETKQ:
+      quiet = true;
+      // fallthrough
+    case OP_GET:
+    case OP_GETK: {
+      Item item;
+      bool withKey = opcode == OP_GETK || opcode == OP_GETKQ;
+      if (find(key, item)) {
+        std::string flags;
+        put32(flags, item.flags);
+        response(c.out, opcode, 0, opaque, flags, withKey ? key : "", item.data);
+      } else if (!quiet) {
+        response(c.out, opcode, 0x01, opaque, "", withKey ? key : "", "Not found");
+      }
+      break;
+    }
+    case OP_SETQ:
+      quiet = true;
+      // fallthrough
+    case OP_SET:
+    case OP_ADD:
+    case OP_REPLACE:
+      store(key, value, extLen >= 8 ? get32(extras, 0) : 0, extLen >= 8 ? get32(extras, 4) : 0);
+      if (!quiet)
+        response(c.out, opcode, 0, opaque, "", "", "");
+      break;
+    case OP_DELETEQ:
+    case OP_DELETE:
+      if (erase(key)) {
+        if (opcode == OP_DELETE)
+          response(c.out, opcode, 0, opaque, "", "", "");
+      } else {
+        response(c.out, opcode, 0x01, opaque, "", "", "Not found");
+      }
+      break;
+    case OP_FLUSH:
+      clear();
+      response(c.out, opcode, 0, opaque, "", "", "");
+      break;
+    case OP_NOOP:
+      response(c.out, opcode, 0, opaque, "", "", "");
+      break;
+    case OP_VERSION:
+      response(c.out, opcode, 0, opaque, "", "", "1.6.0");
+      break;
+    case OP_QUIT:
+      return false;
+    default:
+      response(c.out, opcode, 0x81, opaque, "", "", "Unknown command");
+    }
+
+    // the quiet requests are answered with the next loud one
+    if (!quiet || c.in.size() < 24) {
+      delay();
+      return c.flush(mSplit);
+    }
+    return true;
+  }
+
+  /**********************************************************************/
+
+  void serve(int fd) {
+    Conn c{fd, "", ""};
+    int  one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    for (;;) {
+      if (c.in.empty() && !c.fill())
+        break;
+      bool ok = (uint8_t)c.in[0] == 0x80 ? binaryCommand(c) : textCommand(c);
+      if (!ok)
+        break;
+    }
+    std::lock_guard<std::mutex> lock(mClientsMutex);
+    if (mClients.erase(fd))
+      close(fd);
+  }
+
+  void acceptLoop() {
+    int fd;
+    while ((fd = accept(mListener, nullptr, nullptr)) >= 0) {
+      std::lock_guard<std::mutex> lock(mClientsMutex);
+      connections++;
+      mClients.insert(fd);
+      mThreads.emplace_back(&MemcachedFixture::serve, this, fd);
+    }
+  }
+
+public:
+  std::atomic<unsigned long> gets{0}, hits{0}, sets{0}, connections{0};
+
+  MemcachedFixture() : mLatency(0), mSplit(0) {
+    mListener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t          addrLen = sizeof addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (mListener < 0 || bind(mListener, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(mListener, 128) < 0 ||
+        getsockname(mListener, (struct sockaddr *)&addr, &addrLen) < 0)
+      throw std::runtime_error("MemcachedFixture: can't listen");
+    mPort         = ntohs(addr.sin_port);
+    mAcceptThread = std::thread(&MemcachedFixture::acceptLoop, this);
+  }
+
+  ~MemcachedFixture() {
+    shutdown(mListener, SHUT_RDWR);
+    mAcceptThread.join();
+    close(mListener);
+    {
+      std::lock_guard<std::mutex> lock(mClientsMutex);
+      for (int fd : mClients)
+        shutdown(fd, SHUT_RDWR);
+    }
+    for (std::thread &t : mThreads)
+      t.join();
+  }
+
+  MemcachedFixture(const MemcachedFixture &)            = delete;
+  MemcachedFixture &operator=(const MemcachedFixture &) = delete;
+
+  int getPort() const { return mPort; }
+
+  // delay of each response, in microseconds
+  void setLatency(unsigned us) { mLatency = us; }
+
+  // send the responses by pieces of this size, 1ms apart (0: at once)
+  void setSplit(size_t bytes) { mSplit = bytes; }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mItemsMutex);
+    mItems.clear();
+  }
+
+  void put(const std::string &key, const std::string &data, uint32_t flags = 0) { store(key, data, flags, 0); }
+
+  // the stored item, without counting a get
+  bool peek(const std::string &key, std::string &data, uint32_t &flags) {
+    std::lock_guard<std::mutex> lock(mItemsMutex);
+    auto                        it = mItems.find(key);
+    if (it == mItems.end())
+      return false;
+    data  = it->second.data;
+    flags = it->second.flags;
+    return true;
+  }
+
+  void resetCounters() { gets = hits = sets = 0; }
+};
+
+#endif
@@ -0,0 +1,224 @@
+//********************************************************
+/**
+ * @file  test_bundle.cpp
+ *
+ * @brief nvjBundle.h and BundleRepository: a valid bundle is
+ *        served, corrupted ones are rejected when they are opened
+ *        and keep the current mapping
+ *
+ *   make test_bundle && LD_LIBRARY_PATH=../build/lib ./test_bundle
+ */
+//********************************************************
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../include/libnavajo/BundleRepository.hh"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  if (!(cond)) {                                                                                                       \
+    fprintf(stderr, "FAILED line %d: %s\n", __LINE__, #cond);                                                          \
+    failures++;                                                                                                        \
+  }
+
+static const char *names[]    = {"index.html", "app.js", "img/logo.png"};
+static const size_t nbEntries = sizeof names / sizeof names[0];
+
+// the content of the identity and gzip variants of a file
+static std::string content(size_t i, int variant) {
+  return std::string(variant == NVJ_BUNDLE_GZIP ? "gzip " : "identity ") + names[i];
+}
+
+static std::string headers(size_t i, int variant) {
+  return "Content-Length: " + std::to_string(content(i, variant).size()) + "\r\n";
+}
+
+/**
+ * a bundle laid out as navajoPrecompiler --bundle writes it, with a
+ * single bucket: every file has an identity version, app.js a gzip one
+ */
+class Bundle {
+  static size_t align(size_t offset) { return (offset + 15) / 16 * 16; }
+
+public:
+  NvjBundleHeader             header; // may be corrupted, the layout is then kept
+  NvjBundleHeader             layout;
+  uint32_t                    seed;
+  std::vector<NvjBundleEntry> entries;
+  std::string                 strings, blobs;
+
+  uint32_t addString(const std::string &str) {
+    uint32_t offset  = strings.size();
+    strings         += str;
+    strings         += '\0';
+    return offset;
+  }
+
+  Bundle() : entries(nbEntries), strings(1, '\0') {
+    // a seed giving each name its own slot
+    for (seed = 0;; seed++) {
+      std::vector<bool> used(nbEntries);
+      size_t            i;
+      for (i = 0; i < nbEntries && !used[nvj_phash_slot(names[i], &seed, 1, nbEntries)]; i++)
+        used[nvj_phash_slot(names[i], &seed, 1, nbEntries)] = true;
+      if (i == nbEntries)
+        break;
+    }
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, NVJ_BUNDLE_MAGIC, sizeof NVJ_BUNDLE_MAGIC);
+    header.version       = NVJ_BUNDLE_VERSION;
+    header.byteOrder     = NVJ_BUNDLE_BYTE_ORDER;
+    header.nbEntries     = nbEntries;
+    header.nbBuckets     = 1;
+    header.seedsOffset   = sizeof header;
+    header.entriesOffset = align(header.seedsOffset + sizeof seed);
+    header.stringsOffset = header.entriesOffset + nbEntries * sizeof(NvjBundleEntry);
+
+    memset(entries.data(), 0, nbEntries * sizeof(NvjBundleEntry));
+    std::vector<std::pair<std::string, uint64_t *>> variants;
+    for (size_t i = 0; i < nbEntries; i++) {
+      NvjBundleEntry &e = entries[nvj_phash_slot(names[i], &seed, 1, nbEntries)];
+      e.nameLength      = strlen(names[i]);
+      e.nameOffset      = addString(names[i]);
+      e.etagLength      = 6;
+      e.etagOffset      = addString("\"etag" + std::to_string(i) + "\"");
+      for (int v : {NVJ_BUNDLE_IDENTITY, NVJ_BUNDLE_GZIP}) {
+        if (v == NVJ_BUNDLE_GZIP && i != 1)
+          continue;
+        e.variants[v].length        = content(i, v).size();
+        e.variants[v].headersLength = headers(i, v).size();
+        e.variants[v].headersOffset = addString(headers(i, v));
+        variants.emplace_back(content(i, v), &e.variants[v].offset);
+      }
+    }
+    header.stringsLength = strings.size();
+
+    uint64_t offset = align(header.stringsOffset + header.stringsLength);
+    for (auto &v : variants) {
+      *v.second  = offset;
+      blobs     += v.first;
+      blobs.resize(align(blobs.size()), '\0');
+      offset     = align(header.stringsOffset + header.stringsLength) + blobs.size();
+    }
+    header.fileLength = offset;
+    layout            = header;
+  }
+
+  // the entry of a file
+  NvjBundleEntry &entry(size_t i) { return entries[nvj_phash_slot(names[i], &seed, 1, nbEntries)]; }
+
+  void write(const std::string &path) const {
+    std::string data((const char *)&header, sizeof header);
+    data.resize(layout.seedsOffset);
+    data.append((const char *)&seed, sizeof seed);
+    data.resize(layout.entriesOffset, '\0');
+    data.append((const char *)entries.data(), nbEntries * sizeof(NvjBundleEntry));
+    data += strings;
+    data.resize(align(data.size()), '\0');
+    data += blobs;
+
+    std::string tmpPath = path + ".tmp";
+    FILE       *f       = fopen(tmpPath.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    rename(tmpPath.c_str(), path.c_str());
+  }
+};
+
+// opening the bundle fails
+static bool rejected(const std::string &path) {
+  try {
+    NvjBundle bundle(path);
+  } catch (std::exception &e) {
+    return true;
+  }
+  return false;
+}
+
+// the content served for the url, "<none>" if the repository declines it
+static std::string getFile(BundleRepository &repo, const std::string &url, bool gzip = false) {
+  HttpRequestHeaders headers;
+  if (gzip)
+    headers.add("Accept-Encoding", "gzip");
+  HttpRequest    request(GET_METHOD, url.c_str(), nullptr, nullptr, std::move(headers), nullptr, "", nullptr,
+                         nullptr);
+  HttpResponse   response;
+  unsigned char *data;
+  size_t         length;
+  bool           zip;
+  if (!repo.getFile(&request, &response))
+    return "<none>";
+  response.getContent(&data, &length, &zip);
+  return std::string((const char *)data, length);
+}
+
+/**********************************************************************/
+
+int main() {
+  std::string path = "/tmp/test_bundle." + std::to_string(getpid()) + ".nvjb";
+
+  Bundle valid;
+  valid.write(path);
+  {
+    NvjBundle bundle(path);
+    CHECK(bundle.size() == nbEntries);
+    for (size_t i = 0; i < nbEntries; i++) {
+      const NvjBundleEntry *e = bundle.find(names[i]);
+      CHECK(e != nullptr && bundle.getName(*e) == names[i]);
+      CHECK(e != nullptr && bundle.getHeaders(e->variants[NVJ_BUNDLE_IDENTITY]) == headers(i, NVJ_BUNDLE_IDENTITY));
+    }
+    CHECK(bundle.find("missing.html") == nullptr);
+  }
+
+  BundleRepository repo("/", path, 0);
+  CHECK(getFile(repo, "index.html") == content(0, NVJ_BUNDLE_IDENTITY));
+  CHECK(getFile(repo, "app.js", true) == content(1, NVJ_BUNDLE_GZIP));
+  CHECK(getFile(repo, "img/logo.png", true) == content(2, NVJ_BUNDLE_IDENTITY));
+  CHECK(getFile(repo, "missing.html") == "<none>");
+
+  // each corruption is rejected, and a reload keeps the previous mapping
+  std::vector<std::function<void(Bundle &)>> corruptions = {
+      [](Bundle &b) { b.header.fileLength++; },
+      [](Bundle &b) { b.header.nbEntries = 0x10000000; },
+      [](Bundle &b) { b.header.stringsLength = UINT64_MAX - b.header.stringsOffset + 2; }, // wraps to 1
+      [](Bundle &b) { b.header.entriesOffset = UINT64_MAX - 7; },
+      [](Bundle &b) { b.entry(0).nameOffset = b.header.stringsLength; },
+      [](Bundle &b) { b.entry(2).etagLength = UINT32_MAX; },
+      [](Bundle &b) { // offset + length wraps to 8
+        b.entry(1).variants[NVJ_BUNDLE_GZIP].offset = UINT64_MAX - 7;
+        b.entry(1).variants[NVJ_BUNDLE_GZIP].length = 16;
+      },
+      [](Bundle &b) { b.entry(0).variants[NVJ_BUNDLE_IDENTITY].headersLength = UINT32_MAX; },
+      [](Bundle &b) { b.entry(1).variants[NVJ_BUNDLE_BROTLI].headersOffset = UINT32_MAX; },
+      [](Bundle &b) { b.entry(0).variants[NVJ_BUNDLE_IDENTITY].headersLength--; }, // not followed by a '\0'
+      [](Bundle &b) { // a seed that sends a name to another slot
+        uint32_t seed = b.seed;
+        while (nvj_phash_slot(names[0], &seed, 1, nbEntries) == nvj_phash_slot(names[0], &b.seed, 1, nbEntries))
+          seed++;
+        b.seed = seed;
+      },
+      [](Bundle &b) { std::swap(b.entry(0).nameOffset, b.entry(1).nameOffset); },
+  };
+  for (size_t i = 0; i < corruptions.size(); i++) {
+    Bundle corrupted;
+    corruptions[i](corrupted);
+    corrupted.write(path);
+    if (!rejected(path))
+      fprintf(stderr, "corruption %zu accepted\n", i);
+    CHECK(rejected(path));
+    CHECK(!repo.reload());
+    CHECK(getFile(repo, "app.js", true) == content(1, NVJ_BUNDLE_GZIP));
+  }
+
+  valid.write(path);
+  CHECK(repo.reload());
+  unlink(path.c_str());
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+//********************************************************
+/**
+ * @file  test_cache.cpp
+ *
+ * @brief NvjContentCache eviction and invalidation rules,
+ *        and hit rate of S3-FIFO against a scan
+ *
+ *   make test_cache && ./test_cache
+ */
+//********************************************************
+
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/libnavajo/nvjContentCache.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  if (!(cond)) {                                                                                                       \
+    fprintf(stderr, "FAILED line %d: %s\n", __LINE__, #cond);                                                          \
+    failures++;                                                                                                        \
+  }
+
+static std::shared_ptr<const int> value(int i) { return std::make_shared<const int>(i); }
+
+/**********************************************************************/
+
+int main() {
+  NvjContentCache<int> cache(100);
+
+  // capacity and replacement
+  CHECK(cache.put("a", value(1), 10, cache.getGeneration()));
+  CHECK(cache.put("a", value(2), 20, cache.getGeneration()));
+  CHECK(cache.get("a") != nullptr && *cache.get("a") == 2);
+  CHECK(cache.size() == 1 && cache.getCost() == 20);
+  CHECK(!cache.put("huge", value(3), 101, cache.getGeneration()));
+  CHECK(cache.get("huge") == nullptr);
+
+  // a value loaded before an invalidation is not cached
+  uint64_t generation = cache.getGeneration();
+  cache.erase("a");
+  CHECK(cache.get("a") == nullptr);
+  CHECK(!cache.put("a", value(1), 10, generation));
+  CHECK(cache.put("a", value(1), 10, cache.getGeneration()));
+  cache.clear();
+  CHECK(cache.size() == 0 && cache.getCost() == 0);
+
+  // the entries accessed again survive a scan of one-hit wonders
+  for (int i = 0; i < 10; i++) {
+    cache.put("hot" + std::to_string(i), value(i), 5, cache.getGeneration());
+    cache.get("hot" + std::to_string(i));
+  }
+  for (int i = 0; i < 1000; i++) {
+    cache.put("scan" + std::to_string(i), value(i), 5, cache.getGeneration());
+    if (i % 10 == 0) {
+      cache.get("hot" + std::to_string(i / 10 % 10));
+    }
+  }
+  for (int i = 0; i < 10; i++) {
+    CHECK(cache.get("hot" + std::to_string(i)) != nullptr);
+  }
+  CHECK(cache.getCost() <= 100);
+
+  // the values stay valid while referenced, once evicted
+  std::shared_ptr<const int> held = cache.get("hot0");
+  cache.clear();
+  CHECK(held != nullptr && *held == 0);
+
+  // hit rate on a zipfian workload
+  NvjContentCache<int>            zipf(1000);
+  std::mt19937                    rng(42);
+  std::discrete_distribution<int> dist;
+  {
+    std::vector<double> weights(10000);
+    for (size_t i = 0; i < weights.size(); i++) {
+      weights[i] = 1.0 / (i + 1);
+    }
+    dist = std::discrete_distribution<int>(weights.begin(), weights.end());
+  }
+  for (int i = 0; i < 200000; i++) {
+    std::string key = std::to_string(dist(rng));
+    if (zipf.get(key) == nullptr) {
+      zipf.put(key, value(i), 1, zipf.getGeneration());
+    }
+  }
+  printf("zipfian hit rate, 10%% of the keys cached: %.1f%%\n",
+         100.0 * zipf.getHits() / (zipf.getHits() + zipf.getMisses()));
+
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,409 @@
+//********************************************************
+/**
+ * @file  test_memcached.cpp
+ *
+ * @brief MemcachedRepository against the in-process memcached
+ *        of memcached_fixture.h: invalidation of the local
+ *        cache and its generation check, coalesced lookups,
+ *        regeneration lease and early refresh, compressed values;
+ *        and the pipelined gets of MemcachedAsyncClient
+ *
+ *   make test_memcached && LD_LIBRARY_PATH=../build/lib ./test_memcached
+ */
+//********************************************************
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/libnavajo/MemcachedRepository.hh"
+#include "../include/libnavajo/nvjGzip.h"
+#include "memcached_fixture.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  if (!(cond)) {                                                                                                       \
+    fprintf(stderr, "FAILED line %d: %s\n", __LINE__, #cond);                                                          \
+    failures++;                                                                                                        \
+  }
+
+// the content served for the url, "<none>" if the repository declines it
+static std::string getFile(MemcachedRepository &repo, const std::string &url, bool *zipped = nullptr) {
+  HttpRequest    request(GET_METHOD, url.c_str(), nullptr, nullptr, HttpRequestHeaders(), nullptr, "", nullptr,
+                         nullptr);
+  HttpResponse   response;
+  unsigned char *content;
+  size_t         length;
+  bool           zip;
+  if (!repo.getFile(&request, &response))
+    return "<none>";
+  response.getContent(&content, &length, &zip);
+  if (zipped != nullptr)
+    *zipped = zip;
+  return std::string((const char *)content, length);
+}
+
+static void sleepMs(unsigned ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the completions of MemcachedAsyncClient gets, in their order
+class Gets {
+  std::mutex              mMutex;
+  std::condition_variable mCond;
+
+public:
+  struct Result {
+    int                  id;
+    MemcachedAsyncStatus status;
+    std::string          data;
+    uint32_t             flags;
+  };
+  std::vector<Result> results;
+
+  MemcachedAsyncClient::Completion completion(int id) {
+    return [this, id](MemcachedAsyncStatus status, std::shared_ptr<char> data, size_t length, uint32_t flags) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      results.push_back(Result{id, status, data ? std::string(data.get(), length) : "", flags});
+      mCond.notify_all();
+    };
+  }
+
+  bool wait(size_t nb, unsigned ms = 2000) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mCond.wait_for(lock, std::chrono::milliseconds(ms), [&]() { return results.size() >= nb; });
+  }
+};
+
+/**********************************************************************/
+
+// set() and remove() invalidate the local copy
+static void testLocalCache(MemcachedFixture &memcached) {
+  MemcachedRepository repo("l", "127.0.0.1", memcached.getPort());
+  MemcachedRepository other("l", "127.0.0.1", memcached.getPort()); // another process
+  repo.setLocalCache(1024 * 1024, 60, 60);
+
+  CHECK(repo.set("/a", std::string("v1")));
+  memcached.resetCounters();
+  CHECK(getFile(repo, "/a") == "v1");
+  CHECK(getFile(repo, "/a") == "v1");
+  CHECK(memcached.gets == 1);
+
+  // changed by another process: seen after the ttl only
+  CHECK(other.set("/a", std::string("other")));
+  CHECK(getFile(repo, "/a") == "v1");
+
+  CHECK(repo.set("/a", std::string("v2")));
+  CHECK(getFile(repo, "/a") == "v2");
+  CHECK(memcached.gets == 2);
+
+  CHECK(repo.remove("/a"));
+  CHECK(getFile(repo, "/a") == "<none>");
+  CHECK(getFile(repo, "/a") == "<none>"); // remembered as missing
+  CHECK(memcached.gets == 3);
+
+  CHECK(repo.set("/a", std::string("v3")));
+  CHECK(getFile(repo, "/a") == "v3");
+  CHECK(memcached.gets == 4);
+}
+
+// a value fetched before a set() isn't kept by the local cache
+static void testGeneration(MemcachedFixture &memcached) {
+  MemcachedRepository repo("g", "127.0.0.1", memcached.getPort());
+  repo.setLocalCache(1024 * 1024, 60, 60);
+  CHECK(repo.set("/a", std::string("old")));
+
+  memcached.setLatency(300 * 1000);
+  std::string fetched;
+  std::thread reader([&]() { fetched = getFile(repo, "/a"); });
+  sleepMs(100); // the get is answered in 200ms
+  memcached.setLatency(0);
+  CHECK(repo.set("/a", std::string("new")));
+  reader.join();
+
+  CHECK(fetched == "old");
+  memcached.resetCounters();
+  CHECK(getFile(repo, "/a") == "new");
+  CHECK(memcached.gets == 1);
+}
+
+// concurrent lookups of a key make a single round trip
+static void testSingleFlight(MemcachedFixture &memcached) {
+  MemcachedRepository repo("s", "127.0.0.1", memcached.getPort());
+  CHECK(repo.set("/hit", std::string("value")));
+  const unsigned nbThreads = 16;
+
+  for (const char *url : {"/hit", "/miss"}) {
+    std::vector<std::string> results(nbThreads);
+    std::vector<std::thread> threads;
+    memcached.resetCounters();
+    memcached.setLatency(200 * 1000);
+    for (unsigned t = 0; t < nbThreads; t++)
+      threads.emplace_back([&, t]() { results[t] = getFile(repo, url); });
+    for (std::thread &thread : threads)
+      thread.join();
+    memcached.setLatency(0);
+
+    CHECK(memcached.gets == 1);
+    for (const std::string &result : results)
+      CHECK(result == (std::string(url) == "/hit" ? "value" : "<none>"));
+  }
+}
+
+// a missing key is regenerated by one request, the others wait for its set()
+static void testRegenerationLease(MemcachedFixture &memcached) {
+  const unsigned      lease = 500, nbThreads = 8;
+  MemcachedRepository repo("r", "127.0.0.1", memcached.getPort());
+  repo.setLocalCache(1024 * 1024);
+  repo.setRegenerationLease(lease);
+
+  for (bool regenerated : {true, false}) {
+    std::string url = regenerated ? "/regenerated" : "/abandoned";
+    memcached.resetCounters();
+    CHECK(getFile(repo, url) == "<none>"); // this one regenerates
+
+    std::vector<std::string> results(nbThreads);
+    std::vector<double>      waited(nbThreads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nbThreads; t++)
+      threads.emplace_back([&, t]() {
+        auto start = std::chrono::steady_clock::now();
+        results[t] = getFile(repo, url);
+        waited[t]  = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      });
+    sleepMs(100);
+    if (regenerated)
+      CHECK(repo.set(url, std::string("regenerated")));
+    for (std::thread &thread : threads)
+      thread.join();
+
+    CHECK(memcached.gets == 1);
+    for (unsigned t = 0; t < nbThreads; t++) {
+      if (regenerated) {
+        CHECK(results[t] == "regenerated");
+        CHECK(waited[t] < lease);
+      } else {
+        // not regenerated in time: they go on to the next repositories
+        CHECK(results[t] == "<none>");
+        CHECK(waited[t] >= lease - 150);
+      }
+    }
+  }
+
+  // the lease expires with nobody waiting: the key is asked again, it may
+  // have been set by another process since
+  memcached.resetCounters();
+  CHECK(getFile(repo, "/unclaimed") == "<none>");
+  sleepMs(lease + 100);
+  memcached.put("r/unclaimed", "set elsewhere");
+  CHECK(getFile(repo, "/unclaimed") == "set elsewhere");
+  CHECK(memcached.gets == 2);
+}
+
+// the values close to their expiration are refreshed early, while served
+static void testEarlyRefresh(MemcachedFixture &memcached) {
+  MemcachedRepository repo("e", "127.0.0.1", memcached.getPort());
+  MemcachedRepository other("e", "127.0.0.1", memcached.getPort());
+  repo.setLocalCache(1024 * 1024, 60);
+  CHECK(repo.set("/a", std::string("v1")));
+
+  memcached.setLatency(20 * 1000); // the duration of the fetch weighs on the refresh
+  CHECK(getFile(repo, "/a") == "v1");
+  memcached.setLatency(0);
+  CHECK(other.set("/a", std::string("v2")));
+
+  repo.setEarlyRefresh(0);
+  memcached.resetCounters();
+  CHECK(getFile(repo, "/a") == "v1");
+  CHECK(memcached.gets == 0);
+
+  // a refresh window of 1e6 times the 20ms of the fetch: refreshed at once
+  repo.setEarlyRefresh(1e6);
+  CHECK(getFile(repo, "/a") == "v2");
+  CHECK(memcached.gets == 1);
+}
+
+// the values worth it are stored gzipped, and served so
+static void testCompression(MemcachedFixture &memcached) {
+  MemcachedRepository repo("c", "127.0.0.1", memcached.getPort());
+  repo.setCompression(256);
+
+  std::string page, noise(10000, '\0'), small(100, 'a');
+  for (int i = 0; page.size() < 10000; i++)
+    page += "<p>paragraph " + std::to_string(i % 50) + "</p>\n";
+  std::mt19937 random(42);
+  for (char &c : noise)
+    c = (char)random();
+  CHECK(repo.set("/page.html", page));
+  CHECK(repo.set("/noise.bin", noise));
+  CHECK(repo.set("/img.png", page)); // already compressed type
+  CHECK(repo.set("/small.html", small));
+
+  std::string data;
+  uint32_t    flags = 0;
+  CHECK(memcached.peek("c/page.html", data, flags));
+  CHECK((flags & MEMCACHED_FLAG_GZIP) && data.size() < page.size() / 4);
+  CHECK(data.compare(0, 2, "\x1f\x8b") == 0);
+  unsigned char *raw  = nullptr;
+  size_t         size = nvj_gunzip(&raw, (const unsigned char *)data.data(), data.size());
+  CHECK(std::string((const char *)raw, size) == page);
+  free(raw);
+  bool zipped = false;
+  CHECK(getFile(repo, "/page.html", &zipped) == data);
+  CHECK(zipped);
+
+  for (auto &stored : std::map<std::string, const std::string *>{
+           {"/noise.bin", &noise}, {"/img.png", &page}, {"/small.html", &small}}) {
+    CHECK(memcached.peek("c" + stored.first, data, flags));
+    CHECK(data == *stored.second && !(flags & MEMCACHED_FLAG_GZIP));
+    CHECK(getFile(repo, stored.first, &zipped) == *stored.second);
+    CHECK(!zipped);
+  }
+
+  std::map<std::string, std::string> values;
+  CHECK(repo.getMulti({"/page.html", "/noise.bin", "/img.png", "/missing"}, values) == 3);
+  CHECK(values["/page.html"] == page && values["/noise.bin"] == noise && values["/img.png"] == page);
+}
+
+// several gets on one connection, answered in order
+static void testAsyncPipeline(MemcachedFixture &memcached) {
+  MemcachedAsyncClient client(1000, 1);
+  memcached.put("k1", "one", 1);
+  memcached.put("k2", std::string("two\r\nEND\r\n"), 2); // the data is read by its length
+  memcached.put("k3", "", 3);
+  unsigned long connections = memcached.connections;
+
+  Gets gets;
+  memcached.setLatency(20 * 1000);
+  const char *keys[] = {"k1", "missing", "k2", "k3"};
+  for (int i = 0; i < 4; i++)
+    CHECK(client.get("127.0.0.1", memcached.getPort(), keys[i], gets.completion(i)));
+  CHECK(!client.get("127.0.0.1", memcached.getPort(), "bad key", gets.completion(-1)));
+  CHECK(gets.wait(4));
+  memcached.setLatency(0);
+
+  CHECK(gets.results.size() == 4 && memcached.connections == connections + 1);
+  for (size_t i = 0; i < gets.results.size(); i++)
+    CHECK(gets.results[i].id == (int)i);
+  if (gets.results.size() == 4) {
+    CHECK(gets.results[0].status == MEMCACHED_ASYNC_FOUND && gets.results[0].data == "one" &&
+          gets.results[0].flags == 1);
+    CHECK(gets.results[1].status == MEMCACHED_ASYNC_NOTFOUND);
+    CHECK(gets.results[2].status == MEMCACHED_ASYNC_FOUND && gets.results[2].data == "two\r\nEND\r\n" &&
+          gets.results[2].flags == 2);
+    CHECK(gets.results[3].status == MEMCACHED_ASYNC_FOUND && gets.results[3].data.empty() &&
+          gets.results[3].flags == 3);
+  }
+}
+
+// responses arriving by pieces: a VALUE line and its data split across reads
+static void testAsyncSplit(MemcachedFixture &memcached) {
+  MemcachedAsyncClient client(5000, 1);
+  std::string          value;
+  for (int i = 0; value.size() < 500; i++)
+    value += "line " + std::to_string(i) + "\r\n";
+  memcached.put("split", value, 7);
+
+  Gets gets;
+  memcached.setSplit(7);
+  CHECK(client.get("127.0.0.1", memcached.getPort(), "split", gets.completion(0)));
+  CHECK(client.get("127.0.0.1", memcached.getPort(), "missing", gets.completion(1)));
+  CHECK(gets.wait(2, 5000));
+  memcached.setSplit(0);
+
+  CHECK(gets.results.size() == 2);
+  if (gets.results.size() == 2) {
+    CHECK(gets.results[0].status == MEMCACHED_ASYNC_FOUND && gets.results[0].data == value &&
+          gets.results[0].flags == 7);
+    CHECK(gets.results[1].id == 1 && gets.results[1].status == MEMCACHED_ASYNC_NOTFOUND);
+  }
+}
+
+// a server not answering in time fails all its gets, and isn't asked again
+// before the retry timeout
+static void testAsyncTimeout(MemcachedFixture &memcached) {
+  MemcachedAsyncClient client(100, 1);
+  memcached.put("slow", "value");
+
+  Gets gets;
+  memcached.setLatency(300 * 1000);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 3; i++)
+    CHECK(client.get("127.0.0.1", memcached.getPort(), "slow", gets.completion(i)));
+  CHECK(gets.wait(3));
+  CHECK(elapsedMs(start) < 250);
+  for (const Gets::Result &result : gets.results)
+    CHECK(result.status == MEMCACHED_ASYNC_ERROR);
+  memcached.setLatency(0);
+
+  // failed at once, without connecting
+  unsigned long connections = memcached.connections;
+  start                     = std::chrono::steady_clock::now();
+  CHECK(client.get("127.0.0.1", memcached.getPort(), "slow", gets.completion(3)));
+  CHECK(gets.wait(4));
+  CHECK(elapsedMs(start) < 50 && gets.results.back().status == MEMCACHED_ASYNC_ERROR);
+  CHECK(memcached.connections == connections);
+
+  sleepMs(1100);
+  CHECK(client.get("127.0.0.1", memcached.getPort(), "slow", gets.completion(4)));
+  CHECK(gets.wait(5));
+  CHECK(gets.results.back().status == MEMCACHED_ASYNC_FOUND && gets.results.back().data == "value");
+  CHECK(memcached.connections == connections + 1);
+}
+
+// a value arriving after the request went on fills the local cache, unless
+// the key was set meanwhile
+static void testAsyncLateValue(MemcachedFixture &memcached) {
+  MemcachedRepository repo("a", "127.0.0.1", memcached.getPort());
+  repo.setLocalCache(1024 * 1024, 60);
+  repo.setAsync(50);
+  CHECK(repo.set("/late", std::string("late")));
+  CHECK(repo.set("/set", std::string("old")));
+
+  memcached.resetCounters();
+  memcached.setLatency(200 * 1000);
+  auto start = std::chrono::steady_clock::now();
+  CHECK(getFile(repo, "/late") == "<none>");
+  CHECK(elapsedMs(start) < 150);
+  sleepMs(300);
+  memcached.setLatency(0);
+  CHECK(getFile(repo, "/late") == "late");
+  CHECK(memcached.gets == 1);
+
+  memcached.setLatency(200 * 1000);
+  CHECK(getFile(repo, "/set") == "<none>");
+  memcached.setLatency(0);
+  CHECK(repo.set("/set", std::string("new")));
+  sleepMs(300);
+  CHECK(getFile(repo, "/set") == "new");
+  CHECK(memcached.gets == 3);
+}
+
+/**********************************************************************/
+
+int main() {
+  MemcachedFixture memcached;
+
+  testLocalCache(memcached);
+  testGeneration(memcached);
+  testSingleFlight(memcached);
+  testRegenerationLease(memcached);
+  testEarlyRefresh(memcached);
+  testCompression(memcached);
+  testAsyncPipeline(memcached);
+  testAsyncSplit(memcached);
+  testAsyncTimeout(memcached);
+  testAsyncLateValue(memcached);
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+//********************************************************
+/**
+ * @file  test_router.cpp
+ *
+ * @brief HttpRouter matching rules, and resolution time
+ *        with thousands of routes
+ *
+ *   make test_router && ./test_router
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "../include/libnavajo/HttpRouter.hh"
+
+static int failures = 0;
+
+static void check(const HttpRouter<int> &router, const char *path, size_t method, int expected,
+                  const HttpPathParameters &expectedParams = HttpPathParameters()) {
+  HttpPathParameters params;
+  const int         *h   = router.find(path, method, params);
+  int                res = h != nullptr ? *h : -1;
+  if (res != expected || (h != nullptr && params != expectedParams)) {
+    fprintf(stderr, "FAILED: %s (method %zu) -> %d, expected %d\n", path, method, res, expected);
+    failures++;
+  }
+}
+
+/**********************************************************************/
+
+int main() {
+  HttpRouter<int> router;
+
+  router.add("index.html", 1);
+  router.add("items", 2);
+  router.add("items/{id}", 3);
+  router.add("items/{id}", 4, 2); // POST
+  router.add("items/{id}/details", 5);
+  router.add("items/new", 6);
+  router.add("static/*path", 7);
+  router.add("users/{user}/files/*file", 8);
+  router.add("in", 9);
+
+  if (router.add("items/{other}", 10) || router.add("items/x{id}", 10) || router.add("items", 10)) {
+    fprintf(stderr, "FAILED: conflicting or invalid patterns accepted\n");
+    failures++;
+  }
+
+  check(router, "index.html", 1, 1);
+  check(router, "in", 1, 9);
+  check(router, "ind", 1, -1);
+  check(router, "items", 1, 2);
+  check(router, "items/", 1, -1);
+  check(router, "items/42", 1, 3, {{"id", "42"}});
+  check(router, "items/42", 2, 4, {{"id", "42"}});
+  check(router, "items/new", 1, 6);
+  check(router, "items/newer", 1, 3, {{"id", "newer"}});
+  check(router, "items/42/details", 1, 5, {{"id", "42"}});
+  check(router, "items/42/other", 1, -1);
+  check(router, "static/", 1, 7, {{"path", ""}});
+  check(router, "static/css/app.css", 1, 7, {{"path", "css/app.css"}});
+  check(router, "users/bob/files/a/b.txt", 1, 8, {{"user", "bob"}, {"file", "a/b.txt"}});
+
+  HttpRouter<int> snapshot(router);
+  router.remove("items/{id}", nullptr, 2);
+  check(router, "items/42", 2, 3, {{"id", "42"}});
+  check(snapshot, "items/42", 2, 4, {{"id", "42"}});
+  check(snapshot, "users/bob/files/a/b.txt", 1, 8, {{"user", "bob"}, {"file", "a/b.txt"}});
+
+  // resolution time with many routes
+  HttpRouter<int> big;
+  const size_t    nbRoutes = 10000;
+  for (size_t i = 0; i < nbRoutes; i++) {
+    std::string n = std::to_string(i);
+    big.add("api/v1/resource" + n + "/{id}/sub" + n, (int)i);
+  }
+  check(big, "api/v1/resource1234/abc/sub1234", 1, 1234, {{"id", "abc"}});
+
+  const size_t       iterations = 1000000;
+  HttpPathParameters params;
+  size_t             found = 0;
+  auto               start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    std::string path = "api/v1/resource" + std::to_string(i % nbRoutes) + "/abc/sub" + std::to_string(i % nbRoutes);
+    found += big.find(path, 1, params) != nullptr;
+  }
+  std::chrono::duration<double, std::nano> d = std::chrono::steady_clock::now() - start;
+  printf("%zu routes: %.0f ns per lookup (%zu found)\n", nbRoutes, d.count() / iterations, found);
+
+  if (found != iterations) {
+    failures++;
+  }
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
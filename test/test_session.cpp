@@ -0,0 +1,145 @@
+//********************************************************
+/**
+ * @file  test_session.cpp
+ *
+ * @brief HttpSession attributes: lifetime of the values read
+ *        through the raw pointer API and through a Handle;
+ *        expiration of the sessions by the timing wheel
+ *
+ *   make test_session && LD_LIBRARY_PATH=../build/lib ./test_session
+ */
+//********************************************************
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "../include/libnavajo/HttpSession.hh"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  if (!(cond)) {                                                                                                       \
+    fprintf(stderr, "FAILED line %d: %s\n", __LINE__, #cond);                                                          \
+    failures++;                                                                                                        \
+  }
+
+static int *newInt(int value) {
+  int *p = (int *)malloc(sizeof(int));
+  *p     = value;
+  return p;
+}
+
+class Counted : public SessionAttributeObject {
+public:
+  static int destroyed;
+  int        value;
+  explicit Counted(int v) : value(v) {}
+  ~Counted() override { destroyed++; }
+};
+int Counted::destroyed = 0;
+
+/**********************************************************************/
+
+// a pointer read by a request stays valid when another one replaces the value
+static void testAttributes() {
+  std::string id;
+  HttpSession::create(id);
+
+  int *first = newInt(1);
+  HttpSession::setAttribute(id, "count", first);
+  int *read = (int *)HttpSession::getAttribute(id, "count");
+  CHECK(read == first);
+  HttpSession::setAttribute(id, "count", first); // same value again: kept once
+  HttpSession::setAttribute(id, "count", newInt(2));
+  CHECK(*read == 1);
+  CHECK(*(int *)HttpSession::getAttribute(id, "count") == 2);
+
+  Counted *object = new Counted(1);
+  HttpSession::setObjectAttribute(id, "object", object);
+  HttpSession::setObjectAttribute(id, "object", object);
+  HttpSession::setObjectAttribute(id, "object", new Counted(2));
+  CHECK(Counted::destroyed == 0 && object->value == 1);
+  CHECK(static_cast<Counted *>(HttpSession::getObjectAttribute(id, "object"))->value == 2);
+  HttpSession::removeAttribute(id, "object");
+  CHECK(HttpSession::getObjectAttribute(id, "object") == nullptr);
+  CHECK(Counted::destroyed == 1);
+
+  // typed values are shared: the replaced one lives while it is used
+  HttpSession::Handle session = HttpSession::find(id);
+  session.set("name", std::string("first"));
+  std::shared_ptr<std::string> name = session.get<std::string>("name");
+  session.set("name", std::string("second"));
+  CHECK(*name == "first" && *session.get<std::string>("name") == "second");
+  CHECK(session.get<int>("name") == nullptr);
+
+  session = HttpSession::Handle(); // a handle keeps the session alive
+  HttpSession::remove(id);
+  CHECK(Counted::destroyed == 2);
+  CHECK(!HttpSession::exists(id) && HttpSession::getAttribute(id, "count") == nullptr);
+}
+
+// at the given time after the start of the second t0
+static void sleepUntil(time_t t0, double seconds) {
+  std::this_thread::sleep_until(std::chrono::system_clock::from_time_t(t0) +
+                                std::chrono::milliseconds((long)(seconds * 1000)));
+}
+
+// the sessions are removed once due, unless used meanwhile
+static void testExpiration() {
+  HttpSession::setSessionLifeTime(2);
+  time_t t0 = time(nullptr);
+  while (time(nullptr) == t0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  t0++;
+
+  std::string idle, touched, forever, removed;
+  HttpSession::create(idle);    // due at t0 + 2
+  HttpSession::create(touched); // due at t0 + 2, then t0 + 3
+  HttpSession::create(forever);
+  HttpSession::create(removed);
+  HttpSession::noExpiration(forever);
+  HttpSession::remove(removed); // its timer is left in the wheel
+
+  sleepUntil(t0, 1.5);
+  HttpSession::updateExpiration(touched);
+  HttpSession::removeExpiredSession();
+  CHECK(HttpSession::exists(idle) && HttpSession::exists(touched) && HttpSession::exists(forever));
+
+  sleepUntil(t0, 2.5);
+  HttpSession::removeExpiredSession();
+  CHECK(!HttpSession::exists(idle));
+  CHECK(HttpSession::exists(touched)); // rescheduled
+  CHECK(HttpSession::exists(forever) && !HttpSession::exists(removed));
+
+  sleepUntil(t0, 3.5);
+  HttpSession::removeExpiredSession();
+  CHECK(!HttpSession::exists(touched));
+  CHECK(HttpSession::exists(forever));
+
+  // several lifetimes later
+  sleepUntil(t0, 6.5);
+  HttpSession::removeExpiredSession();
+  CHECK(HttpSession::exists(forever));
+  HttpSession::remove(forever);
+
+  // the reaper expires them without being asked
+  HttpSession::startReaper();
+  std::string reaped;
+  HttpSession::create(reaped);
+  sleepUntil(t0, 10);
+  CHECK(!HttpSession::exists(reaped));
+  HttpSession::stopReaper();
+}
+
+/**********************************************************************/
+
+int main() {
+  testAttributes();
+  testExpiration();
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
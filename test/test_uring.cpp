@@ -0,0 +1,172 @@
+//********************************************************
+/**
+ * @file  test_uring.cpp
+ *
+ * @brief NvjUring::sendFile: a transfer aborted midway (client
+ *        gone, file shorter than announced) must not leave bytes
+ *        in the pipe of the ring for the next response; the end of
+ *        a response is not held back by the socket
+ *
+ *   make test_uring && ./test_uring
+ */
+//********************************************************
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/libnavajo/nvjUring.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  if (!(cond)) {                                                                                                       \
+    fprintf(stderr, "FAILED line %d: %s\n", __LINE__, #cond);                                                          \
+    failures++;                                                                                                        \
+  }
+
+static std::string makeFile(const std::string &path, size_t len, char first) {
+  std::string content(len, '\0');
+  for (size_t i = 0; i < len; i++)
+    content[i] = first + i % 26;
+  FILE *f = fopen(path.c_str(), "wb");
+  fwrite(content.data(), 1, len, f);
+  fclose(f);
+  return content;
+}
+
+// a TCP connection on the loopback: {server side, client side}
+static std::pair<int, int> connection() {
+  int                listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  socklen_t          addrLen = sizeof addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listener, (struct sockaddr *)&addr, sizeof addr);
+  listen(listener, 1);
+  getsockname(listener, (struct sockaddr *)&addr, &addrLen);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  connect(client, (struct sockaddr *)&addr, sizeof addr);
+  int sock = accept(listener, nullptr, nullptr);
+  close(listener);
+  return {sock, client};
+}
+
+// what the client receives until the server closes, at most limit bytes
+static std::string receive(int client, size_t limit) {
+  std::string       received;
+  std::vector<char> buf(64 * 1024);
+  ssize_t           n;
+  while (received.size() < limit &&
+         (n = read(client, buf.data(), std::min(buf.size(), limit - received.size()))) > 0)
+    received.append(buf.data(), n);
+  return received;
+}
+
+// a complete transfer on a new connection is byte-exact
+static void checkTransfer(int fd, const std::string &content) {
+  std::pair<int, int> c = connection();
+  std::string         received;
+  std::thread         reader([&]() { received = receive(c.second, SIZE_MAX); });
+  CHECK(NvjUring::forThread()->sendFile(c.first, fd, 0, content.size()));
+  shutdown(c.first, SHUT_WR);
+  reader.join();
+  CHECK(received == content);
+  close(c.first);
+  close(c.second);
+}
+
+// the client gets the whole file without the server closing: the last
+// chunk isn't corked until the TCP timer (200ms) fires
+static void checkLatency(int fd, const std::string &content) {
+  std::pair<int, int> c = connection();
+  auto                start = std::chrono::steady_clock::now();
+  std::string         received;
+  std::thread         reader([&]() { received = receive(c.second, content.size()); });
+  CHECK(NvjUring::forThread()->sendFile(c.first, fd, 0, content.size()));
+  reader.join();
+  double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  CHECK(received == content);
+  CHECK(elapsed < 100);
+  close(c.first);
+  close(c.second);
+}
+
+/**********************************************************************/
+
+int main() {
+  if (!NvjUring::isSupported()) {
+    printf("io_uring not supported, skipped\n");
+    return 0;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  std::string  dir = "/tmp/test_uring." + std::to_string(getpid());
+  mkdir(dir.c_str(), 0755);
+  const size_t big = 8 * NvjUring::forThread()->getPipeSize();
+  std::string  bigContent = makeFile(dir + "/big", big, 'a');
+  std::string  next = makeFile(dir + "/next", 3 * NvjUring::forThread()->getPipeSize() + 123, 'A');
+  int          bigFd = open((dir + "/big").c_str(), O_RDONLY), nextFd = open((dir + "/next").c_str(), O_RDONLY);
+
+  checkTransfer(nextFd, next);
+
+  for (size_t len : {1000, 5000, 100 * 1024}) {
+    std::string content = makeFile(dir + "/small", len, '0');
+    int         fd      = open((dir + "/small").c_str(), O_RDONLY);
+    checkLatency(fd, content);
+    close(fd);
+  }
+  unlink((dir + "/small").c_str());
+
+  // the client goes away after a part of the file: the socket splice fails
+  // with bytes left in the pipe
+  for (int i = 0; i < 5; i++) {
+    std::pair<int, int> c = connection();
+    int                 small = 4096;
+    setsockopt(c.first, SOL_SOCKET, SO_SNDBUF, &small, sizeof small);
+    std::thread reader([&]() {
+      receive(c.second, 100 * 1024 + i * 1000);
+      struct linger l = {1, 0}; // reset, the server can't send any more
+      setsockopt(c.second, SOL_SOCKET, SO_LINGER, &l, sizeof l);
+      close(c.second);
+    });
+    CHECK(!NvjUring::forThread()->sendFile(c.first, bigFd, 0, big));
+    CHECK(errno == EPIPE || errno == ECONNRESET);
+    reader.join();
+    close(c.first);
+
+    checkTransfer(nextFd, next);
+  }
+
+  // the file is shorter than announced
+  {
+    std::pair<int, int> c = connection();
+    std::string         received;
+    std::thread         reader([&]() { received = receive(c.second, SIZE_MAX); });
+    CHECK(!NvjUring::forThread()->sendFile(c.first, nextFd, 0, next.size() + 1000));
+    CHECK(errno == EIO);
+    shutdown(c.first, SHUT_WR);
+    reader.join();
+    CHECK(received == next);
+    close(c.first);
+    close(c.second);
+
+    checkTransfer(bigFd, bigContent);
+  }
+
+  close(bigFd);
+  close(nextFd);
+  unlink((dir + "/big").c_str());
+  unlink((dir + "/next").c_str());
+  rmdir(dir.c_str());
+
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}